@@ -20,22 +20,117 @@
 
 #include "ast.hpp"
 #include "type.hpp"
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/IntrinsicInst.h>
 
 namespace whack::ast {
 
 class Arg {
 public:
-  explicit Arg(Type&& type, llvm::StringRef name, const bool variadic = false,
-               const bool mut = false)
+  explicit Arg(Type&& type, llvm::StringRef name, const bool variadic = false)
       : type{std::forward<Type>(type)}, name{name}, variadic{variadic},
-        mut{mut} {}
+        mut{this->type.isMutable()}, reference{this->type.isReference()} {}
 
   const Type type;
   llvm::StringRef name;
   const bool variadic;
   const bool mut;
+  const bool reference;
 };
 
+/// @brief How a function uses the memory its pointer argument addresses
+enum class ArgAccess { kReadOnly, kEscapes, kWrites };
+
+/// @brief Follows the uses of pointer argument arg (and of the pointers
+/// derived from it) in its function. Stores, atomic updates and memory
+/// intrinsics through it are writes. Uses which let it escape (storing or
+/// returning it, or passing it to callees which do not take it readonly
+/// and nocapture) may be writes.
+static ArgAccess getArgAccess(const llvm::Argument& arg) {
+  small_vector<const llvm::Value*> worklist{&arg};
+  llvm::SmallPtrSet<const llvm::Value*, 16> visited{&arg};
+  auto access = ArgAccess::kReadOnly;
+  while (!worklist.empty()) {
+    const auto ptr = worklist.pop_back_val();
+    for (const auto user : ptr->users()) {
+      const auto inst = llvm::cast<llvm::Instruction>(user);
+      if (llvm::isa<llvm::LoadInst>(inst) || llvm::isa<llvm::ICmpInst>(inst)) {
+        continue;
+      }
+      if (llvm::isa<llvm::GetElementPtrInst>(inst) ||
+          llvm::isa<llvm::BitCastInst>(inst) ||
+          llvm::isa<llvm::PHINode>(inst) || llvm::isa<llvm::SelectInst>(inst)) {
+        if (visited.insert(inst).second) {
+          worklist.push_back(inst);
+        }
+        continue;
+      }
+      const auto store = llvm::dyn_cast<llvm::StoreInst>(inst);
+      const auto rmw = llvm::dyn_cast<llvm::AtomicRMWInst>(inst);
+      const auto cmpxchg = llvm::dyn_cast<llvm::AtomicCmpXchgInst>(inst);
+      const auto mem = llvm::dyn_cast<llvm::MemIntrinsic>(inst);
+      if ((store && store->getPointerOperand() == ptr) ||
+          (rmw && rmw->getPointerOperand() == ptr) ||
+          (cmpxchg && cmpxchg->getPointerOperand() == ptr) ||
+          (mem && mem->getRawDest() == ptr)) {
+        return ArgAccess::kWrites;
+      }
+      if (mem) { // (read from)
+        continue;
+      }
+      if (const auto call = llvm::dyn_cast<llvm::CallInst>(inst)) {
+        const auto callee = call->getCalledFunction();
+        if (callee && callee->isIntrinsic() &&
+            (callee->getIntrinsicID() == llvm::Intrinsic::lifetime_start ||
+             callee->getIntrinsicID() == llvm::Intrinsic::lifetime_end)) {
+          continue;
+        }
+        for (unsigned i = 0; i < call->getNumArgOperands(); ++i) {
+          if (call->getArgOperand(i) == ptr &&
+              (!callee || i >= callee->arg_size() ||
+               !callee->hasParamAttribute(i, llvm::Attribute::NoCapture) ||
+               !(callee->hasParamAttribute(i, llvm::Attribute::ReadOnly) ||
+                 callee->hasParamAttribute(i, llvm::Attribute::ReadNone)))) {
+            access = ArgAccess::kEscapes;
+          }
+        }
+        continue;
+      }
+      access = ArgAccess::kEscapes;
+    }
+  }
+  return access;
+}
+
+/// @brief Adds the attributes of `this`, the first parameter of the member
+/// function func (once its body is built). It refers to an object (checked
+/// at calls by pass::NonNull), and only `mut` member functions write to it.
+static llvm::Error addThisAttributes(llvm::Function* const func,
+                                     const bool mutatesMembers,
+                                     const mpc_state_t state) {
+  const auto type = func->getFunctionType()->getParamType(0);
+  func->addParamAttr(0, llvm::Attribute::NonNull);
+  if (type->getPointerElementType()->isSized()) {
+    func->addDereferenceableParamAttr(
+        0, func->getParent()->getDataLayout().getTypeAllocSize(
+               type->getPointerElementType()));
+  }
+  if (mutatesMembers) {
+    return llvm::Error::success();
+  }
+  const auto access = getArgAccess(*func->arg_begin());
+  if (access == ArgAccess::kWrites) {
+    return error("cannot write to `this` in member function `{}`, which is "
+                 "not `mut`, at line {}",
+                 func->getName().str(), state.row + 1);
+  }
+  if (access == ArgAccess::kReadOnly) {
+    func->addParamAttr(0, llvm::Attribute::ReadOnly);
+    func->addParamAttr(0, llvm::Attribute::NoCapture);
+  }
+  return llvm::Error::success();
+}
+
 class Args final : public AST {
 public:
   explicit Args(const mpc_ast_t* const ast) {
@@ -74,17 +169,51 @@ public:
       if (!tp) {
         return tp.takeError();
       }
-      auto type = *tp;
-      if (Type::getUnderlyingType(type)->isFunctionTy() ||
-          (type->isStructTy() &&
-           type->getStructName().startswith("interface::"))) {
-        type = type->getPointerTo(0);
-      }
-      ret.push_back(type);
+      ret.push_back(Type::getClosureKind(*tp));
     }
     return ret;
   }
 
+  /// @brief Adds the parameter attributes implied by the argument types to
+  /// func (once its body is built), whose parameters from offset on are
+  /// these args. References are non-null and dereferenceable (checked at
+  /// calls by pass::NonNull). Writing through pointers which are not `mut`
+  /// is an error, and they are readonly (and nocapture) unless they escape.
+  llvm::Error addAttributes(llvm::Function* const func, const unsigned offset,
+                            const mpc_state_t state) const {
+    const auto& dataLayout = func->getParent()->getDataLayout();
+    for (size_t i = 0; i < args_.size() && i + offset < func->arg_size(); ++i) {
+      const auto& arg = args_[i];
+      const auto idx = static_cast<unsigned>(i + offset);
+      const auto type = func->getFunctionType()->getParamType(idx);
+      if (arg.variadic || !type->isPointerTy()) {
+        continue;
+      }
+      if (arg.reference) {
+        func->addParamAttr(idx, llvm::Attribute::NonNull);
+        const auto pointee = type->getPointerElementType();
+        if (pointee->isSized()) {
+          func->addDereferenceableParamAttr(
+              idx, dataLayout.getTypeAllocSize(pointee));
+        }
+      }
+      if (arg.mut) {
+        continue;
+      }
+      const auto access = getArgAccess(func->arg_begin()[idx]);
+      if (access == ArgAccess::kWrites) {
+        return error("cannot write through argument `{}`, which is not `mut`, "
+                     "in function `{}` at line {}",
+                     arg.name.str(), func->getName().str(), state.row + 1);
+      }
+      if (access == ArgAccess::kReadOnly) {
+        func->addParamAttr(idx, llvm::Attribute::ReadOnly);
+        func->addParamAttr(idx, llvm::Attribute::NoCapture);
+      }
+    }
+    return llvm::Error::success();
+  }
+
   const auto names() const {
     small_vector<llvm::StringRef> ret;
     for (const auto& arg : args_) {
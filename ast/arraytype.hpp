@@ -20,6 +20,8 @@
 
 #include "ast.hpp"
 #include "integral.hpp"
+#include "metadata.hpp"
+#include <llvm/Support/raw_ostream.h>
 
 namespace whack::ast {
 
@@ -29,6 +31,15 @@ public:
       : ast_{ast} {}
 
   llvm::Expected<llvm::Type*> codegen(const llvm::Module* const module) const {
+    // Slice
+    if (ast_->children_num == 4 &&
+        std::string_view(ast_->children[1]->contents) == "..") {
+      auto type = getType(ast_->children[3], module);
+      if (!type) {
+        return type.takeError();
+      }
+      return getSliceType(module, *type);
+    }
     // Fixed-size array
     if (ast_->children_num == 4) {
       const Integral len{ast_->children[1]};
@@ -36,6 +47,9 @@ public:
       if (!type) {
         return type.takeError();
       }
+      if (const auto soa = getSoAType(module, *type, len.value())) {
+        return soa;
+      }
       return reinterpret_cast<llvm::Type*>(
           llvm::ArrayType::get(*type, len.value()));
     }
@@ -44,13 +58,87 @@ public:
     if (!type) {
       return type.takeError();
     }
-    return getVarLenType(module->getContext(), *type);
+    if (isSoAStruct(module, *type)) {
+      return error("cannot make a dynamic array of @soa struct `{}` "
+                   "at line {}",
+                   (*type)->getStructName().str(), ast_->state.row + 1);
+    }
+    return getVarLenType(module, *type);
+  }
+
+  /// @brief Fixed-size arrays of structs tagged @soa are stored as one array
+  /// per field: `soa::X[N]` is {[N x F0], [N x F1]...}. Returns nullptr for
+  /// other element types.
+  static llvm::Type* getSoAType(const llvm::Module* const module,
+                                llvm::Type* const element,
+                                const uint64_t len) {
+    if (!isSoAStruct(module, element)) {
+      return nullptr;
+    }
+    const auto name =
+        format("soa::{}[{}]", element->getStructName().str(), len);
+    if (const auto soa = module->getTypeByName(name)) {
+      return soa;
+    }
+    small_vector<llvm::Type*> columns;
+    for (const auto field : llvm::cast<llvm::StructType>(element)->elements()) {
+      columns.push_back(llvm::ArrayType::get(field, len));
+    }
+    return llvm::StructType::create(module->getContext(), columns, name);
+  }
+
+  /// @brief Whether type is a struct tagged @soa
+  inline static bool isSoAStruct(const llvm::Module* const module,
+                                 const llvm::Type* const type) {
+    const auto structType = llvm::dyn_cast<llvm::StructType>(type);
+    return structType && structType->hasName() &&
+           getMetadataOperand(*module, "soa", structType->getName());
+  }
+
+  inline static bool isSoA(const llvm::Type* const type) {
+    return type->isStructTy() && type->getStructName().startswith("soa::");
+  }
+
+  /// @brief Returns the struct type of the elements of a SoA array type
+  static llvm::StructType* getSoAElementType(const llvm::Module* const module,
+                                             const llvm::Type* const soa) {
+    return module->getTypeByName(
+        soa->getStructName().drop_front(5).rsplit('[').first);
+  }
+
+  /// @brief `[]T` is {T* data, int len, int cap} (see dynamicarray.hpp)
+  static llvm::StructType* getVarLenType(const llvm::Module* const module,
+                                         llvm::Type* const type) {
+    std::string name;
+    llvm::raw_string_ostream os{name};
+    os << "[]";
+    type->print(os);
+    if (const auto array = module->getTypeByName(os.str())) {
+      return array;
+    }
+    return llvm::StructType::create(
+        module->getContext(),
+        {type->getPointerTo(0), BasicTypes["int"], BasicTypes["int"]}, name);
+  }
+
+  /// @brief `[..]T` is {T* data, int len} (see slice.hpp)
+  static llvm::StructType* getSliceType(const llvm::Module* const module,
+                                        llvm::Type* const type) {
+    std::string name;
+    llvm::raw_string_ostream os{name};
+    os << "[..]";
+    type->print(os);
+    if (const auto slice = module->getTypeByName(os.str())) {
+      return slice;
+    }
+    return llvm::StructType::create(
+        module->getContext(), {type->getPointerTo(0), BasicTypes["int"]},
+        name);
   }
 
-  inline static llvm::Type* getVarLenType(llvm::LLVMContext& ctx,
-                                          llvm::Type* const type) {
-    return reinterpret_cast<llvm::Type*>(llvm::StructType::get(
-        ctx, {BasicTypes["int"], llvm::ArrayType::get(type, 0)}));
+  inline static bool isSlice(const llvm::Type* const type) {
+    const auto slice = llvm::dyn_cast<llvm::StructType>(type);
+    return slice && !slice->isLiteral() && slice->getName().startswith("[..]");
   }
 
 private:
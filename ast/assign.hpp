@@ -19,6 +19,9 @@
 #pragma once
 
 #include "ast.hpp"
+#include "atomic.hpp"
+#include "element.hpp"
+#include "structmember.hpp"
 
 namespace whack::ast {
 
@@ -57,6 +60,12 @@ public:
     const auto store = [&](llvm::Value* const value,
                            const Factor* const var) -> llvm::Error {
       llvm::Value* variable;
+      if (const auto member = dynamic_cast<const StructMember*>(var)) {
+        return member->assign(builder, value);
+      }
+      if (const auto element = dynamic_cast<const Element*>(var)) {
+        return element->assign(builder, value);
+      }
       if (const auto ptr = dynamic_cast<const Deref*>(var)) {
         auto v = ptr->loadPointer(builder);
         if (!v) {
@@ -74,6 +83,10 @@ public:
       if (!variable /* || variable->getName() == "_"*/) {
         return llvm::Error::success();
       }
+      if (getAtomicValueType(variable) == value->getType()) {
+        storeAtomic(builder, value, variable);
+        return llvm::Error::success();
+      }
       const auto varType = variable->getType()->getPointerElementType();
       if (value->getType() != varType) {
         return error("type mismatch: cannot assign at line {}", state_.row + 1);
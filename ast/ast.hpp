@@ -114,6 +114,7 @@ public:
     kBoolean,
     kString,
     kElement,
+    kSlice,
     kStructMember,
     kScopeRes,
     kReference,
@@ -168,6 +169,7 @@ public:
     kOpEq,
     kComment,
     kFuncCall,
+    kFnAppend,
     kSend,
     kReceive,
     kOutStream,
@@ -210,15 +212,38 @@ static llvm::Function* changeFuncReturnType(llvm::Function* const,
 static llvm::Expected<llvm::Type*>
 deduceFuncReturnType(const llvm::Function* const, const mpc_state_t);
 
-static llvm::Function* bindFirstFuncArgument(llvm::IRBuilder<>&,
-                                             llvm::Function* const,
-                                             llvm::Value* const,
-                                             llvm::FunctionType* const);
+/// @brief A function pointer made by a trampoline, and the trampoline's slot
+using trampoline_t = std::pair<llvm::Value*, llvm::Value*>;
+
+static trampoline_t bindFirstFuncArgument(llvm::IRBuilder<>&,
+                                          llvm::Function* const,
+                                          llvm::Value* const,
+                                          llvm::FunctionType* const);
+
+static void freeTrampoline(llvm::IRBuilder<>&, llvm::Value* const);
+
+static llvm::Value* makeClosure(llvm::IRBuilder<>&, llvm::Value* const,
+                                llvm::Value* const);
+
+static llvm::Value* getFunctionClosure(llvm::IRBuilder<>&,
+                                       llvm::Function* const);
+
+static llvm::Value* bindClosure(llvm::IRBuilder<>&, llvm::Function* const,
+                                llvm::Value* const);
+
+static llvm::CallInst* callClosure(llvm::IRBuilder<>&, llvm::Value* const,
+                                   llvm::ArrayRef<llvm::Value*>);
+
+static trampoline_t getClosureFuncPointer(llvm::IRBuilder<>&,
+                                          llvm::Value* const);
 
 class Body;
 static llvm::Expected<llvm::Function*>
 buildFunction(llvm::Function*, const Body* const, const mpc_state_t);
 
+static llvm::Error lowerClosureEnvironments(llvm::Function* const,
+                                            const mpc_state_t);
+
 inline static /*const*/ llvm::StringMap<decltype(&LLVMBuildAnd)> OpsTable{
     {"&", &LLVMBuildAnd},   {"|", &LLVMBuildOr},     {"+", &LLVMBuildNSWAdd},
     {"+f", &LLVMBuildFAdd}, {"-", &LLVMBuildNSWSub}, {"-f", &LLVMBuildFSub},
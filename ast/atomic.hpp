@@ -0,0 +1,280 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_ATOMIC_HPP
+#define WHACK_ATOMIC_HPP
+
+#pragma once
+
+#include "ast.hpp"
+#include "type.hpp"
+#include <llvm/ADT/StringSwitch.h>
+
+// Accesses to atomic<T> variables (and fields) are atomic: reading and
+// assigning them are atomic loads and stores, and `+=`, `-=`, `&=`, `|=`
+// and `^=` are atomicrmw's, all sequentially consistent. The builtins
+//   atomic::load(x), atomic::store(x, value),
+//   atomic::exchange(x, value), atomic::add/sub/and/or/xor(x, value)
+//     (which return the previous value),
+//   atomic::cas(x, expected, desired) (which returns whether it stored) and
+//   atomic::fence()
+// take an ordering (relaxed, acquire, release, acq_rel or seq_cst) as their
+// last argument, which defaults to seq_cst. x is an atomic, or a pointer to
+// one. All of these are lowered inline, without runtime calls.
+
+namespace whack::ast {
+
+static std::optional<llvm::AtomicOrdering>
+getAtomicOrdering(llvm::StringRef name) {
+  using ordering_t = std::optional<llvm::AtomicOrdering>;
+  return llvm::StringSwitch<ordering_t>(name)
+      .Case("relaxed", llvm::AtomicOrdering::Monotonic)
+      .Case("acquire", llvm::AtomicOrdering::Acquire)
+      .Case("release", llvm::AtomicOrdering::Release)
+      .Case("acq_rel", llvm::AtomicOrdering::AcquireRelease)
+      .Case("seq_cst", llvm::AtomicOrdering::SequentiallyConsistent)
+      .Default(std::nullopt);
+}
+
+/// @brief Returns the atomicrmw operation of a compound assignment operator
+/// or of a builtin
+static std::optional<llvm::AtomicRMWInst::BinOp>
+getAtomicOp(llvm::StringRef name) {
+  using op_t = std::optional<llvm::AtomicRMWInst::BinOp>;
+  return llvm::StringSwitch<op_t>(name)
+      .Cases("+", "add", llvm::AtomicRMWInst::Add)
+      .Cases("-", "sub", llvm::AtomicRMWInst::Sub)
+      .Cases("&", "and", llvm::AtomicRMWInst::And)
+      .Cases("|", "or", llvm::AtomicRMWInst::Or)
+      .Cases("^", "xor", llvm::AtomicRMWInst::Xor)
+      .Case("exchange", llvm::AtomicRMWInst::Xchg)
+      .Default(std::nullopt);
+}
+
+/// @brief Returns T if ptr points to an atomic<T>
+inline static llvm::Type* getAtomicValueType(const llvm::Value* const ptr) {
+  const auto type = ptr->getType();
+  return type->isPointerTy()
+             ? Type::getAtomicValueType(type->getPointerElementType())
+             : nullptr;
+}
+
+/// @brief Returns a pointer to the integer storage of the atomic (pointers
+/// are accessed as integers by atomicrmw)
+static llvm::Value* getAtomicStorage(llvm::IRBuilder<>& builder,
+                                     llvm::Value* const atomic,
+                                     const bool integral = false) {
+  const auto storage = builder.CreateStructGEP(
+      atomic->getType()->getPointerElementType(), atomic, 0);
+  const auto type = storage->getType()->getPointerElementType();
+  if (!integral || type->isIntegerTy()) {
+    return storage;
+  }
+  const auto module = builder.GetInsertBlock()->getModule();
+  return builder.CreateBitCast(
+      storage, module->getDataLayout()
+                   .getIntPtrType(module->getContext())
+                   ->getPointerTo(0));
+}
+
+/// @brief Converts value to (toStorage) or from the type of storage
+static llvm::Value* convertAtomic(llvm::IRBuilder<>& builder,
+                                  llvm::Value* const value,
+                                  llvm::Value* const storage,
+                                  llvm::Type* const type,
+                                  const bool toStorage) {
+  const auto storageType = storage->getType()->getPointerElementType();
+  const auto from = toStorage ? value->getType() : storageType;
+  const auto to = toStorage ? storageType : type;
+  if (from == to) {
+    return value;
+  }
+  if (from->isPointerTy()) {
+    return builder.CreatePtrToInt(value, to);
+  }
+  if (to->isPointerTy()) {
+    return builder.CreateIntToPtr(value, to);
+  }
+  return toStorage ? builder.CreateZExt(value, to)
+                   : builder.CreateTrunc(value, to);
+}
+
+static llvm::Value* loadAtomic(
+    llvm::IRBuilder<>& builder, llvm::Value* const atomic,
+    const llvm::AtomicOrdering ordering =
+        llvm::AtomicOrdering::SequentiallyConsistent) {
+  const auto module = builder.GetInsertBlock()->getModule();
+  const auto storage = getAtomicStorage(builder, atomic);
+  const auto load = builder.CreateLoad(storage);
+  load->setAtomic(ordering);
+  // (the alignment of the storage, which is its size, see Type::codegen)
+  load->setAlignment(Type::getAlignment(module, load->getType()));
+  return convertAtomic(builder, load, storage, getAtomicValueType(atomic),
+                       false);
+}
+
+static llvm::StoreInst*
+storeAtomic(llvm::IRBuilder<>& builder, llvm::Value* const value,
+            llvm::Value* const atomic,
+            const llvm::AtomicOrdering ordering =
+                llvm::AtomicOrdering::SequentiallyConsistent) {
+  const auto module = builder.GetInsertBlock()->getModule();
+  const auto storage = getAtomicStorage(builder, atomic);
+  const auto store = builder.CreateStore(
+      convertAtomic(builder, value, storage, nullptr, true), storage);
+  store->setAtomic(ordering);
+  store->setAlignment(
+      Type::getAlignment(module, storage->getType()->getPointerElementType()));
+  return store;
+}
+
+/// @brief Applies op (named as by getAtomicOp) with value to the atomic,
+/// returning its previous value
+static llvm::Expected<llvm::Value*>
+rmwAtomic(llvm::IRBuilder<>& builder, llvm::StringRef op,
+          llvm::Value* const atomic, llvm::Value* const value,
+          const llvm::AtomicOrdering ordering, const mpc_state_t state) {
+  const auto type = getAtomicValueType(atomic);
+  const auto binOp = getAtomicOp(op);
+  // pointers are only exchanged, and bools are not added to
+  const auto exchange = binOp && binOp.value() == llvm::AtomicRMWInst::Xchg;
+  const auto arithmetic = binOp && (binOp.value() == llvm::AtomicRMWInst::Add ||
+                                    binOp.value() == llvm::AtomicRMWInst::Sub);
+  if (!binOp || (!exchange && type->isPointerTy()) ||
+      (arithmetic && type->isIntegerTy(1))) {
+    return error("invalid atomic operation `{}` at line {}", op.str(),
+                 state.row + 1);
+  }
+  if (value->getType() != type) {
+    return error("type mismatch: invalid value for atomic at line {}",
+                 state.row + 1);
+  }
+  const auto storage = getAtomicStorage(builder, atomic, true);
+  const auto previous = builder.CreateAtomicRMW(
+      binOp.value(), storage,
+      convertAtomic(builder, value, storage, nullptr, true), ordering);
+  return convertAtomic(builder, previous, storage, type, false);
+}
+
+/// @brief Emits a call to an atomic:: builtin (the funccall ast)
+static llvm::Expected<llvm::Value*> callAtomic(llvm::IRBuilder<>& builder,
+                                               const mpc_ast_t* const ast) {
+  const auto state = ast->state;
+  const llvm::StringRef name = ast->children[0]->children[2]->contents;
+  if (ast->children_num > 4) {
+    return error("invalid call to atomic::{} at line {}", name.str(),
+                 state.row + 1);
+  }
+  small_vector<const mpc_ast_t*> args;
+  if (ast->children_num == 4) {
+    const auto list = ast->children[2];
+    if (getOutermostAstTag(list) == "exprlist") {
+      for (auto i = 0; i < list->children_num; i += 2) {
+        args.push_back(list->children[i]);
+      }
+    } else {
+      args.push_back(list);
+    }
+  }
+  auto ordering = llvm::AtomicOrdering::SequentiallyConsistent;
+  if (!args.empty() && getInnermostAstTag(args.back()) == "ident") {
+    if (const auto order = getAtomicOrdering(args.back()->contents)) {
+      ordering = order.value();
+      args.pop_back();
+    }
+  }
+
+  if (name == "fence") {
+    if (!args.empty() || ordering == llvm::AtomicOrdering::Monotonic) {
+      return error("atomic::fence expects an ordering (other than relaxed) "
+                   "at line {}",
+                   state.row + 1);
+    }
+    return builder.CreateFence(ordering);
+  }
+  if (name != "load" && name != "store" && name != "cas" &&
+      !getAtomicOp(name)) {
+    return error("`atomic::{}` is not an atomic builtin at line {}",
+                 name.str(), state.row + 1);
+  }
+  const auto numArgs = name == "load" ? 1u : name == "cas" ? 3u : 2u;
+  if (args.size() != numArgs) {
+    return error("atomic::{} expects {} argument(s) and an optional "
+                 "ordering at line {}",
+                 name.str(), numArgs, state.row + 1);
+  }
+
+  // atomics are addressed in place; pointers to them are loaded
+  const auto tag = getInnermostAstTag(args[0]);
+  auto a = tag == "ident" || tag == "structmember" || tag == "element"
+               ? getFactor(args[0])->codegen(builder)
+               : getExpressionValue(args[0])->codegen(builder);
+  if (!a) {
+    return a.takeError();
+  }
+  auto atomic = *a;
+  while (!getAtomicValueType(atomic) && atomic->getType()->isPointerTy() &&
+         atomic->getType()->getPointerElementType()->isPointerTy()) {
+    atomic = builder.CreateLoad(atomic);
+  }
+  if (!getAtomicValueType(atomic)) {
+    return error("atomic::{} expects an atomic at line {}", name.str(),
+                 state.row + 1);
+  }
+  small_vector<llvm::Value*> values;
+  for (unsigned i = 1; i < args.size(); ++i) {
+    auto v = getExpressionValue(args[i])->codegen(builder);
+    if (!v) {
+      return v.takeError();
+    }
+    const auto value = *v;
+    if (value->getType() != getAtomicValueType(atomic)) {
+      return error("type mismatch: invalid value for atomic at line {}",
+                   state.row + 1);
+    }
+    values.push_back(value);
+  }
+
+  const auto acquire = ordering == llvm::AtomicOrdering::Acquire;
+  const auto release = ordering == llvm::AtomicOrdering::Release;
+  const auto acqRel = ordering == llvm::AtomicOrdering::AcquireRelease;
+  if (name == "load") {
+    if (release || acqRel) {
+      return error("invalid ordering for atomic::load at line {}",
+                   state.row + 1);
+    }
+    return loadAtomic(builder, atomic, ordering);
+  }
+  if (name == "store") {
+    if (acquire || acqRel) {
+      return error("invalid ordering for atomic::store at line {}",
+                   state.row + 1);
+    }
+    return storeAtomic(builder, values[0], atomic, ordering);
+  }
+  if (name == "cas") {
+    const auto storage = getAtomicStorage(builder, atomic);
+    const auto result = builder.CreateAtomicCmpXchg(
+        storage, convertAtomic(builder, values[0], storage, nullptr, true),
+        convertAtomic(builder, values[1], storage, nullptr, true), ordering,
+        llvm::AtomicCmpXchgInst::getStrongestFailureOrdering(ordering));
+    return builder.CreateExtractValue(result, 1);
+  }
+  return rmwAtomic(builder, name, atomic, values[0], ordering, state);
+}
+
+} // end namespace whack::ast
+
+#endif // WHACK_ATOMIC_HPP
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "ast.hpp"
+#include "coroutine.hpp"
 #include "deferstmt.hpp"
 #include "ident.hpp"
 #include "tags.hpp"
@@ -28,7 +29,8 @@ namespace whack::ast {
 
 class Body final : public Stmt {
 public:
-  explicit Body(const mpc_ast_t* const ast) : Stmt(kBody), state_{ast->state} {
+  explicit Body(const mpc_ast_t* const ast)
+      : Stmt(kBody), state_{ast->state}, coroutine_{isCoroutineBody(ast)} {
     auto idx = 1;
     if (getInnermostAstTag(ast->children[0]) == "tags") {
       tags_ = std::make_unique<Tags>(ast->children[0]);
@@ -77,12 +79,16 @@ public:
     return llvm::Error::success();
   }
 
+  /// @brief Whether the function of this body is a coroutine
+  inline bool isCoroutine() const { return coroutine_; }
+
   inline static bool classof(const Stmt* const stmt) {
     return stmt->getKind() == kBody;
   }
 
 private:
   const mpc_state_t state_;
+  const bool coroutine_;
   std::unique_ptr<Tags> tags_;
   small_vector<std::unique_ptr<Stmt>> statements_;
   mutable llvm::BasicBlock* begin_;
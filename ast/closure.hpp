@@ -21,9 +21,12 @@
 #include "args.hpp"
 #include "ast.hpp"
 #include "body.hpp"
+#include "ident.hpp"
 #include "metadata.hpp"
 #include "structure.hpp"
 #include "typelist.hpp"
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/ValueSymbolTable.h>
 
 namespace whack::ast {
@@ -44,9 +47,11 @@ public:
         }
         if (ref->children_num) {
           const auto name = ref->children[0]->contents;
-          // @todo
           const bool isRef =
               std::string_view(ref->children[1]->contents) == "&";
+          if (isRef) {
+            refCaptures_.push_back(name);
+          }
           explicitCaptures_[name] =
               getExpressionValue(ref->children[isRef ? 0 : 2]);
         } else {
@@ -80,6 +85,13 @@ public:
       ++idx;
     }
     body_ = std::make_unique<Body>(ast->children[idx]);
+    if (defaultCaptureMode_ != None) {
+      small_vector<llvm::StringRef> bound;
+      if (args_) {
+        bound = args_->names();
+      }
+      getFreeVariables(ast->children[idx], bound);
+    }
   }
 
   llvm::Expected<llvm::Value*> codegen(llvm::IRBuilder<>& builder) const final {
@@ -102,61 +114,98 @@ public:
     small_vector<llvm::Type*> scopedTypes;
     small_vector<llvm::Value*> scopedValues;
     small_vector<llvm::StringRef> scopedNames;
+    // variables captured by reference (as pointers into enclosing frames)
+    small_vector<llvm::StringRef> refNames;
+    const auto capture = [&](llvm::StringRef name, llvm::Value* const value,
+                             const bool byRef = false) {
+      scopedNames.push_back(name);
+      scopedValues.push_back(value);
+      scopedTypes.push_back(value->getType());
+      if (byRef) {
+        refNames.push_back(name);
+      }
+    };
 
-    if (defaultCaptureMode_ == AllByReference) {
-      return error("capturing all closure variable(s) explicitly"
-                   " by reference is not implemented at line {}",
-                   state_.row + 1);
-    } else if (defaultCaptureMode_ == AllByValue) {
-      // we inherit any captured variables if enclosing function is a closure
-      if (enclosingFn->getName().startswith("::closure")) {
-        if (!enclosingFn->arg_empty()) {
-          const auto enclosingEnv =
-              llvm::cast<llvm::Value>(&enclosingFn->arg_begin()[0]);
-          // we ensure first parameter is an environment structure
-          if (enclosingEnv->getName() == ".env") {
-            const auto enclosingEnvType =
-                enclosingEnv->getType()->getPointerElementType();
-            scopedNames = getMetadataParts(*module, "structures",
-                                           enclosingEnvType->getStructName());
-            for (size_t i = 0; i < scopedNames.size(); ++i) {
-              const auto ptr = builder.CreateStructGEP(enclosingEnvType,
-                                                       enclosingEnv, i, "");
-              const auto val = builder.CreateLoad(ptr);
-              scopedValues.push_back(val);
-              scopedTypes.push_back(val->getType());
-            }
-          }
+    // we link to the environment if enclosing function is a closure
+    llvm::Value* enclosingEnv{nullptr};
+    if (enclosingFn->getName().startswith("::closure")) {
+      enclosingEnv = enclosingFn->getValueSymbolTable()->lookup(".env");
+    }
+
+    small_vector<llvm::StringRef> paramNames;
+    if (args_) {
+      paramNames = args_->names();
+    }
+
+    if (defaultCaptureMode_ != None) {
+      const auto byRef = defaultCaptureMode_ == AllByReference;
+      bool linkEnclosingEnv = false;
+      for (const auto name : freeVariables_) {
+        if (explicitCaptures_.count(name) ||
+            std::find(paramNames.begin(), paramNames.end(), name) !=
+                paramNames.end()) {
+          continue;
         }
-      }
-      for (const auto& symbol : *enclosingFn->getValueSymbolTable()) {
-        const auto val = symbol.getValue();
-        if (!val->getType()->isSized() ||
-            val->getName().find('.') != llvm::StringRef::npos) {
+        if (const auto val = enclosingFn->getValueSymbolTable()->lookup(name)) {
+          if (llvm::isa<llvm::AllocaInst>(val)) {
+            capture(name, byRef ? val : builder.CreateLoad(val), byRef);
+          } else if (val->getType()->isSized()) { // not a basic block
+            capture(name, val);
+          }
           continue;
         }
-        scopedValues.push_back(val);
-        scopedTypes.push_back(val->getType());
-        scopedNames.push_back(val->getName());
+        if (!enclosingEnv) {
+          continue; // not a variable (e.g. a free function)
+        }
+        if (byRef) {
+          // we access enclosing captures through its environment
+          linkEnclosingEnv = linkEnclosingEnv ||
+                             Ident::getCaptured(builder, enclosingEnv, name);
+        } else if (auto val = Ident::getCaptured(builder, enclosingEnv, name)) {
+          if (llvm::isa<llvm::GetElementPtrInst>(val)) {
+            val = builder.CreateLoad(val);
+          }
+          capture(name, val);
+        }
+      }
+      if (linkEnclosingEnv) {
+        capture(".parent", enclosingEnv, true);
       }
     }
 
-    for (const auto& capture : explicitCaptures_) {
-      const auto name = capture.getKey();
+    for (const auto& capt : explicitCaptures_) {
+      const auto name = capt.getKey();
       if (std::find(scopedNames.begin(), scopedNames.end(), name) !=
           scopedNames.end()) {
         return error("variable name `{}` already in use "
                      "for closure capture list at line {}",
                      name.str(), state_.row + 1);
       }
-      scopedNames.push_back(name);
-      auto val = capture.getValue()->codegen(builder);
+      if (std::find(refCaptures_.begin(), refCaptures_.end(), name) !=
+          refCaptures_.end()) {
+        llvm::Value* var = enclosingFn->getValueSymbolTable()->lookup(name);
+        if (!var && enclosingEnv) {
+          var = Ident::getCaptured(builder, enclosingEnv, name);
+        }
+        if (!var || !(llvm::isa<llvm::AllocaInst>(var) ||
+                      llvm::isa<llvm::GetElementPtrInst>(var))) {
+          return error("cannot capture `{}` by reference for closure "
+                       "at line {}",
+                       name.str(), state_.row + 1);
+        }
+        capture(name, var, true);
+        continue;
+      }
+      auto val = capt.getValue()->codegen(builder);
       if (!val) {
         return val.takeError();
       }
-      const auto value = *val;
-      scopedValues.push_back(value);
-      scopedTypes.push_back(value->getType());
+      auto value = *val;
+      if (llvm::isa<llvm::AllocaInst>(value) ||
+          llvm::isa<llvm::GetElementPtrInst>(value)) {
+        value = builder.CreateLoad(value);
+      }
+      capture(name, value);
     }
 
     small_vector<llvm::Type*> argTypes;
@@ -168,12 +217,12 @@ public:
       argTypes = std::move(*types);
     }
 
+    // closures always take their environment as first argument
     const auto hasEnv = !scopedValues.empty();
-    if (hasEnv) {
-      argTypes.insert(
-          argTypes.begin(),
-          llvm::StructType::create(module->getContext())->getPointerTo(0));
-    }
+    argTypes.insert(
+        argTypes.begin(),
+        hasEnv ? llvm::StructType::create(module->getContext())->getPointerTo(0)
+               : BasicTypes["char"]->getPointerTo(0));
 
     auto func = llvm::Function::Create(
         llvm::FunctionType::get(*returnType, argTypes,
@@ -182,11 +231,10 @@ public:
 
     if (hasEnv) {
       func->arg_begin()[0].setName(".env");
-      func->addParamAttr(0, llvm::Attribute::Nest);
     }
 
     if (args_) {
-      const auto j = static_cast<int>(hasEnv);
+      constexpr auto j = 1;
       const auto names = args_->names();
       for (size_t i = 0; i < names.size(); ++i) {
         if (hasEnv && std::find(scopedNames.begin(), scopedNames.end(),
@@ -197,11 +245,6 @@ public:
         }
         func->arg_begin()[i + j].setName(names[i]);
       }
-      for (size_t i = 0; i < func->arg_size() - j; ++i) {
-        if (!args_->arg(i).mut) {
-          func->addParamAttr(i + j, llvm::Attribute::ReadOnly);
-        }
-      }
     }
 
     if (hasEnv) {
@@ -210,6 +253,9 @@ public:
       env->setName(func->getName());
       env->setBody(scopedTypes);
       Structure::addMetadata(module, env->getName(), scopedNames);
+      if (!refNames.empty()) {
+        Structure::addMetadata(module, env->getName(), refNames, "captures");
+      }
     }
 
     auto built = buildFunction(func, body_.get(), state_);
@@ -217,35 +263,450 @@ public:
       return built.takeError();
     }
     func = *built;
+    if (args_) {
+      if (auto err = args_->addAttributes(func, 1, state_)) {
+        return err;
+      }
+    }
 
     if (hasEnv) {
       const auto env = argTypes.front()->getPointerElementType();
-      const auto scopeVars = builder.CreateAlloca(env, 0, nullptr, "");
+      // environments live in the entry block, so that loops reuse them
+      auto& entry = enclosingFn->getEntryBlock();
+      llvm::IRBuilder<> entryBuilder{&entry, entry.begin()};
+      const auto scopeVars = entryBuilder.CreateAlloca(env, 0, nullptr, "");
+      builder.CreateLifetimeStart(
+          scopeVars, builder.getInt64(
+                         module->getDataLayout().getTypeAllocSize(env)));
       for (size_t i = 0; i < scopedValues.size(); ++i) {
         const auto ptr = builder.CreateStructGEP(env, scopeVars, i, "");
         builder.CreateStore(scopedValues[i], ptr);
       }
-      const auto closureType = llvm::FunctionType::get(
-          func->getReturnType(), func->getFunctionType()->params().drop_front(),
-          func->isVarArg());
-      return bindFirstFuncArgument(builder, func, scopeVars, closureType);
+      return makeClosure(builder, func, scopeVars);
     }
-    return func;
+    return makeClosure(builder, func, nullptr);
   }
 
   inline static bool classof(const Factor* const factor) {
     return factor->getKind() == kClosure;
   }
 
+  inline static bool isEnvironment(const llvm::AllocaInst* const alloca) {
+    const auto type = alloca->getAllocatedType();
+    return type->isStructTy() &&
+           !llvm::cast<llvm::StructType>(type)->isLiteral() &&
+           type->getStructName().startswith("::closure");
+  }
+
+  /// @brief How a closure environment (or a closure value) is used beyond
+  /// the closure's own calls: Borrowed when passed to functions which may
+  /// capture it (callees borrow closures for the duration of the call), and
+  /// Moved when it may outlive the function creating it, i.e. is returned,
+  /// stored in non-local memory or deleted
+  enum class Escape { None, Borrowed, Moved };
+
+  /// @brief Conservatively classifies how env escapes (see Escape)
+  static Escape getEscape(const llvm::Value* const env) {
+    // we track values holding env, and local memory holding such values
+    small_vector<std::pair<const llvm::Value*, bool>> worklist{{env, false}};
+    llvm::SmallPtrSet<const llvm::Value*, 16> visited;
+    const auto isOwnCall = [](const llvm::CallInst* const call) {
+      // calling a closure passes its environment to its code
+      const auto code = llvm::dyn_cast<llvm::ExtractValueInst>(
+          call->getCalledValue()->stripPointerCasts());
+      const auto arg = call->getNumArgOperands()
+                           ? llvm::dyn_cast<llvm::ExtractValueInst>(
+                                 call->getArgOperand(0)->stripPointerCasts())
+                           : nullptr;
+      return code && arg &&
+             code->getAggregateOperand() == arg->getAggregateOperand();
+    };
+    const auto isBorrowed = [](const llvm::CallInst* const call,
+                               const llvm::Value* const value) {
+      for (unsigned i = 0; i < call->getNumArgOperands(); ++i) {
+        if (call->getArgOperand(i) == value &&
+            !call->paramHasAttr(i, llvm::Attribute::NoCapture)) {
+          return true;
+        }
+      }
+      return false;
+    };
+    auto escape = Escape::None;
+    while (!worklist.empty()) {
+      const auto [value, inMemory] = worklist.pop_back_val();
+      if (!visited.insert(value).second) {
+        continue;
+      }
+      for (const auto user : value->users()) {
+        const auto call = llvm::dyn_cast<llvm::CallInst>(user);
+        if (call && call->getMetadata("closure.delete")) {
+          return Escape::Moved;
+        }
+        if (inMemory) {
+          if (llvm::isa<llvm::LoadInst>(user)) {
+            worklist.emplace_back(user, false);
+          } else if (call) {
+            if (isBorrowed(call, value)) {
+              escape = Escape::Borrowed;
+            }
+          } else if (!llvm::isa<llvm::StoreInst>(user) ||
+                     llvm::cast<llvm::StoreInst>(user)->getValueOperand() ==
+                         value) {
+            return Escape::Moved;
+          }
+          continue;
+        }
+        if (llvm::isa<llvm::CastInst>(user) ||
+            llvm::isa<llvm::GetElementPtrInst>(user) ||
+            llvm::isa<llvm::InsertValueInst>(user) ||
+            llvm::isa<llvm::ExtractValueInst>(user) ||
+            llvm::isa<llvm::PHINode>(user) ||
+            llvm::isa<llvm::SelectInst>(user)) {
+          worklist.emplace_back(user, false);
+        } else if (llvm::isa<llvm::LoadInst>(user)) {
+          continue; // we read from env
+        } else if (const auto store = llvm::dyn_cast<llvm::StoreInst>(user)) {
+          if (store->getValueOperand() != value) {
+            continue; // we write into env
+          }
+          const auto ptr = store->getPointerOperand()->stripPointerCasts();
+          if (!llvm::isa<llvm::AllocaInst>(ptr)) {
+            return Escape::Moved;
+          }
+          worklist.emplace_back(ptr, true);
+        } else if (call) {
+          if (call->getCalledValue() == value || isOwnCall(call)) {
+            continue;
+          }
+          if (isBorrowed(call, value)) {
+            escape = Escape::Borrowed;
+          }
+        } else {
+          return Escape::Moved; // e.g. returned
+        }
+      }
+    }
+    return escape;
+  }
+
+  /// @brief Checks whether a returned closure value owns its environment,
+  /// i.e. the environment was moved to the heap by its creator
+  static bool ownsEnvironment(const llvm::Module& module,
+                              const llvm::Value* const closure) {
+    if (const auto insert = llvm::dyn_cast<llvm::InsertValueInst>(closure)) {
+      if (insert->getIndices()[0] == 0) {
+        return ownsEnvironment(module, insert->getAggregateOperand());
+      }
+      const auto env = insert->getInsertedValueOperand()->stripPointerCasts();
+      if (llvm::isa<llvm::ConstantPointerNull>(env)) {
+        return true;
+      }
+      const auto call = llvm::dyn_cast<llvm::CallInst>(env);
+      return call && call->getCalledFunction() &&
+             call->getCalledFunction()->getName() == "malloc" &&
+             call->getMetadata("closure.env");
+    }
+    if (const auto call = llvm::dyn_cast<llvm::CallInst>(closure)) {
+      const auto callee = call->getCalledFunction();
+      return callee && getMetadataOperand(module, "environments",
+                                          callee->getName());
+    }
+    if (const auto phi = llvm::dyn_cast<llvm::PHINode>(closure)) {
+      return std::all_of(phi->incoming_values().begin(),
+                         phi->incoming_values().end(),
+                         [&module](const llvm::Value* const value) {
+                           return ownsEnvironment(module, value);
+                         });
+    }
+    return false;
+  }
+
 private:
+  /// @brief Collects the identifiers the closure body uses which it does
+  /// not declare (bound holds the names in scope, i.e. its parameters and
+  /// locals). Those that resolve to variables in the enclosing scope are its
+  /// free variables.
+  void getFreeVariables(const mpc_ast_t* const ast,
+                        small_vector<llvm::StringRef>& bound) {
+    const auto isBound = [&bound](llvm::StringRef name) {
+      return std::find(bound.begin(), bound.end(), name) != bound.end();
+    };
+    const auto bind = [&bound](const mpc_ast_t* const ref) {
+      const auto names = getIdentList(ref);
+      bound.append(names.begin(), names.end());
+    };
+    const auto tag = getInnermostAstTag(ast);
+    if (!ast->children_num) {
+      if (tag == "ident" && !isBound(ast->contents) &&
+          std::find(freeVariables_.begin(), freeVariables_.end(),
+                    ast->contents) == freeVariables_.end()) {
+        freeVariables_.push_back(ast->contents);
+      }
+      return;
+    }
+    // types, member names and scoped names are not variables
+    const auto outer = getOutermostAstTag(ast);
+    if (outer == "type" || outer == "typelist" || tag == "scoperes" ||
+        tag == "overloadid") {
+      return;
+    }
+    if (tag == "structmember") {
+      getFreeVariables(ast->children[0], bound);
+      return;
+    }
+
+    // declarations bind names in the enclosing scope
+    if (tag == "declassign") {
+      // <type> <ident> <initializer>? (',' <ident> <initializer>?)*
+      for (auto i = 0; i < ast->children_num; ++i) {
+        const auto ref = ast->children[i];
+        if (getInnermostAstTag(ref) == "typeident") {
+          bound.push_back(ref->children[1]->contents);
+        } else if (getInnermostAstTag(ref) == "ident") {
+          bound.push_back(ref->contents);
+        } else {
+          getFreeVariables(ref, bound);
+        }
+      }
+      return;
+    }
+    if (tag == "letexpr") {
+      auto eq = 0;
+      while (std::string_view{ast->children[eq]->contents} != "=") {
+        ++eq;
+      }
+      getFreeVariables(ast->children[eq + 1], bound);
+      bind(ast->children[eq - 1]);
+      for (auto i = eq + 2; i < ast->children_num; ++i) {
+        getFreeVariables(ast->children[i], bound);
+      }
+      return;
+    }
+    if (tag == "forinexpr") {
+      // the range is evaluated before the loop variables are bound
+      for (auto i = 3; i < ast->children_num; ++i) {
+        getFreeVariables(ast->children[i], bound);
+        if (i == 3) {
+          bind(ast->children[1]);
+        }
+      }
+      return;
+    }
+    if (tag == "letbind") {
+      // "let" <variant> '(' <identlist> ')' '=' <ident>
+      getFreeVariables(ast->children[ast->children_num - 1], bound);
+      bind(ast->children[3]);
+      return;
+    }
+    if (tag == "memberinitlist") {
+      for (auto i = 3; i < ast->children_num; i += 4) {
+        getFreeVariables(ast->children[i], bound);
+      }
+      return;
+    }
+    if (tag == "capture") {
+      // the names of init captures are the nested closure's own
+      getFreeVariables(
+          ast->children[std::string_view{ast->children[1]->contents} == "="
+                            ? 2
+                            : 0],
+          bound);
+      return;
+    }
+
+    // names declared in a block, loop, conditional or closure go out of
+    // scope at its end
+    const auto scope = bound.size();
+    if (tag == "listcomprehension") {
+      // the values are evaluated in the scope of the loops
+      for (auto i = 2; i < ast->children_num; ++i) {
+        getFreeVariables(ast->children[i], bound);
+      }
+      getFreeVariables(ast->children[1], bound);
+      bound.resize(scope);
+      return;
+    }
+    for (auto i = 0; i < ast->children_num; ++i) {
+      const auto ref = ast->children[i];
+      if (tag == "closure" && getOutermostAstTag(ref) == "args") {
+        const auto names = Args{ref}.names();
+        bound.append(names.begin(), names.end());
+      } else if (tag == "select" &&
+                 std::string_view{ref->contents} == "let") {
+        bind(ast->children[++i]);
+      } else if (i && std::string_view{ast->children[i - 1]->contents} ==
+                          ".") {
+        continue; // members of elements
+      } else {
+        getFreeVariables(ref, bound);
+      }
+    }
+    bound.resize(scope);
+  }
+
   const mpc_state_t state_;
   std::unique_ptr<Args> args_;
   llvm::StringMap<expr_t> explicitCaptures_;
+  small_vector<llvm::StringRef> refCaptures_;
+  small_vector<llvm::StringRef> freeVariables_;
   DefaultCaptureMode defaultCaptureMode_{None};
   std::unique_ptr<TypeList> returns_;
   std::unique_ptr<Body> body_;
 };
 
+/// @brief Chooses where closure environments created in func live, and
+/// which function releases them:
+///  - environments of closures which don't escape, or are only borrowed by
+///    the functions they are passed to (for the duration of the calls), stay
+///    on the stack;
+///  - those of closures which are moved (returned, stored in non-local
+///    memory or deleted) go to the heap, and are owned by the closure.
+///    Returned closures are owned by the caller, stored ones by the program,
+///    which releases them with `delete`. Environments pointing into the
+///    frame (e.g. capturing by reference) cannot be moved, nor can interface
+///    values whose data is in the frame.
+/// Owned closures returned by calls are released by func once they are no
+/// longer reachable (when they are replaced, e.g. by the next iteration of
+/// a loop, and when func returns), unless they are moved on.
+static llvm::Error lowerClosureEnvironments(llvm::Function* const func,
+                                            const mpc_state_t state) {
+  const auto module = func->getParent();
+  auto& ctx = module->getContext();
+  const auto& DL = module->getDataLayout();
+  // (whether a value stored into env points into the frame)
+  const auto isFramePointer = [&DL](const llvm::Value* const value) {
+    return value->getType()->isPointerTy() &&
+           llvm::isa<llvm::AllocaInst>(llvm::GetUnderlyingObject(value, DL));
+  };
+  small_vector<llvm::AllocaInst*> escaping;
+  for (auto& inst : func->getEntryBlock()) {
+    const auto env = llvm::dyn_cast<llvm::AllocaInst>(&inst);
+    if (!env || !Closure::isEnvironment(env) ||
+        Closure::getEscape(env) != Closure::Escape::Moved) {
+      continue;
+    }
+    const auto envName = env->getAllocatedType()->getStructName();
+    auto framePointer =
+        getMetadataOperand(*module, "captures", envName).has_value();
+    for (const auto field : env->users()) {
+      for (const auto user : field->users()) {
+        const auto store = llvm::dyn_cast<llvm::StoreInst>(user);
+        framePointer = framePointer ||
+                       (store && store->getPointerOperand() == field &&
+                        isFramePointer(store->getValueOperand()));
+      }
+    }
+    if (framePointer) {
+      return error("closure referring to local variable(s) escapes "
+                   "function `{}` at line {}",
+                   func->getName().str(), state.row + 1);
+    }
+    escaping.push_back(env);
+  }
+
+  // interface values (see Interface::cast) cannot be moved either when
+  // their data is in the frame
+  for (auto& block : *func) {
+    for (auto& inst : block) {
+      const auto insert = llvm::dyn_cast<llvm::InsertValueInst>(&inst);
+      if (!insert || insert->getIndices()[0] != 0 ||
+          !insert->getType()->isStructTy() ||
+          !insert->getType()->getStructName().startswith("interface::") ||
+          !isFramePointer(insert->getInsertedValueOperand()) ||
+          Closure::getEscape(insert) != Closure::Escape::Moved) {
+        continue;
+      }
+      return error("interface value referring to local variable(s) escapes "
+                   "function `{}` at line {}",
+                   func->getName().str(), state.row + 1);
+    }
+  }
+
+  // we allocate escaping environments where closures are created
+  // (marked by the start of their lifetime)
+  for (const auto env : escaping) {
+    llvm::IntrinsicInst* lifetimeStart{nullptr};
+    for (const auto user : env->users()) {
+      for (const auto use : user->users()) {
+        if (const auto intrinsic = llvm::dyn_cast<llvm::IntrinsicInst>(use)) {
+          if (intrinsic->getIntrinsicID() == llvm::Intrinsic::lifetime_start) {
+            lifetimeStart = intrinsic;
+          }
+        }
+      }
+    }
+    assert(lifetimeStart && "closure environment without lifetime start");
+    const auto type = env->getAllocatedType();
+    const auto heap = llvm::CallInst::CreateMalloc(
+        lifetimeStart, BasicTypes["int"], type,
+        llvm::ConstantInt::get(BasicTypes["int"], DL.getTypeAllocSize(type)),
+        nullptr, nullptr, "");
+    llvm::cast<llvm::Instruction>(heap->stripPointerCasts())
+        ->setMetadata("closure.env", llvm::MDNode::get(ctx, {}));
+    const auto cast = lifetimeStart->getArgOperand(1);
+    lifetimeStart->eraseFromParent();
+    if (const auto inst = llvm::dyn_cast<llvm::Instruction>(cast);
+        inst && inst->use_empty()) {
+      inst->eraseFromParent();
+    }
+    env->replaceAllUsesWith(heap);
+    env->eraseFromParent();
+  }
+
+  small_vector<llvm::ReturnInst*> returns;
+  small_vector<llvm::CallInst*> owned;
+  for (auto& block : *func) {
+    for (auto& inst : block) {
+      if (const auto ret = llvm::dyn_cast<llvm::ReturnInst>(&inst)) {
+        returns.push_back(ret);
+      } else if (const auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+        if (Type::isClosureType(call->getType()) &&
+            Closure::ownsEnvironment(*module, call) &&
+            Closure::getEscape(call) != Closure::Escape::Moved) {
+          owned.push_back(call);
+        }
+      }
+    }
+  }
+
+  // ownership of environments is moved to callers with returned closures
+  const auto returnsOwned = [&] {
+    return Type::isClosureType(func->getReturnType()) &&
+           std::all_of(returns.begin(), returns.end(),
+                       [module](const llvm::ReturnInst* const ret) {
+                         return Closure::ownsEnvironment(*module,
+                                                         ret->getReturnValue());
+                       });
+  };
+  if (returnsOwned()) {
+    module->getOrInsertNamedMetadata("environments")
+        ->addOperand(llvm::MDNode::get(
+            ctx, llvm::MDString::get(ctx, func->getName())));
+  }
+
+  if (!owned.empty()) {
+    auto& entry = func->getEntryBlock();
+    llvm::IRBuilder<> builder{&entry, entry.begin()};
+    const auto envTy = BasicTypes["char"]->getPointerTo(0);
+    for (const auto call : owned) {
+      // each environment is released when the next one replaces it (e.g.
+      // calls in loops), and the last when func returns
+      builder.SetInsertPoint(&entry, entry.begin());
+      const auto slot = builder.CreateAlloca(envTy, 0, nullptr, "");
+      builder.CreateStore(llvm::Constant::getNullValue(envTy), slot);
+      const auto next = &*++call->getIterator();
+      builder.SetInsertPoint(next);
+      (void)llvm::CallInst::CreateFree(builder.CreateLoad(slot), next);
+      builder.CreateStore(builder.CreateExtractValue(call, 1), slot);
+      for (const auto ret : returns) {
+        builder.SetInsertPoint(ret);
+        (void)llvm::CallInst::CreateFree(builder.CreateLoad(slot), ret);
+      }
+    }
+  }
+  return llvm::Error::success();
+}
+
 } // end namespace whack::ast
 
 #endif // WHACK_CLOSURE_HPP
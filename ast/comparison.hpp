@@ -20,6 +20,7 @@
 
 #include "ast.hpp"
 #include "lexp.hpp"
+#include "vector.hpp"
 #include <llvm/ADT/StringMap.h>
 
 namespace whack::ast {
@@ -54,11 +55,13 @@ public:
           return rhs.takeError();
         }
         const auto& op = ast_->children[i]->contents;
-        const auto type = value->getType();
+        // (vectors are compared lane-wise, into a mask)
+        const auto [lhs, other] = splatOperands(builder, value, *rhs);
+        const auto type = lhs->getType()->getScalarType();
         if (type->isFloatingPointTy()) { //
-          value = builder.CreateFCmp(REALCMP[op], value, *rhs);
+          value = builder.CreateFCmp(REALCMP[op], lhs, other);
         } else if (type->isIntegerTy()) {
-          value = builder.CreateICmp(INTCMP[op], value, *rhs);
+          value = builder.CreateICmp(INTCMP[op], lhs, other);
         } else {
           llvm_unreachable("TODO");
         }
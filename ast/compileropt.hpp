@@ -19,6 +19,7 @@
 #pragma once
 
 #include "ast.hpp"
+#include "metadata.hpp"
 #include <llvm/IR/MDBuilder.h>
 
 namespace whack::ast {
@@ -40,7 +41,13 @@ public:
   inline const auto& get() const { return options_; }
 
   inline static auto get(const llvm::Module* const module) {
-    return getMetadataParts(*module, "options");
+    return getMetadataParts<1>(*module, "options");
+  }
+
+  /// @brief Whether the module sets option (e.g. `boundscheck`)
+  static bool isSet(const llvm::Module* const module, llvm::StringRef option) {
+    const auto options = get(module);
+    return std::find(options.begin(), options.end(), option) != options.end();
   }
 
 private:
@@ -19,20 +19,34 @@
 #pragma once
 
 #include "ast.hpp"
+#include "coroutine.hpp"
 
 namespace whack::ast {
 
 class CoReturn final : public Stmt {
 public:
-  explicit CoReturn(const mpc_ast_t* const ast) : Stmt(kCoReturn) {}
+  explicit CoReturn(const mpc_ast_t* const ast)
+      : Stmt(kCoReturn), state_{ast->state} {
+    if (ast->children_num > 2) {
+      exprList_ = getExprList(ast->children[1]);
+    }
+  }
 
   llvm::Error codegen(llvm::IRBuilder<>& builder) const final {
-    return llvm::Error::success();
+    if (!getCoroutine(builder.GetInsertBlock()->getParent())) {
+      return error("cannot use co_return outside of a coroutine at line {}",
+                   state_.row + 1);
+    }
+    return returnCoroutine(builder, exprList_, state_);
   }
 
   inline static bool classof(const Stmt* const stmt) {
     return stmt->getKind() == kCoReturn;
   }
+
+private:
+  const mpc_state_t state_;
+  small_vector<expr_t> exprList_;
 };
 
 } // end namespace whack::ast
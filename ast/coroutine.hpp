@@ -0,0 +1,361 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_COROUTINE_HPP
+#define WHACK_COROUTINE_HPP
+
+#pragma once
+
+#include "ast.hpp"
+#include "type.hpp"
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/ValueSymbolTable.h>
+
+// Functions containing `yield`, `co_return` or `await` are (switched-resume)
+// coroutines. Calling one allocates its frame and returns a `coro<T>`
+// handle to it without running its body; awaiting the handle runs the
+// coroutine until it yields (or returns) its next value. Frames are
+// allocated through runtime hooks, which CoroElide removes when the frame
+// does not outlive its caller (i.e. the handle is deleted in the caller).
+// The promise of a coroutine is a {awaiter, handoff, value} struct; the
+// first two fields are shared with the runtime (see runtime.c).
+
+namespace whack::ast {
+
+/// @brief Whether the body ast contains `yield`, `co_return` or `await`
+/// (outside of nested closures)
+static bool isCoroutineBody(const mpc_ast_t* const ast) {
+  for (auto i = 0; i < ast->children_num; ++i) {
+    const auto child = ast->children[i];
+    const std::string_view tag{child->tag};
+    if (tag.find("closure") != std::string_view::npos) {
+      continue;
+    }
+    if (tag.find("yieldstmt") != std::string_view::npos ||
+        tag.find("coreturnstmt") != std::string_view::npos) {
+      return true;
+    }
+    if (tag.find("funccall") != std::string_view::npos &&
+        child->children_num &&
+        std::string_view{child->children[0]->contents} == "await") {
+      return true;
+    }
+    if (isCoroutineBody(child)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline static llvm::Function* getCoroIntrinsic(llvm::Module* const module,
+                                               const llvm::Intrinsic::ID id) {
+  if (id == llvm::Intrinsic::coro_size) {
+    return llvm::Intrinsic::getDeclaration(
+        module, id, {llvm::Type::getInt64Ty(module->getContext())});
+  }
+  return llvm::Intrinsic::getDeclaration(module, id);
+}
+
+/// @brief Declares a function of the coroutine runtime (see runtime.c)
+static llvm::Constant* getCoroFunction(llvm::Module* const module,
+                                       llvm::StringRef name) {
+  auto& ctx = module->getContext();
+  const auto ptr = BasicTypes["char"]->getPointerTo(0);
+  const auto i32 = llvm::Type::getInt32Ty(ctx);
+  llvm::FunctionType* type;
+  if (name == "__builtin_coro_alloc") {
+    type = llvm::FunctionType::get(ptr, llvm::Type::getInt64Ty(ctx), false);
+  } else if (name == "__builtin_await_suspend") { // (future, awaiter)
+    type = llvm::FunctionType::get(i32, {ptr, ptr}, false);
+  } else if (name == "__builtin_coro_wait") {
+    type = llvm::FunctionType::get(i32, ptr, false);
+  } else { // free, yield
+    type = llvm::FunctionType::get(BasicTypes["void"], ptr, false);
+  }
+  const auto func = module->getOrInsertFunction(name, type);
+  if (const auto f = llvm::dyn_cast<llvm::Function>(func)) {
+    f->addFnAttr(llvm::Attribute::NoUnwind);
+  }
+  return func;
+}
+
+/// @brief Returns the handle of the coroutine func, if it is one
+inline static llvm::Value* getCoroutine(const llvm::Function* const func) {
+  return func->getValueSymbolTable()->lookup("::coro.handle");
+}
+
+inline static llvm::BasicBlock* getCoroBlock(const llvm::Function* const func,
+                                             llvm::StringRef name) {
+  return llvm::cast<llvm::BasicBlock>(
+      func->getValueSymbolTable()->lookup(name));
+}
+
+inline static llvm::StructType* getCoroPromiseType(llvm::Type* const value) {
+  auto& ctx = value->getContext();
+  small_vector<llvm::Type*> fields{BasicTypes["char"]->getPointerTo(0),
+                                   llvm::Type::getInt32Ty(ctx)};
+  if (!value->isVoidTy()) {
+    fields.push_back(value);
+  }
+  return llvm::StructType::get(ctx, fields);
+}
+
+/// @brief Returns the promise of the coroutine handle
+static llvm::Value* getCoroPromise(llvm::IRBuilder<>& builder,
+                                   llvm::Value* const handle) {
+  const auto module = builder.GetInsertBlock()->getModule();
+  const auto type =
+      getCoroPromiseType(Type::getCoroValueType(handle->getType()));
+  const auto ptr = BasicTypes["char"]->getPointerTo(0);
+  const auto promise = builder.CreateCall(
+      getCoroIntrinsic(module, llvm::Intrinsic::coro_promise),
+      {builder.CreateBitCast(handle, ptr),
+       builder.getInt32(Type::getAlignment(module, type)),
+       builder.getFalse()});
+  return builder.CreateBitCast(promise, type->getPointerTo(0));
+}
+
+/// @brief Suspends the coroutine (from the save point save), returning its
+/// handle to whoever called or resumed it. We continue in resume.
+static void suspendCoroutine(llvm::IRBuilder<>& builder,
+                             llvm::Value* const save,
+                             llvm::BasicBlock* const resume) {
+  const auto func = builder.GetInsertBlock()->getParent();
+  const auto suspend = builder.CreateCall(
+      getCoroIntrinsic(func->getParent(), llvm::Intrinsic::coro_suspend),
+      {save, builder.getFalse()});
+  const auto switchInst =
+      builder.CreateSwitch(suspend, getCoroBlock(func, "::coro.end"), 2);
+  switchInst->addCase(builder.getInt8(0), resume);
+  switchInst->addCase(builder.getInt8(1),
+                      getCoroBlock(func, "::coro.cleanup"));
+  builder.SetInsertPoint(resume);
+}
+
+/// @brief Hands the value of the promise over to the awaiter of the
+/// coroutine, suspending until it is awaited again
+static void yieldCoroutine(llvm::IRBuilder<>& builder) {
+  const auto func = builder.GetInsertBlock()->getParent();
+  const auto module = func->getParent();
+  const auto handle = getCoroutine(func);
+  const auto save = builder.CreateCall(
+      getCoroIntrinsic(module, llvm::Intrinsic::coro_save), handle);
+  builder.CreateCall(getCoroFunction(module, "__builtin_coro_yield"),
+                     builder.CreateBitCast(
+                         func->getValueSymbolTable()->lookup("::coro.promise"),
+                         BasicTypes["char"]->getPointerTo(0)));
+  suspendCoroutine(
+      builder, save,
+      llvm::BasicBlock::Create(module->getContext(), "::coro.resume", func));
+}
+
+/// @brief Emits the prologue of the coroutine we are building (at its entry
+/// block): its promise, frame allocation and initial suspension. Its body
+/// follows; reaching its end (or a return) completes the coroutine.
+static void beginCoroutine(llvm::IRBuilder<>& builder,
+                           llvm::Type* const value) {
+  const auto func = builder.GetInsertBlock()->getParent();
+  const auto module = func->getParent();
+  auto& ctx = module->getContext();
+  const auto ptr = BasicTypes["char"]->getPointerTo(0);
+  const auto null = llvm::ConstantPointerNull::get(ptr);
+  const auto type = getCoroPromiseType(value);
+  const auto align = Type::getAlignment(module, type);
+  const auto promise =
+      builder.CreateAlloca(type, 0, nullptr, "::coro.promise");
+  promise->setAlignment(align);
+  const auto id = builder.CreateCall(
+      getCoroIntrinsic(module, llvm::Intrinsic::coro_id),
+      {builder.getInt32(align), builder.CreateBitCast(promise, ptr), null,
+       null},
+      "::coro.id");
+
+  const auto entry = builder.GetInsertBlock();
+  const auto alloc = llvm::BasicBlock::Create(ctx, "::coro.alloc", func);
+  const auto begin = llvm::BasicBlock::Create(ctx, "::coro.begin", func);
+  builder.CreateCondBr(
+      builder.CreateCall(getCoroIntrinsic(module, llvm::Intrinsic::coro_alloc),
+                         id),
+      alloc, begin);
+  builder.SetInsertPoint(alloc);
+  const auto mem = builder.CreateCall(
+      getCoroFunction(module, "__builtin_coro_alloc"),
+      builder.CreateCall(getCoroIntrinsic(module, llvm::Intrinsic::coro_size)));
+  builder.CreateBr(begin);
+  builder.SetInsertPoint(begin);
+  const auto frame = builder.CreatePHI(ptr, 2);
+  frame->addIncoming(null, entry);
+  frame->addIncoming(mem, alloc);
+  const auto handle = builder.CreateCall(
+      getCoroIntrinsic(module, llvm::Intrinsic::coro_begin), {id, frame},
+      "::coro.handle");
+
+  const auto end = llvm::BasicBlock::Create(ctx, "::coro.end", func);
+  const auto cleanup = llvm::BasicBlock::Create(ctx, "::coro.cleanup", func);
+  const auto complete = llvm::BasicBlock::Create(ctx, "::coro.final", func);
+  {
+    llvm::IRBuilder<> endBuilder{end};
+    endBuilder.CreateCall(getCoroIntrinsic(module, llvm::Intrinsic::coro_end),
+                          {handle, endBuilder.getFalse()});
+    endBuilder.CreateRet(
+        endBuilder.CreateBitCast(handle, func->getReturnType()));
+
+    llvm::IRBuilder<> cleanupBuilder{cleanup};
+    const auto free = llvm::BasicBlock::Create(ctx, "::coro.free", func);
+    const auto mem = cleanupBuilder.CreateCall(
+        getCoroIntrinsic(module, llvm::Intrinsic::coro_free), {id, handle});
+    cleanupBuilder.CreateCondBr(cleanupBuilder.CreateIsNotNull(mem), free,
+                                end);
+    cleanupBuilder.SetInsertPoint(free);
+    cleanupBuilder.CreateCall(getCoroFunction(module, "__builtin_coro_free"),
+                              mem);
+    cleanupBuilder.CreateBr(end);
+
+    // completed coroutines are never resumed, only destroyed
+    llvm::IRBuilder<> finalBuilder{complete};
+    const auto save = finalBuilder.CreateCall(
+        getCoroIntrinsic(module, llvm::Intrinsic::coro_save), handle);
+    finalBuilder.CreateCall(getCoroFunction(module, "__builtin_coro_yield"),
+                            finalBuilder.CreateBitCast(promise, ptr));
+    const auto suspend = finalBuilder.CreateCall(
+        getCoroIntrinsic(module, llvm::Intrinsic::coro_suspend),
+        {save, finalBuilder.getTrue()});
+    const auto switchInst = finalBuilder.CreateSwitch(suspend, end, 2);
+    switchInst->addCase(finalBuilder.getInt8(0), cleanup);
+    switchInst->addCase(finalBuilder.getInt8(1), cleanup);
+  }
+
+  // we only run once awaited
+  suspendCoroutine(builder, llvm::ConstantTokenNone::get(ctx),
+                   llvm::BasicBlock::Create(ctx, "::coro.body", func));
+}
+
+/// @brief Stores the value of a `yield` or `co_return` (several values make
+/// up a struct) into the promise of the coroutine we are building
+static llvm::Error setCoroutineValue(llvm::IRBuilder<>& builder,
+                                     const small_vector<expr_t>& exprList,
+                                     const mpc_state_t state) {
+  const auto func = builder.GetInsertBlock()->getParent();
+  const auto type = Type::getCoroValueType(func->getReturnType());
+  const auto isStruct = exprList.size() > 1 && type->isStructTy() &&
+                        type->getStructNumElements() == exprList.size();
+  small_vector<llvm::Value*> values;
+  for (const auto& expression : exprList) {
+    auto expr = expression->codegen(builder);
+    if (!expr) {
+      return expr.takeError();
+    }
+    auto value = *expr;
+    // @todo: Delegate to Loader, based on use context?
+    if ((llvm::isa<llvm::AllocaInst>(value) ||
+         llvm::isa<llvm::GetElementPtrInst>(value)) &&
+        value->getType()->getPointerElementType() ==
+            (isStruct ? type->getStructElementType(values.size()) : type)) {
+      value = builder.CreateLoad(value);
+    }
+    values.push_back(value);
+  }
+
+  llvm::Value* value = values.front();
+  if (isStruct) {
+    value = llvm::UndefValue::get(type);
+    for (unsigned i = 0; i < values.size(); ++i) {
+      value = builder.CreateInsertValue(value, values[i], i);
+    }
+  }
+  if (value->getType() != type) {
+    return error("invalid type for the value of coroutine `{}` at line {}",
+                 func->getName().str(), state.row + 1);
+  }
+  builder.CreateStore(
+      value, builder.CreateStructGEP(
+                 nullptr, func->getValueSymbolTable()->lookup("::coro.promise"),
+                 2, ""));
+  return llvm::Error::success();
+}
+
+/// @brief Completes the coroutine we are building (`co_return`)
+static llvm::Error returnCoroutine(llvm::IRBuilder<>& builder,
+                                   const small_vector<expr_t>& exprList,
+                                   const mpc_state_t state) {
+  if (!exprList.empty()) {
+    if (auto err = setCoroutineValue(builder, exprList, state)) {
+      return err;
+    }
+  }
+  const auto func = builder.GetInsertBlock()->getParent();
+  builder.CreateBr(getCoroBlock(func, "::coro.final"));
+  // (unreachable) statements which follow
+  builder.SetInsertPoint(
+      llvm::BasicBlock::Create(func->getContext(), "", func));
+  return llvm::Error::success();
+}
+
+/// @brief Runs the coroutine handle until its next value, which we return.
+/// Coroutines suspend meanwhile (the awaited coroutine resumes them), while
+/// other functions block. Completed coroutines give their last value.
+static llvm::Value* awaitCoroutine(llvm::IRBuilder<>& builder,
+                                   llvm::Value* const handle) {
+  const auto func = builder.GetInsertBlock()->getParent();
+  const auto module = func->getParent();
+  auto& ctx = module->getContext();
+  const auto ptr = BasicTypes["char"]->getPointerTo(0);
+  const auto frame = builder.CreateBitCast(handle, ptr);
+  const auto promise = getCoroPromise(builder, handle);
+
+  const auto resume = llvm::BasicBlock::Create(ctx, "::await.resume", func);
+  const auto ready = llvm::BasicBlock::Create(ctx, "::await.ready", func);
+  builder.CreateCondBr(
+      builder.CreateCall(getCoroIntrinsic(module, llvm::Intrinsic::coro_done),
+                         frame),
+      ready, resume);
+  builder.SetInsertPoint(resume);
+  const auto awaiter = getCoroutine(func);
+  builder.CreateStore(awaiter ? awaiter : llvm::ConstantPointerNull::get(ptr),
+                      builder.CreateStructGEP(nullptr, promise, 0, ""));
+  builder.CreateStore(builder.getInt32(0),
+                      builder.CreateStructGEP(nullptr, promise, 1, ""));
+  // the awaited coroutine may resume us before we suspend
+  const auto save =
+      awaiter ? builder.CreateCall(
+                    getCoroIntrinsic(module, llvm::Intrinsic::coro_save),
+                    awaiter)
+              : nullptr;
+  const auto resumed = builder.CreateCall(
+      getCoroIntrinsic(module, llvm::Intrinsic::coro_resume), frame);
+  const auto wait =
+      builder.CreateCall(getCoroFunction(module, "__builtin_coro_wait"),
+                         builder.CreateBitCast(promise, ptr));
+  if (awaiter) {
+    const auto suspend =
+        llvm::BasicBlock::Create(ctx, "::await.suspend", func);
+    builder.CreateCondBr(builder.CreateIsNotNull(wait), suspend, ready);
+    builder.SetInsertPoint(suspend);
+    suspendCoroutine(builder, save, ready);
+  } else {
+    builder.CreateBr(ready);
+    builder.SetInsertPoint(ready);
+  }
+
+  const auto type = Type::getCoroValueType(handle->getType());
+  if (type->isVoidTy()) {
+    return resumed;
+  }
+  return builder.CreateLoad(builder.CreateStructGEP(nullptr, promise, 2, ""));
+}
+
+} // end namespace whack::ast
+
+#endif // WHACK_COROUTINE_HPP
@@ -44,6 +44,11 @@ public:
   }
 
   // registers a data class type
+  // A data class is laid out as {tag, payload}: the tag is the smallest
+  // integer holding all variant indices, and the payload is sized and aligned
+  // for the largest variant (variants are payload-only structs which we
+  // access by casting the payload). A class of one empty variant and one
+  // single-pointer variant uses the null pointer as its tag (niche).
   llvm::Error codegen(llvm::Module* const module) const {
     if (module->getTypeByName(class_) ||
         module->getTypeByName("class::" + class_)) {
@@ -54,9 +59,11 @@ public:
 
     auto& ctx = module->getContext();
     llvm::MDBuilder MDBuilder{ctx};
-    unsigned int biggestSize = 8;
+    uint64_t biggestSize = 0;
+    unsigned biggestAlign = 1;
     const auto dataClass = llvm::StructType::create(ctx, "class::" + class_);
     small_vector<std::pair<llvm::MDNode*, uint64_t>> metadata;
+    small_vector<llvm::StructType*> variants;
 
     for (const auto& [name, typeList] : variants_) {
       const auto classMD =
@@ -64,34 +71,71 @@ public:
       metadata.emplace_back(std::pair{classMD, metadata.size()});
       // @todo Proper mangling
       const auto className = format("class::{}::{}", class_, name);
+      const auto variant = llvm::StructType::create(ctx, className);
       if (typeList) {
         auto t = typeList.value().codegen(module);
         if (!t) {
           return t.takeError();
         }
-        auto [types, variadic] = std::move(*t);
+        const auto [types, variadic] = std::move(*t);
         if (variadic) {
           return error("cannot use variadic type in typelist for "
                        "constructor `{}` in data class `{}` "
                        "at line {}",
                        name.data(), class_, state_.row + 1);
         }
-        types.insert(types.begin(), BasicTypes["char"]); // for tag
-        const auto variant = llvm::StructType::create(ctx, types, className);
-        const auto size = Type::getBitSize(module, variant);
-        if (size > biggestSize) {
-          biggestSize = size;
-        }
+        variant->setBody(types);
+        biggestSize = std::max<uint64_t>(biggestSize,
+                                         Type::getAllocSize(module, variant));
+        biggestAlign = std::max<unsigned>(biggestAlign,
+                                          Type::getAlignment(module, variant));
       } else {
-        (void)llvm::StructType::create(ctx, BasicTypes["char"] /*tag*/,
-                                       className);
+        variant->setBody(llvm::None);
       }
+      variants.push_back(variant);
     }
 
-    dataClass->setBody({BasicTypes["char"],
-                        llvm::ArrayType::get(BasicTypes["char"], biggestSize)});
     auto MD = module->getOrInsertNamedMetadata("classes");
     MD->addOperand(MDBuilder.createTBAAStructTypeNode(class_, metadata));
+
+    // null pointer niche
+    if (variants.size() == 2) {
+      for (unsigned i = 0; i < 2; ++i) {
+        const auto other = variants[1 - i];
+        if (variants[i]->getNumElements() == 0 &&
+            other->getNumElements() == 1 &&
+            other->getElementType(0)->isPointerTy()) {
+          dataClass->setBody(other->getElementType(0));
+          const auto niche = std::pair{metadata[i].first, uint64_t{0}};
+          module->getOrInsertNamedMetadata("niches")->addOperand(
+              MDBuilder.createTBAAStructTypeNode(class_, niche));
+          return llvm::Error::success();
+        }
+      }
+    }
+
+    const auto tagBits = variants.size() <= (1u << 8)
+                             ? 8
+                             : variants.size() <= (1u << 16) ? 16 : 32;
+    small_vector<llvm::Type*> body{llvm::Type::getIntNTy(ctx, tagBits)};
+    if (biggestSize) {
+      // an array of integers of the largest alignment keeps the payload
+      // aligned. Integers are not aligned beyond their ABI alignment (8
+      // bytes for i128 on x86-64), so larger alignments are raised by a
+      // zero-sized vector array (as for structures) before a byte array.
+      const auto size = llvm::alignTo(biggestSize, biggestAlign);
+      const auto alignType = llvm::Type::getIntNTy(ctx, biggestAlign * 8);
+      if (Type::getAlignment(module, alignType) < biggestAlign) {
+        body.push_back(llvm::ArrayType::get(
+            llvm::VectorType::get(BasicTypes["char"], biggestAlign), 0));
+        body.push_back(llvm::ArrayType::get(BasicTypes["char"], size));
+      } else {
+        body.push_back(llvm::ArrayType::get(alignType, size / biggestAlign));
+      }
+    }
+    dataClass->setBody(body);
+    assert(Type::getAlignment(module, dataClass) >= biggestAlign &&
+           "underaligned data class payload");
     return llvm::Error::success();
   }
 
@@ -102,46 +146,100 @@ public:
     const auto className = ref->children[0]->contents;
     const auto ctorName = ref->children[2]->contents;
     // @todo Proper mangling
-    const auto dataClass = format("class::{}::{}", className, ctorName);
+    const auto variantName = format("class::{}::{}", className, ctorName);
     const auto module = builder.GetInsertBlock()->getModule();
+    const auto type = module->getTypeByName(variantName);
+    const auto idx = DataClass::getIndex(module, className, ctorName);
 
-    if (const auto type = module->getTypeByName(dataClass)) {
-      auto alloc = builder.CreateAlloca(type, 0, nullptr, dataClass);
-      const auto idx = DataClass::getIndex(module, className, ctorName);
-      assert(idx.value() && "invalid constructor index for data class");
-      const auto tag = Character::get(idx.value());
-      builder.CreateStore(tag, builder.CreateStructGEP(type, alloc, 0, "tag"));
-
-      if (getOutermostAstTag(ast->children[2]) == "exprlist") {
-        const auto exprList = getExprList(ast->children[2]);
-        if (exprList.size() != type->getStructNumElements() - 1) {
-          return error("invalid number of elements for constructor "
-                       "`{}` of data class `{}` at line {}",
-                       ctorName, className, ast->state.row + 1);
-        }
+    if (!type || !idx) {
+      return error("could not find data class by name `{}` "
+                   "at line {}",
+                   className, ast->state.row + 1);
+    }
 
-        for (size_t i = 0; i < exprList.size(); ++i) {
-          auto val = exprList[i]->codegen(builder);
-          if (!val) {
-            return val.takeError();
-          }
-          const auto value = *val;
-          const auto ptr = builder.CreateStructGEP(type, alloc, i + 1, "");
-
-          if (value->getType() != ptr->getType()->getPointerElementType()) {
-            return error("type mismatch at index {} of constructor "
-                         "`{}` of data class `{}` at line {}",
-                         i, ctorName, className, ast->state.row + 1);
-          }
-          builder.CreateStore(value, ptr);
-        }
-      }
+    const auto classType =
+        module->getTypeByName(format("class::{}", className));
+    auto alloc = builder.CreateAlloca(classType, 0, nullptr, className);
+    const auto tagPtr = builder.CreateStructGEP(classType, alloc, 0, "tag");
+    const auto tagType = tagPtr->getType()->getPointerElementType();
+    if (!DataClass::getNiche(module, className)) {
+      builder.CreateStore(llvm::ConstantInt::get(tagType, idx.value()), tagPtr);
+    } else if (type->getStructNumElements() == 0) {
+      builder.CreateStore(llvm::Constant::getNullValue(tagType), tagPtr);
+    }
+
+    small_vector<expr_t> exprList;
+    if (getOutermostAstTag(ast->children[2]) == "exprlist") {
+      exprList = getExprList(ast->children[2]);
+    }
+    if (exprList.size() != type->getStructNumElements()) {
+      return error("invalid number of elements for constructor "
+                   "`{}` of data class `{}` at line {}",
+                   ctorName, className, ast->state.row + 1);
+    }
+    if (exprList.empty()) {
       return alloc;
     }
 
-    return error("could not find data class by name `{}` "
-                 "at line {}",
-                 className, ast->state.row + 1);
+    const auto payload = DataClass::getPayload(builder, alloc, type);
+    for (size_t i = 0; i < exprList.size(); ++i) {
+      auto val = exprList[i]->codegen(builder);
+      if (!val) {
+        return val.takeError();
+      }
+      const auto value = *val;
+      const auto ptr = builder.CreateStructGEP(type, payload, i, "");
+
+      if (value->getType() != ptr->getType()->getPointerElementType()) {
+        return error("type mismatch at index {} of constructor "
+                     "`{}` of data class `{}` at line {}",
+                     i, ctorName, className, ast->state.row + 1);
+      }
+      builder.CreateStore(value, ptr);
+    }
+    return alloc;
+  }
+
+  // returns the variant index of a data class value (pointer)
+  static llvm::Value* getTag(llvm::IRBuilder<>& builder,
+                             llvm::Value* const value,
+                             llvm::StringRef className) {
+    const auto module = builder.GetInsertBlock()->getModule();
+    const auto type = value->getType()->getPointerElementType();
+    const auto tag =
+        builder.CreateLoad(builder.CreateStructGEP(type, value, 0), "tag");
+    if (const auto niche = DataClass::getNiche(module, className)) {
+      return builder.CreateSelect(
+          builder.CreateIsNull(tag), builder.getInt8(niche.value()),
+          builder.getInt8(1 - niche.value()), "tag");
+    }
+    return tag;
+  }
+
+  // returns a pointer to the variant payload of a data class value (pointer)
+  static llvm::Value* getPayload(llvm::IRBuilder<>& builder,
+                                 llvm::Value* const value,
+                                 llvm::Type* const variant) {
+    const auto type = value->getType()->getPointerElementType();
+    // niche-optimized classes are their own payload, which is otherwise the
+    // last field (after the tag, and any alignment field)
+    const auto numElements = type->getStructNumElements();
+    const auto payload =
+        numElements == 1
+            ? value
+            : builder.CreateStructGEP(type, value, numElements - 1);
+    return builder.CreateBitCast(payload, variant->getPointerTo(), "payload");
+  }
+
+  // returns the index of the variant represented by a null pointer, if the
+  // data class is niche-optimized
+  inline static std::optional<unsigned>
+  getNiche(const llvm::Module* const module, llvm::StringRef className) {
+    const auto parts = getMetadataParts(*module, "niches", className);
+    if (parts.empty()) {
+      return std::nullopt;
+    }
+    return DataClass::getIndex(module, className, parts.front());
   }
 
   inline static std::optional<unsigned>
@@ -51,12 +51,16 @@ public:
     if (!tp) {
       return tp.takeError();
     }
-    const auto type = *tp;
+    const auto type = Type::getClosureKind(*tp);
     for (const auto& var : vars_) {
       if (auto err = Ident::isUnique(builder, var, state_)) {
         return err;
       }
       const auto ptr = builder.CreateAlloca(type, 0, nullptr, var);
+      if (Type::isVariableLengthArray(type)) {
+        // (empty until appended to)
+        builder.CreateStore(llvm::Constant::getNullValue(type), ptr);
+      }
       for (const auto& [varName, initializer] : initializers_) {
         if (var == varName) {
           const auto list = initializer.list();
@@ -19,6 +19,9 @@
 #pragma once
 
 #include "ast.hpp"
+#include "coroutine.hpp"
+#include "dynamicarray.hpp"
+#include "receive.hpp"
 
 namespace whack::ast {
 
@@ -36,10 +39,65 @@ public:
         return e.takeError();
       }
       auto source = *e;
+      // deleting a closure releases its environment (moving it to the heap,
+      // see lowerClosureEnvironments)
+      if (llvm::isa<llvm::AllocaInst>(source) &&
+          Type::isClosureType(source->getType()->getPointerElementType())) {
+        source = builder.CreateLoad(source);
+      }
+      if (Type::isClosureType(source->getType())) {
+        source = builder.CreateExtractValue(source, 1);
+        const auto free = llvm::CallInst::CreateFree(source, block);
+        free->setMetadata("closure.delete",
+                          llvm::MDNode::get(block->getContext(), {}));
+        builder.Insert(free);
+        continue;
+      }
+      // deleting a dynamic array frees its buffer (see dynamicarray.hpp),
+      // emptying the array when deleted through its owner
+      if (Type::isVariableLengthArray(source->getType())) {
+        builder.Insert(llvm::CallInst::CreateFree(
+            builder.CreateExtractValue(source, 0), block));
+        continue;
+      }
+      if (source->getType()->isPointerTy() &&
+          Type::isVariableLengthArray(
+              source->getType()->getPointerElementType())) {
+        const auto type = source->getType()->getPointerElementType();
+        builder.Insert(llvm::CallInst::CreateFree(
+            getDynamicArrayField(builder, source, 0), block));
+        builder.CreateStore(llvm::Constant::getNullValue(type), source);
+        continue;
+      }
       if (!source->getType()->isPointerTy()) {
         return error("invalid type for operator delete at line {}",
                      state_.row + 1);
       }
+      // channels own their slots (and are aligned allocations)
+      if (Type::getChanElementType(source->getType())) {
+        builder.CreateCall(
+            getChanFunction(block->getModule(), "__builtin_chan_free"),
+            builder.CreateBitCast(source,
+                                  BasicTypes["char"]->getPointerTo(0)));
+        continue;
+      }
+      // deleting a future detaches it (its task is freed once done)
+      if (Type::getFutureResultType(source->getType())) {
+        const auto ptr = BasicTypes["char"]->getPointerTo(0);
+        const auto detach = block->getModule()->getOrInsertFunction(
+            "__builtin_future_free", BasicTypes["void"], ptr);
+        builder.CreateCall(detach, builder.CreateBitCast(source, ptr));
+        continue;
+      }
+      // deleting a coroutine destroys its frame
+      if (Type::getCoroValueType(source->getType())) {
+        const auto module = block->getModule();
+        builder.CreateCall(
+            getCoroIntrinsic(module, llvm::Intrinsic::coro_destroy),
+            builder.CreateBitCast(source,
+                                  BasicTypes["char"]->getPointerTo(0)));
+        continue;
+      }
       if (!block->empty() && block->back().isTerminator()) {
         (void)llvm::CallInst::CreateFree(source, &block->back());
       } else {
@@ -0,0 +1,162 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_DYNAMICARRAY_HPP
+#define WHACK_DYNAMICARRAY_HPP
+
+#pragma once
+
+#include "ast.hpp"
+#include "heap.hpp"
+#include "integral.hpp"
+#include "type.hpp"
+#include <llvm/IR/MDBuilder.h>
+
+// A dynamic array []T is a {T* data, int len, int cap} header over a heap
+// buffer with room for cap elements, the first len of which are in use.
+// The buffer grows geometrically (starting at kMinArrayCapacity elements),
+// so appending is amortized O(1) and only calls realloc when the buffer is
+// full.
+// The variable (or field) a dynamic array is created in owns its buffer,
+// which `delete` frees. Headers are copied by value, and copies are views
+// of the owner's buffer: they (like slices of the array, and elements
+// bound in place by for-in) are only valid until the owner is appended to,
+// which may move the buffer, or deleted.
+
+namespace whack::ast {
+
+constexpr auto kMinArrayCapacity = 8;
+
+/// @brief Declares malloc or realloc
+static llvm::Constant* getHeapFunction(llvm::Module* const module,
+                                       llvm::StringRef name) {
+  const auto ptr = BasicTypes["char"]->getPointerTo(0);
+  const auto sizeType =
+      module->getDataLayout().getIntPtrType(module->getContext());
+  return module->getOrInsertFunction(
+      name, name == "malloc"
+                ? llvm::FunctionType::get(ptr, sizeType, false)
+                : llvm::FunctionType::get(ptr, {ptr, sizeType}, false));
+}
+
+/// @brief Returns the size in bytes of count elements of type type
+static llvm::Value* getAllocSize(llvm::IRBuilder<>& builder,
+                                 llvm::Type* const type,
+                                 llvm::Value* const count) {
+  const auto module = builder.GetInsertBlock()->getModule();
+  const auto sizeType =
+      module->getDataLayout().getIntPtrType(module->getContext());
+  return builder.CreateMul(
+      builder.CreateZExt(count, sizeType),
+      llvm::ConstantInt::get(sizeType, Type::getAllocSize(module, type)));
+}
+
+/// @brief Returns T, for the header type of []T
+inline static llvm::Type*
+getDynamicArrayElementType(const llvm::Type* const type) {
+  return type->getStructElementType(0)->getPointerElementType();
+}
+
+/// @brief Returns the data pointer (0), length (1) or capacity (2) of the
+/// dynamic array (its header, or a pointer to it). Slices share the data
+/// pointer and length fields.
+static llvm::Value* getDynamicArrayField(llvm::IRBuilder<>& builder,
+                                         llvm::Value* const array,
+                                         const unsigned idx) {
+  const auto type = array->getType();
+  if (!type->isPointerTy()) {
+    return builder.CreateExtractValue(array, idx);
+  }
+  return builder.CreateLoad(
+      builder.CreateStructGEP(type->getPointerElementType(), array, idx));
+}
+
+/// @brief Grows the buffer at data (with room for the number of elements
+/// of type type at capacity) to fit needed elements. Buffers at least
+/// double when they grow, so we weight the growing branch as unlikely.
+static void reserveDynamicArray(llvm::IRBuilder<>& builder,
+                                llvm::Type* const type,
+                                llvm::Value* const data,
+                                llvm::Value* const capacity,
+                                llvm::Value* const needed) {
+  const auto func = builder.GetInsertBlock()->getParent();
+  auto& ctx = func->getContext();
+  const auto grow = llvm::BasicBlock::Create(ctx, "", func);
+  const auto cont = llvm::BasicBlock::Create(ctx, "", func);
+  const auto cap = builder.CreateLoad(capacity);
+  llvm::MDBuilder MDBuilder{ctx};
+  builder.CreateCondBr(builder.CreateICmpSGT(needed, cap), grow, cont,
+                       MDBuilder.createBranchWeights(1, 64));
+  builder.SetInsertPoint(grow);
+  auto grown = builder.CreateShl(cap, 1);
+  grown = builder.CreateSelect(builder.CreateICmpSGT(needed, grown), needed,
+                               grown);
+  const auto min = Integral::get(kMinArrayCapacity);
+  grown =
+      builder.CreateSelect(builder.CreateICmpSLT(grown, min), min, grown);
+  builder.CreateStore(grown, capacity);
+  const auto ptr = BasicTypes["char"]->getPointerTo(0);
+  const auto mem = builder.CreateCall(
+      getHeapFunction(func->getParent(), "realloc"),
+      {builder.CreateBitCast(builder.CreateLoad(data), ptr),
+       getAllocSize(builder, type, grown)});
+  checkAllocation(builder, mem);
+  builder.CreateStore(
+      builder.CreateBitCast(mem, data->getType()->getPointerElementType()),
+      data);
+  builder.CreateBr(cont);
+  builder.SetInsertPoint(cont);
+}
+
+/// @brief Makes room for count more elements in the dynamic array (through
+/// a pointer to its header)
+static void reserveDynamicArray(llvm::IRBuilder<>& builder,
+                                llvm::Value* const array,
+                                llvm::Value* const count) {
+  const auto type = array->getType()->getPointerElementType();
+  const auto len = getDynamicArrayField(builder, array, 1);
+  reserveDynamicArray(builder, getDynamicArrayElementType(type),
+                      builder.CreateStructGEP(type, array, 0),
+                      builder.CreateStructGEP(type, array, 2),
+                      builder.CreateNSWAdd(len, count));
+}
+
+/// @brief Returns a new dynamic array (header) holding the values, which
+/// are of type type
+static llvm::Value* makeDynamicArray(llvm::IRBuilder<>& builder,
+                                     llvm::Type* const array,
+                                     llvm::ArrayRef<llvm::Value*> values) {
+  const auto module = builder.GetInsertBlock()->getModule();
+  const auto type = getDynamicArrayElementType(array);
+  const auto len = Integral::get(values.size());
+  const auto cap = Integral::get(
+      std::max<int64_t>(values.size(), kMinArrayCapacity));
+  const auto mem = builder.CreateCall(getHeapFunction(module, "malloc"),
+                                      getAllocSize(builder, type, cap));
+  checkAllocation(builder, mem);
+  const auto data = builder.CreateBitCast(mem, type->getPointerTo(0));
+  for (size_t i = 0; i < values.size(); ++i) {
+    builder.CreateStore(values[i],
+                        builder.CreateInBoundsGEP(data, Integral::get(i)));
+  }
+  llvm::Value* header = llvm::UndefValue::get(array);
+  header = builder.CreateInsertValue(header, data, 0);
+  header = builder.CreateInsertValue(header, len, 1);
+  return builder.CreateInsertValue(header, cap, 2);
+}
+
+} // end namespace whack::ast
+
+#endif // WHACK_DYNAMICARRAY_HPP
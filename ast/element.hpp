@@ -19,6 +19,14 @@
 #pragma once
 
 #include "ast.hpp"
+#include "arraytype.hpp"
+#include "atomic.hpp"
+#include "compileropt.hpp"
+#include "dynamicarray.hpp"
+#include "integral.hpp"
+#include "structmember.hpp"
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/ValueSymbolTable.h>
 
 namespace whack::ast {
 
@@ -28,38 +36,247 @@ public:
       : Factor(kElement), ast_{ast} {}
 
   llvm::Expected<llvm::Value*> codegen(llvm::IRBuilder<>& builder) const final {
+    auto e = this->resolve(builder);
+    if (!e) {
+      return e.takeError();
+    }
+    const auto [extracted, soa, index] = *e;
+    if (bitField_) {
+      return StructMember::loadBitField(builder, extracted, bitField_.value());
+    }
+    return soa ? gather(builder, soa, index) : extracted;
+  }
+
+  /// @brief Stores value to the element (scattered over the field arrays of
+  /// structure-of-arrays elements)
+  llvm::Error assign(llvm::IRBuilder<>& builder, llvm::Value* value) const {
+    auto e = this->resolve(builder);
+    if (!e) {
+      return e.takeError();
+    }
+    const auto [extracted, soa, index] = *e;
+    if (bitField_) {
+      return storeBitField(builder, extracted, value);
+    }
+    const auto module = builder.GetInsertBlock()->getModule();
+    const auto type = soa ? ArrayType::getSoAElementType(
+                                module, soa->getType()->getPointerElementType())
+                          : extracted->getType()->getPointerElementType();
+    if (!soa && getAtomicValueType(extracted) == value->getType()) {
+      storeAtomic(builder, value, extracted);
+      return llvm::Error::success();
+    }
+    if (soa && value->getType() == type->getPointerTo(0)) {
+      value = builder.CreateLoad(value);
+    }
+    if (value->getType() != type) {
+      return error("type mismatch: cannot assign at line {}",
+                   ast_->state.row + 1);
+    }
+    if (!soa) {
+      builder.CreateStore(value, extracted);
+      return llvm::Error::success();
+    }
+    for (unsigned i = 0; i < type->getStructNumElements(); ++i) {
+      builder.CreateStore(builder.CreateExtractValue(value, i),
+                          getSoAField(builder, soa, index, i));
+    }
+    return llvm::Error::success();
+  }
+
+  /// @brief Gathers element index of the structure-of-arrays soa into a
+  /// temporary
+  static llvm::Value* gather(llvm::IRBuilder<>& builder,
+                             llvm::Value* const soa,
+                             llvm::Value* const index) {
+    const auto func = builder.GetInsertBlock()->getParent();
+    const auto type = ArrayType::getSoAElementType(
+        func->getParent(), soa->getType()->getPointerElementType());
+    llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                            func->getEntryBlock().begin()};
+    const auto tmp = entry.CreateAlloca(type, 0, nullptr, "");
+    for (unsigned i = 0; i < type->getNumElements(); ++i) {
+      builder.CreateStore(
+          builder.CreateLoad(getSoAField(builder, soa, index, i)),
+          builder.CreateStructGEP(type, tmp, i));
+    }
+    return tmp;
+  }
+
+  /// @brief Traps unless index < len (as unsigned, so that negative indices
+  /// fail too). The check (a branch tagged "boundscheck") is removed by
+  /// pass::BoundsCheck when it cannot fail. Returns the index, as wide as
+  /// the compared values.
+  static llvm::Value* checkBounds(llvm::IRBuilder<>& builder,
+                                  llvm::Value* index, llvm::Value* len) {
+    const auto func = builder.GetInsertBlock()->getParent();
+    auto& ctx = func->getContext();
+    if (index->getType()->getIntegerBitWidth() <
+        len->getType()->getIntegerBitWidth()) {
+      index = builder.CreateSExt(index, len->getType());
+    } else {
+      len = builder.CreateZExtOrTrunc(len, index->getType());
+    }
+    // all the checks of a function share a trap
+    auto trap = llvm::dyn_cast_or_null<llvm::BasicBlock>(
+        func->getValueSymbolTable()->lookup("boundscheck"));
+    if (!trap) {
+      trap = llvm::BasicBlock::Create(ctx, "boundscheck", func);
+      llvm::IRBuilder<> fail{trap};
+      fail.CreateCall(llvm::Intrinsic::getDeclaration(func->getParent(),
+                                                      llvm::Intrinsic::trap));
+      fail.CreateUnreachable();
+    }
+    const auto ok = llvm::BasicBlock::Create(ctx, "", func);
+    builder
+        .CreateCondBr(builder.CreateICmpULT(index, len), ok, trap)
+        ->setMetadata("boundscheck", llvm::MDNode::get(ctx, {}));
+    builder.SetInsertPoint(ok);
+    return index;
+  }
+
+  /// @brief Whether the element last resolved by codegen is a bitfield
+  /// (`xs[i].bits`), whose value is loaded rather than addressed
+  bool isBitField() const noexcept { return bitField_.has_value(); }
+
+  /// @brief Stores value to the bitfield last resolved by codegen (without
+  /// evaluating the indices again), for compound assignment
+  llvm::Error assignBitField(llvm::IRBuilder<>& builder,
+                             llvm::Value* const value) const {
+    return storeBitField(builder, storage_, value);
+  }
+
+  inline static bool classof(const Factor* const factor) {
+    return factor->getKind() == kElement;
+  }
+
+private:
+  const mpc_ast_t* const ast_;
+  // (the storage of a bitfield resolves to the whole storage unit)
+  mutable std::optional<StructMember::bitfield_t> bitField_;
+  mutable llvm::Value* storage_{nullptr};
+
+  llvm::Error storeBitField(llvm::IRBuilder<>& builder,
+                            llvm::Value* const storage,
+                            llvm::Value* const value) const {
+    if (value->getType() != bitField_.value().second->getType()) {
+      return error("type mismatch: cannot assign at line {}",
+                   ast_->state.row + 1);
+    }
+    StructMember::storeBitField(builder, storage, bitField_.value(), value);
+    return llvm::Error::success();
+  }
+
+  /// @brief The element pointer, or the structure-of-arrays and index of
+  /// a whole SoA element (which has no address)
+  using element_t = std::tuple<llvm::Value*, llvm::Value*, llvm::Value*>;
+
+  llvm::Expected<element_t> resolve(llvm::IRBuilder<>& builder) const {
+    bitField_.reset();
+    storage_ = nullptr;
     auto e = getFactor(ast_->children[0])->codegen(builder);
     if (!e) {
       return e.takeError();
     }
     auto extracted = *e;
-    for (auto i = 2; i < ast_->children_num; i += 3) {
+    llvm::Value* soa = nullptr;
+    llvm::Value* soaIndex = nullptr;
+    const auto module = builder.GetInsertBlock()->getModule();
+    const auto checked = CompilerOpt::isSet(module, "boundscheck");
+    auto i = 2;
+    for (; i < ast_->children_num &&
+           std::string_view(ast_->children[i - 1]->contents) == "[";
+         i += 3) {
+      if (soa) {
+        extracted = gather(builder, soa, soaIndex);
+        soa = nullptr;
+      }
       // @todo Constrain types accepted for index
       auto idx = getExpressionValue(ast_->children[i])->codegen(builder);
       if (!idx) {
         return idx.takeError();
       }
-      const auto index = *idx;
-      const auto type = extracted->getType()->getPointerElementType();
-      if (type->isArrayTy() || type->isPointerTy()) {
+      auto index = *idx;
+      // through pointer variables (e.g. holding arrays from `new`)
+      auto type = extracted->getType()->getPointerElementType();
+      if (type->isPointerTy() &&
+          (llvm::isa<llvm::AllocaInst>(extracted) ||
+           llvm::isa<llvm::GetElementPtrInst>(extracted))) {
+        extracted = builder.CreateLoad(extracted);
+        type = type->getPointerElementType();
+      }
+      if (ArrayType::isSoA(type)) {
+        // (all the columns are as long as the array)
+        if (checked) {
+          index = checkBounds(
+              builder, index,
+              Integral::get(
+                  type->getStructElementType(0)->getArrayNumElements()));
+        }
+        // SoA elements are gathered unless only a field is accessed
+        soa = extracted;
+        soaIndex = index;
+      } else if (type->isArrayTy()) {
+        if (checked) {
+          index = checkBounds(builder, index,
+                              Integral::get(type->getArrayNumElements()));
+        }
         extracted =
             builder.CreateInBoundsGEP(extracted, {Integral::zero(), index});
-      } else if (Type::isVariableLengthArray(type)) {
-        auto elems = builder.CreateStructGEP(type, extracted, 1);
-        extracted = builder.CreateInBoundsGEP(elems, {Integral::zero(), index});
+      } else if (Type::isVariableLengthArray(type) ||
+                 ArrayType::isSlice(type)) {
+        if (checked) {
+          index = checkBounds(builder, index,
+                              getDynamicArrayField(builder, extracted, 1));
+        }
+        extracted = builder.CreateInBoundsGEP(
+            getDynamicArrayField(builder, extracted, 0), index);
       } else {
         extracted = builder.CreateGEP(extracted, index);
       }
     }
-    return extracted;
-  }
 
-  inline static bool classof(const Factor* const factor) {
-    return factor->getKind() == kElement;
+    // members of elements: xs[i].field
+    for (; i < ast_->children_num; i += 2) {
+      const auto member = ast_->children[i]->contents;
+      if (bitField_) {
+        return error("cannot access a member of bitfield at line {}",
+                     ast_->state.row + 1);
+      }
+      const auto type =
+          soa ? ArrayType::getSoAElementType(
+                    module, soa->getType()->getPointerElementType())
+              : extracted->getType()->getPointerElementType();
+      const auto idx =
+          type->isStructTy()
+              ? StructMember::getIndex(*module, type->getStructName(), member)
+              : std::nullopt;
+      if (!idx) {
+        return error("`{}` is not a field of element at line {}", member,
+                     ast_->state.row + 1);
+      }
+      extracted = soa ? getSoAField(builder, soa, soaIndex, idx.value())
+                      : builder.CreateStructGEP(type, extracted, idx.value(),
+                                                member);
+      soa = nullptr;
+      // bitfields resolve to their storage (see StructMember)
+      if ((bitField_ =
+               StructMember::getBitField(*module, type->getStructName(),
+                                         member))) {
+        storage_ = extracted;
+      }
+    }
+    return element_t{extracted, soa, soaIndex};
   }
 
-private:
-  const mpc_ast_t* const ast_;
+  /// @brief Returns a pointer to field (element) idx of SoA element index
+  static llvm::Value* getSoAField(llvm::IRBuilder<>& builder,
+                                  llvm::Value* const soa,
+                                  llvm::Value* const index,
+                                  const unsigned idx) {
+    return builder.CreateInBoundsGEP(
+        soa, {Integral::zero(), Integral::get(idx), index});
+  }
 };
 
 } // end namespace whack::ast
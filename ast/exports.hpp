@@ -29,6 +29,16 @@ public:
 
   const auto& exportSymbols() const { return exportSymbols_; }
 
+  /// @brief Records the exported symbols in "exports" metadata; symbols
+  /// which are not exported are internalized (see pass::Internalize)
+  void codegen(llvm::Module* const module) const {
+    auto& ctx = module->getContext();
+    const auto MD = module->getOrInsertNamedMetadata("exports");
+    for (const auto symbol : exportSymbols_) {
+      MD->addOperand(llvm::MDNode::get(ctx, llvm::MDString::get(ctx, symbol)));
+    }
+  }
+
 private:
   ident_list_t exportSymbols_;
 };
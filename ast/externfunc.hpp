@@ -73,7 +73,13 @@ private:
       if (!params) {
         return params.takeError();
       }
-      const auto& [types, variadic] = *params;
+      auto [types, variadic] = std::move(*params);
+      // closures are passed to C as plain function pointers
+      for (auto& type : types) {
+        if (Type::isClosureType(type)) {
+          type = Type::getClosureFuncType(type)->getPointerTo(0);
+        }
+      }
       return llvm::FunctionType::get(*returnType, types, variadic);
     }
     return llvm::FunctionType::get(*returnType, false);
@@ -27,8 +27,10 @@
 #include "expansion.hpp"
 #include "floatingpt.hpp"
 #include "fnalignof.hpp"
+#include "fnappend.hpp"
 #include "fncast.hpp"
 #include "fnlen.hpp"
+#include "fnsizeof.hpp"
 #include "funccall.hpp"
 #include "ident.hpp"
 #include "integral.hpp"
@@ -37,8 +39,10 @@
 #include "nullptr.hpp"
 #include "postop.hpp"
 #include "preop.hpp"
+#include "receive.hpp"
 #include "reference.hpp"
 #include "scoperes.hpp"
+#include "slice.hpp"
 #include "string.hpp"
 #include "structmember.hpp"
 #include "value.hpp"
@@ -59,16 +63,22 @@ static std::unique_ptr<Factor> getFactor(const mpc_ast_t* const ast) {
   OPT("postop", PostOp)
   OPT("funccall", FuncCall)
   OPT("element", Element)
+  OPT("slice", Slice)
   OPT("expandop", ExpandOp)
   OPT("structmember", StructMember)
   OPT("closure", Closure)
   OPT("fncast", FnCast)
+  OPT("fnsizeof", FnSizeOf)
+  OPT("fnalignof", FnAlignOf)
+  OPT("fnappend", FnAppend)
+  OPT("fnlen", FnLen)
   OPT("value", Value)
   OPT("deref", Deref)
   OPT("newexpr", NewExpr)
   OPT("scoperes", ScopeRes)
   OPT("listcomprehension", ListComprehension)
   OPT("reference", Reference)
+  OPT("receive", Receive)
 #undef OPT
   if (tag == "ident") {
     if (std::string_view(ast->contents) == "nullptr") {
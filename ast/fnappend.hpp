@@ -19,20 +19,103 @@
 #pragma once
 
 #include "ast.hpp"
+#include "dynamicarray.hpp"
 
 namespace whack::ast {
 
+/// @brief `append(xs, a, b, c)` appends the values to the dynamic array
+/// xs (or to the one xs points to) in place, making room for all of them
+/// at once. Returns (a pointer to) xs.
 class FnAppend final : public Factor {
 public:
-  explicit FnAppend(const mpc_ast_t* const ast) : Factor(kFnAppend) {}
+  explicit FnAppend(const mpc_ast_t* const ast)
+      : Factor(kFnAppend), state_{ast->state}, array_{ast->children[2]},
+        values_{getExprList(ast->children[4])} {}
 
   llvm::Expected<llvm::Value*> codegen(llvm::IRBuilder<>& builder) const final {
-    llvm_unreachable("not implemented");
+    // arrays are appended to in place
+    const auto tag = getInnermostAstTag(array_);
+    auto a = tag == "ident" || tag == "structmember" || tag == "element"
+                 ? getFactor(array_)->codegen(builder)
+                 : getExpressionValue(array_)->codegen(builder);
+    if (!a) {
+      return a.takeError();
+    }
+    auto array = *a;
+    while (array->getType()->isPointerTy() &&
+           array->getType()->getPointerElementType()->isPointerTy()) {
+      array = builder.CreateLoad(array);
+    }
+    const auto type = array->getType();
+    if (!type->isPointerTy() ||
+        !Type::isVariableLengthArray(type->getPointerElementType())) {
+      return error("append expects a dynamic array at line {}",
+                   state_.row + 1);
+    }
+    const auto elementType =
+        getDynamicArrayElementType(type->getPointerElementType());
+    small_vector<llvm::Value*> values;
+    for (const auto& expr : values_) {
+      auto v = expr->codegen(builder);
+      if (!v) {
+        return v.takeError();
+      }
+      auto value = *v;
+      if (llvm::isa<llvm::AllocaInst>(value) ||
+          llvm::isa<llvm::GetElementPtrInst>(value)) {
+        value = builder.CreateLoad(value);
+      }
+      if (value->getType() != elementType) {
+        return error("type mismatch: cannot append value {} "
+                     "at line {}",
+                     values.size() + 1, state_.row + 1);
+      }
+      values.push_back(value);
+    }
+
+    reserveDynamicArray(builder, array, Integral::get(values.size()));
+    const auto data = getDynamicArrayField(builder, array, 0);
+    const auto len = getDynamicArrayField(builder, array, 1);
+    for (size_t i = 0; i < values.size(); ++i) {
+      const auto index = builder.CreateNSWAdd(len, Integral::get(i));
+      builder.CreateStore(values[i], builder.CreateInBoundsGEP(data, index));
+    }
+    builder.CreateStore(
+        builder.CreateNSWAdd(len, Integral::get(values.size())),
+        builder.CreateStructGEP(type->getPointerElementType(), array, 1));
+    return array;
   }
 
   inline static bool classof(const Factor* const factor) {
     return factor->getKind() == kFnAppend;
   }
+
+private:
+  const mpc_state_t state_;
+  const mpc_ast_t* const array_;
+  small_vector<expr_t> values_;
 };
 
+class FnAppendStmt final : public Stmt {
+public:
+  explicit FnAppendStmt(const mpc_ast_t* const ast)
+      : Stmt(kFnAppend), impl_{ast} {}
+
+  llvm::Error codegen(llvm::IRBuilder<>& builder) const final {
+    if (auto val = impl_.codegen(builder); !val) {
+      return val.takeError();
+    }
+    return llvm::Error::success();
+  }
+
+  inline static bool classof(const Stmt* const stmt) {
+    return stmt->getKind() == kFnAppend;
+  }
+
+private:
+  const FnAppend impl_;
+};
+
+} // end namespace whack::ast
+
 #endif // WHACK_FNAPPEND_HPP
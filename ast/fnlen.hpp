@@ -16,7 +16,9 @@
 #ifndef WHACK_FNLEN_HPP
 #define WHACK_FNLEN_HPP
 
+#include "arraytype.hpp"
 #include "ast.hpp"
+#include "dynamicarray.hpp"
 
 #pragma once
 
@@ -33,9 +35,19 @@ public:
       return e.takeError();
     }
     const auto expr = *e;
-    const auto type = expr->getType();
-    if (Type::isVariableLengthArray(type)) {
-      // @todo
+    // (struct kinds, including SoA arrays, are not loaded)
+    const auto [type, _] = Type::isStructKind(expr->getType());
+    if (type->isArrayTy()) {
+      return Integral::get(type->getArrayNumElements());
+    }
+    if (Type::isVariableLengthArray(type) || ArrayType::isSlice(type)) {
+      return getDynamicArrayField(builder, expr, 1);
+    }
+    if (ArrayType::isSoA(type)) { // soa::X[N]
+      unsigned len;
+      (void)type->getStructName().rsplit('[').second.drop_back().getAsInteger(
+          10, len);
+      return Integral::get(len);
     }
     return Integral::one(); // @todo
   }
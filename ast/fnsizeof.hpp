@@ -19,31 +19,41 @@
 #pragma once
 
 #include "ast.hpp"
-#include <llvm/IR/DataLayout.h>
+#include "type.hpp"
 
 namespace whack::ast {
 
 class FnSizeOf final : public Factor {
 public:
   explicit FnSizeOf(const mpc_ast_t* const ast)
-      : Factor(kFnSizeOf), variadic_{getInnermostAstTag(ast->children[1]) ==
-                                     "expansion"},
-        expr_{getExpressionValue(ast->children[variadic_ ? 3 : 2])} {}
+      : Factor(kFnSizeOf), state_{ast->state},
+        variadic_{getInnermostAstTag(ast->children[1]) == "expansion"},
+        ast_{ast->children[variadic_ ? 3 : 2]},
+        expr_{getExpressionValue(ast_)} {}
 
   llvm::Expected<llvm::Value*> codegen(llvm::IRBuilder<>& builder) const final {
-    llvm_unreachable("not implemented");
     const auto module = builder.GetInsertBlock()->getModule();
     if (variadic_) {
       // @todo
-    } else {
-      if (auto value = expr_->codegen(builder)) {
-        // @todo: Return size of
-        // @todo: Load in case of allocas e.t.c
-        return Type::getBitSize(module, (*value)->getType());
-      } else {
-        // @todo: Check if we have a type name
+      return error("sizeof... not implemented at line {}", state_.row + 1);
+    }
+    // sizeof(<type name>)
+    if (getInnermostAstTag(ast_) == "ident") {
+      if (const auto type = Type::getFromTypeName(module, ast_->contents)) {
+        return llvm::ConstantExpr::getSizeOf(type.value());
       }
     }
+    auto value = expr_->codegen(builder);
+    if (!value) {
+      return value.takeError();
+    }
+    auto type = (*value)->getType();
+    // variables (struct values are not loaded)
+    if (llvm::isa<llvm::AllocaInst>(*value) ||
+        llvm::isa<llvm::GetElementPtrInst>(*value)) {
+      type = type->getPointerElementType();
+    }
+    return llvm::ConstantExpr::getSizeOf(type);
   }
 
   inline static bool classof(const Factor* const factor) {
@@ -51,8 +61,10 @@ public:
   }
 
 private:
+  const mpc_state_t state_;
   const bool variadic_;
-  std::unique_ptr<Expression> expr_;
+  const mpc_ast_t* const ast_;
+  const expr_t expr_;
 };
 
 } // end namespace whack::ast
@@ -19,28 +19,463 @@
 #pragma once
 
 #include "ast.hpp"
+#include "comparison.hpp"
 #include "condition.hpp"
+#include "coroutine.hpp"
+#include "dynamicarray.hpp"
+#include "element.hpp"
+#include "ident.hpp"
 #include "range.hpp"
+#include <llvm/ADT/STLExtras.h>
 
 namespace whack::ast {
 
+/// @brief `for <identlist> in <range> (if <condition>)?` iterates over
+/// integer intervals, arrays (fixed, variable length and structure-of-arrays)
+/// and generators. Intervals and arrays are counted loops over an index
+/// (elements are bound in place); generators are awaited for each of their
+/// values until they complete, so no values are ever collected.
 class ForInExpr final : public AST {
 public:
   explicit ForInExpr(const mpc_ast_t* const ast)
-      : identList_{getIdentList(ast->children[1])}, range_{ast->children[3]} {
+      : state_{ast->state}, identList_{getIdentList(ast->children[1])},
+        range_{ast->children[3]} {
     if (ast->children_num > 4) {
       condition_ = std::make_unique<Condition>(ast->children[5]);
     }
   }
 
+  /// @brief Emits the loop, whose body is emitted by body. The header block
+  /// of the loop is named "for" (continue starts the next iteration there)
+  /// and is only entered through a conditional branch to the end of the
+  /// loop (which break takes).
+  llvm::Error codegen(llvm::IRBuilder<>& builder,
+                      llvm::function_ref<llvm::Error()> body) const {
+    auto it = range_.begin(builder);
+    if (!it) {
+      return it.takeError();
+    }
+    const auto iterable = getValue(builder, *it);
+    const auto type = iterable->getType();
+    const auto func = builder.GetInsertBlock()->getParent();
+    auto& ctx = func->getContext();
+    const auto loop = llvm::BasicBlock::Create(ctx, "for", func);
+    const auto next = llvm::BasicBlock::Create(ctx, "next", func);
+    const auto cont = llvm::BasicBlock::Create(ctx, "cont", func);
+
+    auto element = [&]() -> llvm::Expected<llvm::Value*> {
+      if (range_.isInterval()) {
+        return this->count(builder, iterable, loop, cont);
+      }
+      if (Type::getCoroValueType(type)) {
+        return this->await(builder, iterable, loop, cont);
+      }
+      if (isArray(type)) {
+        return this->index(builder, iterable, loop, cont);
+      }
+      return error("cannot iterate over value at line {}", state_.row + 1);
+    }();
+    if (!element) {
+      return element.takeError();
+    }
+
+    // generators we called are ours to destroy (letting CoroElide allocate
+    // their frames on our stack), when the loop ends or the body returns
+    const auto destroy = [&](llvm::Instruction* const insertBefore) {
+      if (Type::getCoroValueType(type) &&
+          llvm::isa<llvm::CallInst>(iterable)) {
+        llvm::CallInst::Create(
+            getCoroIntrinsic(func->getParent(), llvm::Intrinsic::coro_destroy),
+            new llvm::BitCastInst(iterable,
+                                  BasicTypes["char"]->getPointerTo(0), "",
+                                  insertBefore),
+            "", insertBefore);
+      }
+    };
+    llvm::SmallPtrSet<const llvm::BasicBlock*, 16> blocks;
+    for (const auto& block : *func) {
+      blocks.insert(&block);
+    }
+
+    small_vector<llvm::Value*> bindings;
+    if (auto err = this->bind(builder, *element, bindings)) {
+      return err;
+    }
+    if (condition_) {
+      auto cond = condition_->codegen(builder);
+      if (!cond) {
+        return cond.takeError();
+      }
+      const auto then = llvm::BasicBlock::Create(ctx, "", func, next);
+      builder.CreateCondBr(*cond, then, next);
+      builder.SetInsertPoint(then);
+    }
+    if (auto err = body()) {
+      return err;
+    }
+    if (!builder.GetInsertBlock()->getTerminator()) {
+      builder.CreateBr(next);
+    }
+    for (auto& block : *func) {
+      const auto term = block.getTerminator();
+      if (blocks.count(&block) || !term) {
+        continue;
+      }
+      // (returning from a coroutine branches to its final suspend)
+      const auto br = llvm::dyn_cast<llvm::BranchInst>(term);
+      if (llvm::isa<llvm::ReturnInst>(term) ||
+          (br && br->isUnconditional() &&
+           br->getSuccessor(0)->getName() == "::coro.final")) {
+        destroy(term);
+      }
+    }
+    next->moveAfter(builder.GetInsertBlock());
+    cont->moveAfter(next);
+    builder.SetInsertPoint(next);
+    builder.CreateBr(loop);
+    for (const auto binding : bindings) {
+      binding->setName("");
+    }
+
+    builder.SetInsertPoint(cont);
+    if (Type::getCoroValueType(type) && llvm::isa<llvm::CallInst>(iterable)) {
+      builder.CreateCall(
+          getCoroIntrinsic(func->getParent(), llvm::Intrinsic::coro_destroy),
+          builder.CreateBitCast(iterable,
+                                BasicTypes["char"]->getPointerTo(0)));
+    }
+    return llvm::Error::success();
+  }
+
+  /// @brief Returns the number of iterations of the loop (regardless of
+  /// its condition) if it is known before the loop, i.e. for arrays and
+  /// bounded intervals which do not depend on bound (the names bound by
+  /// enclosing loops). Returns nullptr otherwise.
+  llvm::Expected<llvm::Value*> getTripCount(llvm::IRBuilder<>& builder,
+                                            const ident_list_t& bound) const {
+    if (!range_.isInvariant(bound) ||
+        (range_.isInterval() && !range_.hasEnd())) {
+      return nullptr;
+    }
+    auto it = range_.begin(builder);
+    if (!it) {
+      return it.takeError();
+    }
+    const auto iterable = getValue(builder, *it);
+    const auto type = iterable->getType();
+    if (!range_.isInterval()) {
+      return isArray(type) ? getLength(builder, iterable) : nullptr;
+    }
+    if (!type->isIntegerTy()) {
+      return error("expected an integer range at line {}", state_.row + 1);
+    }
+    auto e = range_.end(builder);
+    if (!e) {
+      return e.takeError();
+    }
+    llvm::Value* step = Integral::one(type);
+    if (range_.hasNext()) {
+      auto n = range_.next(builder);
+      if (!n) {
+        return n.takeError();
+      }
+      step = getValue(builder, *n);
+    }
+    const auto end = getValue(builder, *e);
+    if (step->getType() != type || end->getType() != type) {
+      return error("type mismatch: range bounds must be of the same type "
+                   "at line {}",
+                   state_.row + 1);
+    }
+    const auto constStep = llvm::dyn_cast<llvm::ConstantInt>(step);
+    if (constStep && constStep->isZero()) {
+      return error("range step cannot be zero at line {}", state_.row + 1);
+    }
+    return builder.CreateIntCast(
+        countSteps(builder, iterable, end, step, range_.endInclusive()),
+        BasicTypes["int"], true);
+  }
+
   inline const auto& identList() const { return identList_; }
   inline const auto& range() const { return range_; }
   inline const auto& condition() const { return condition_; }
 
 private:
+  mpc_state_t state_;
   ident_list_t identList_;
   Range range_;
   std::unique_ptr<Condition> condition_;
+
+  /// @brief Loads variables holding scalars and pointers (arrays are
+  /// iterated in place, and array values are spilled to the stack)
+  static llvm::Value* getValue(llvm::IRBuilder<>& builder,
+                               llvm::Value* const value) {
+    const auto type = value->getType();
+    if (llvm::isa<llvm::AllocaInst>(value) ||
+        llvm::isa<llvm::GetElementPtrInst>(value)) {
+      const auto pointee = type->getPointerElementType();
+      return pointee->isAggregateType() ? value : builder.CreateLoad(value);
+    }
+    if (!type->isAggregateType()) {
+      return value;
+    }
+    const auto func = builder.GetInsertBlock()->getParent();
+    llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                            func->getEntryBlock().begin()};
+    const auto tmp = entry.CreateAlloca(type, 0, nullptr, "");
+    builder.CreateStore(value, tmp);
+    return tmp;
+  }
+
+  /// @brief Whether type is a pointer to an array we can iterate over
+  static bool isArray(const llvm::Type* const type) {
+    if (!type->isPointerTy()) {
+      return false;
+    }
+    const auto pointee = type->getPointerElementType();
+    return pointee->isArrayTy() || Type::isVariableLengthArray(pointee) ||
+           ArrayType::isSlice(pointee) || ArrayType::isSoA(pointee);
+  }
+
+  /// @brief Returns the number of elements of the array (through a pointer)
+  static llvm::Value* getLength(llvm::IRBuilder<>& builder,
+                                llvm::Value* const array) {
+    const auto type = array->getType()->getPointerElementType();
+    if (type->isArrayTy()) {
+      return Integral::get(type->getArrayNumElements());
+    }
+    if (Type::isVariableLengthArray(type) || ArrayType::isSlice(type)) {
+      return getDynamicArrayField(builder, array, 1);
+    }
+    // soa::X[N]
+    return Integral::get(type->getStructElementType(0)->getArrayNumElements());
+  }
+
+  /// @brief Returns the number of steps from begin towards end (see count):
+  /// ceil(|end - begin| / |step|) for a non-empty range, and 0 for empty
+  /// ranges or zero steps. The count is computed in a type wide enough for
+  /// the span of any range (twice as wide as begin, up to 128 bits).
+  static llvm::Value* countSteps(llvm::IRBuilder<>& builder,
+                                 llvm::Value* const begin,
+                                 llvm::Value* const end,
+                                 llvm::Value* const step,
+                                 const bool inclusive) {
+    const auto bits = begin->getType()->getIntegerBitWidth();
+    const auto wide = builder.getIntNTy(bits < 128 ? 2 * bits : bits);
+    const auto zero = Integral::zero(wide);
+    const auto one = Integral::one(wide);
+    const auto wideStep = builder.CreateSExt(step, wide);
+    const auto descending = builder.CreateICmpSLT(wideStep, zero);
+    const auto wideBegin = builder.CreateSExt(begin, wide);
+    const auto wideEnd = builder.CreateSExt(end, wide);
+    auto span = builder.CreateSelect(descending,
+                                     builder.CreateSub(wideBegin, wideEnd),
+                                     builder.CreateSub(wideEnd, wideBegin));
+    if (inclusive) {
+      span = builder.CreateAdd(span, one);
+    }
+    // (zero steps are not divided by)
+    const auto isZero = builder.CreateICmpEQ(wideStep, zero);
+    const auto stride = builder.CreateSelect(
+        isZero, one,
+        builder.CreateSelect(descending, builder.CreateNeg(wideStep),
+                             wideStep));
+    const auto count = builder.CreateSDiv(
+        builder.CreateAdd(span, builder.CreateSub(stride, one)), stride);
+    return builder.CreateSelect(
+        builder.CreateAnd(builder.CreateICmpSGT(span, zero),
+                          builder.CreateNot(isZero)),
+        count, zero);
+  }
+
+  /// @brief Counts from begin by next (1 by default) until end, if any,
+  /// upwards or downwards with the sign of next (zero steps count nothing
+  /// towards an end). Returns the (stack) variable holding the current
+  /// count.
+  llvm::Expected<llvm::Value*> count(llvm::IRBuilder<>& builder,
+                                     llvm::Value* const begin,
+                                     llvm::BasicBlock* const loop,
+                                     llvm::BasicBlock* const cont) const {
+    const auto type = begin->getType();
+    if (!type->isIntegerTy()) {
+      return error("expected an integer range at line {}", state_.row + 1);
+    }
+    auto step = Integral::one(type);
+    if (range_.hasNext()) {
+      auto n = range_.next(builder);
+      if (!n) {
+        return n.takeError();
+      }
+      step = getValue(builder, *n);
+    }
+    llvm::Value* end = nullptr;
+    if (range_.hasEnd()) {
+      auto e = range_.end(builder);
+      if (!e) {
+        return e.takeError();
+      }
+      end = getValue(builder, *e);
+    }
+    if (step->getType() != type || (end && end->getType() != type)) {
+      return error("type mismatch: range bounds must be of the same type "
+                   "at line {}",
+                   state_.row + 1);
+    }
+    const auto constStep = llvm::dyn_cast<llvm::ConstantInt>(step);
+    if (constStep && constStep->isZero()) {
+      return error("range step cannot be zero at line {}", state_.row + 1);
+    }
+
+    const auto func = builder.GetInsertBlock()->getParent();
+    llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                            func->getEntryBlock().begin()};
+    const auto counter = entry.CreateAlloca(type, 0, nullptr, "");
+    const auto value = entry.CreateAlloca(type, 0, nullptr, "");
+    builder.CreateStore(begin, counter);
+    if (!end) {
+      builder.CreateCondBr(builder.getTrue(), loop, cont);
+      builder.SetInsertPoint(loop);
+      const auto current = builder.CreateLoad(counter);
+      builder.CreateStore(builder.CreateAdd(current, step), counter);
+      builder.CreateStore(current, value);
+      return value;
+    }
+
+    const auto body =
+        llvm::BasicBlock::Create(func->getContext(), "", func, cont);
+    // counting by 1 up (or down) to an exclusive end cannot overflow, and
+    // is tested on the count itself
+    if (constStep && !range_.endInclusive() &&
+        (constStep->isOne() || constStep->isMinusOne())) {
+      builder.CreateCondBr(builder.getTrue(), loop, cont);
+      builder.SetInsertPoint(loop);
+      const auto current = builder.CreateLoad(counter);
+      builder.CreateStore(builder.CreateNSWAdd(current, step), counter);
+      const auto cmp = INTCMP[constStep->isOne() ? "<" : ">"];
+      builder.CreateCondBr(builder.CreateICmp(cmp, current, end), body, cont);
+      builder.SetInsertPoint(body);
+      builder.CreateStore(current, value);
+      return value;
+    }
+
+    // otherwise the count past the last one may overflow (e.g. for an
+    // inclusive end at the maximum of the type), so the loop runs for the
+    // number of steps (and the count past the last one is never used)
+    const auto steps =
+        countSteps(builder, begin, end, step, range_.endInclusive());
+    const auto trip = entry.CreateAlloca(steps->getType(), 0, nullptr, "");
+    builder.CreateStore(Integral::zero(steps->getType()), trip);
+    builder.CreateCondBr(builder.getTrue(), loop, cont);
+    builder.SetInsertPoint(loop);
+    const auto current = builder.CreateLoad(counter);
+    const auto taken = builder.CreateLoad(trip);
+    builder.CreateStore(builder.CreateNSWAdd(current, step), counter);
+    builder.CreateStore(
+        builder.CreateNSWAdd(taken, Integral::one(steps->getType())), trip);
+    builder.CreateCondBr(builder.CreateICmpSLT(taken, steps), body, cont);
+    builder.SetInsertPoint(body);
+    builder.CreateStore(current, value);
+    return value;
+  }
+
+  /// @brief Counts over the indices of the array (through a pointer to it).
+  /// Returns a pointer to the current element (a gathered copy, for
+  /// structure-of-arrays).
+  llvm::Expected<llvm::Value*> index(llvm::IRBuilder<>& builder,
+                                     llvm::Value* const array,
+                                     llvm::BasicBlock* const loop,
+                                     llvm::BasicBlock* const cont) const {
+    if (range_.hasNext() || range_.hasEnd()) {
+      return error("cannot use range bounds with arrays at line {}",
+                   state_.row + 1);
+    }
+    const auto type = array->getType()->getPointerElementType();
+    const auto len = getLength(builder, array);
+    const auto func = builder.GetInsertBlock()->getParent();
+    llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                            func->getEntryBlock().begin()};
+    const auto counter = entry.CreateAlloca(BasicTypes["int"], 0, nullptr, "");
+    builder.CreateStore(Integral::zero(), counter);
+    builder.CreateCondBr(builder.getTrue(), loop, cont);
+    builder.SetInsertPoint(loop);
+    const auto current = builder.CreateLoad(counter);
+    builder.CreateStore(builder.CreateNSWAdd(current, Integral::one()),
+                        counter);
+    const auto body =
+        llvm::BasicBlock::Create(func->getContext(), "", func, cont);
+    builder.CreateCondBr(builder.CreateICmpSLT(current, len), body, cont);
+    builder.SetInsertPoint(body);
+    if (ArrayType::isSoA(type)) {
+      return Element::gather(builder, array, current);
+    }
+    if (type->isArrayTy()) {
+      return builder.CreateInBoundsGEP(array, {Integral::zero(), current});
+    }
+    return builder.CreateInBoundsGEP(getDynamicArrayField(builder, array, 0),
+                                     current);
+  }
+
+  /// @brief Awaits the generator handle for each of its values (until it
+  /// completes). Returns the (stack) variable holding the current value.
+  llvm::Expected<llvm::Value*> await(llvm::IRBuilder<>& builder,
+                                     llvm::Value* const handle,
+                                     llvm::BasicBlock* const loop,
+                                     llvm::BasicBlock* const cont) const {
+    const auto type = Type::getCoroValueType(handle->getType());
+    if (type->isVoidTy()) {
+      return error("cannot iterate over a coroutine without values "
+                   "at line {}",
+                   state_.row + 1);
+    }
+    const auto func = builder.GetInsertBlock()->getParent();
+    builder.CreateCondBr(builder.getTrue(), loop, cont);
+    builder.SetInsertPoint(loop);
+    const auto next = awaitCoroutine(builder, handle);
+    // the last value is that of a completed coroutine, which we skip
+    const auto done = builder.CreateCall(
+        getCoroIntrinsic(func->getParent(), llvm::Intrinsic::coro_done),
+        builder.CreateBitCast(handle, BasicTypes["char"]->getPointerTo(0)));
+    const auto body =
+        llvm::BasicBlock::Create(func->getContext(), "", func, cont);
+    builder.CreateCondBr(done, cont, body);
+    builder.SetInsertPoint(body);
+    llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                            func->getEntryBlock().begin()};
+    const auto value = entry.CreateAlloca(type, 0, nullptr, "");
+    builder.CreateStore(next, value);
+    return value;
+  }
+
+  /// @brief Binds the identifiers to the element (or to its fields, for
+  /// several names)
+  llvm::Error bind(llvm::IRBuilder<>& builder, llvm::Value* const element,
+                   small_vector<llvm::Value*>& bindings) const {
+    const auto type = element->getType()->getPointerElementType();
+    if (identList_.size() > 1 &&
+        (!type->isStructTy() ||
+         type->getStructNumElements() != identList_.size())) {
+      return error("invalid number of bindings for element at line {}",
+                   state_.row + 1);
+    }
+    for (unsigned i = 0; i < identList_.size(); ++i) {
+      const auto& name = identList_[i];
+      if (name == "_") {
+        continue;
+      }
+      if (auto err = Ident::isUnique(builder, name, state_)) {
+        return err;
+      }
+      // (elements are addressed in place, and loaded like variables)
+      if (identList_.size() == 1) {
+        element->setName(name);
+        bindings.push_back(tagBinding(element));
+      } else {
+        bindings.push_back(
+            tagBinding(builder.CreateStructGEP(type, element, i, name)));
+      }
+    }
+    return llvm::Error::success();
+  }
 };
 
 } // end namespace whack::ast
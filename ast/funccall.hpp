@@ -19,9 +19,16 @@
 #pragma once
 
 #include "ast.hpp"
+#include "atomic.hpp"
+#include "coroutine.hpp"
 #include "dataclass.hpp"
+#include "heap.hpp"
 #include "interface.hpp"
+#include "structmember.hpp"
+#include "vector.hpp"
+#include <llvm/Analysis/ValueTracking.h>
 #include <llvm/IR/ValueSymbolTable.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 namespace whack::ast {
 
@@ -40,6 +47,14 @@ public:
     // we store any value construction/call failures (FINAE)
     if (!await_ && !async_ &&
         getInnermostAstTag(ast_->children[0]) == "scoperes") {
+      if (std::string_view(ast_->children[0]->children[0]->contents) ==
+          "atomic") {
+        return callAtomic(builder, ast_);
+      }
+      if (std::string_view(ast_->children[0]->children[0]->contents) ==
+          "vec") {
+        return callVector(builder, ast_);
+      }
       // LIKELY to be a data class in this module, not really a function call
       // @todo Refactor
       if (ast_->children[0]->children_num == 3) {
@@ -85,13 +100,20 @@ private:
     return args;
   }
 
+  /// @brief Checks the arguments of a call to value, converting them to
+  /// its parameter types. The slots of the trampolines made for closures
+  /// passed as function pointers are added to trampolines; the caller frees
+  /// them (with freeTrampoline) once the call returns.
   static llvm::Error checkTransformArgs(llvm::IRBuilder<>& builder,
                                         llvm::Value* const value,
                                         small_vector<llvm::Value*>& args,
+                                        small_vector<llvm::Value*>& trampolines,
                                         const mpc_state_t state) {
     auto type = value->getType();
     if (type->isPointerTy() && type->getPointerElementType()->isFunctionTy()) {
       type = type->getPointerElementType();
+    } else if (Type::isClosureType(type)) {
+      type = Type::getClosureFuncType(type);
     } else {
       return error("expected `{}` to be callable at line {}",
                    value->getName().str(), state.row + 1);
@@ -103,7 +125,17 @@ private:
       return llvm::Error::success();
     }
 
-    if (funcType->getNumParams() != args.size()) {
+    // partial applications (with a trailing expansion) bind fewer arguments
+    const bool partial =
+        !args.empty() && args.back()->getName() == "::expansion";
+    if (partial && funcType->getNumParams() < args.size()) {
+      return error("cannot partially applicate function `{}` "
+                   "(number of arguments exceeds {}, got {}) "
+                   "at line {}",
+                   value->getName().str(), funcType->getNumParams(),
+                   args.size() - 1, state.row + 1);
+    }
+    if (!partial && funcType->getNumParams() != args.size()) {
       return error("invalid number of arguments given for function `{}` "
                    "at line {} (expected {}, got {})",
                    value->getName().str(), state.row + 1,
@@ -130,6 +162,26 @@ private:
           return impl.takeError();
         }
         args[i] = *impl;
+      } else if (Type::isClosureType(paramType) &&
+                 llvm::isa<llvm::Function>(args[i]) &&
+                 Type::getClosureType(llvm::cast<llvm::Function>(args[i])
+                                          ->getFunctionType()) == paramType) {
+        args[i] =
+            getFunctionClosure(builder, llvm::cast<llvm::Function>(args[i]));
+      } else if (Type::isClosureType(args[i]->getType()) &&
+                 paramType->isPointerTy() &&
+                 Type::getClosureFuncType(args[i]->getType()) ==
+                     paramType->getPointerElementType()) {
+        // closures only become plain function pointers at extern boundaries
+        // (for the duration of the call)
+        if (partial) {
+          return error("cannot bind a closure as a function pointer in a "
+                       "partial application at line {}",
+                       state.row + 1);
+        }
+        const auto [ptr, slot] = getClosureFuncPointer(builder, args[i]);
+        args[i] = ptr;
+        trampolines.push_back(slot);
       } else if (args[i]->getType() != paramType) {
         return error("invalid type given for argument {} of call to "
                      "function `{}` at line {}",
@@ -139,16 +191,328 @@ private:
     return llvm::Error::success();
   }
 
-  llvm::Expected<llvm::Value*> call(llvm::IRBuilder<>& builder) const {
-    if (await_) { // @todo enclosing function becomes a coroutine
-      return error("awaitable function calls not implemented at line {}",
-                   ast_->state.row + 1);
-    } else if (async_) { // @todo launch call in a new thread?
-      return error("async function calls not implemented at line {}",
-                   ast_->state.row + 1);
+  /// @brief Binds the leading arguments args of callee, returning a closure.
+  /// Constant arguments are substituted into a specialized clone of callee;
+  /// others are stored in an environment, read by a forwarding thunk.
+  static llvm::Value* partialApply(llvm::IRBuilder<>& builder,
+                                   llvm::Value* callee,
+                                   llvm::ArrayRef<llvm::Value*> args) {
+    const auto module = builder.GetInsertBlock()->getModule();
+    auto& ctx = module->getContext();
+    if (const auto func = llvm::dyn_cast<llvm::Function>(callee)) {
+      // a single dynamic pointer is bound like `this`
+      if (args.size() == 1 && args[0]->getType()->isPointerTy() &&
+          !llvm::isa<llvm::Constant>(args[0])) {
+        return func->isVarArg() ? makeClosure(builder, func, args[0])
+                                : bindClosure(builder, func, args[0]);
+      }
+    }
+
+    small_vector<llvm::Value*> bound{args.begin(), args.end()};
+    if (const auto func = llvm::dyn_cast<llvm::Function>(callee);
+        func && !func->isDeclaration() && !func->isVarArg() &&
+        std::any_of(args.begin(), args.end(), [](llvm::Value* const arg) {
+          return llvm::isa<llvm::Constant>(arg);
+        })) {
+      // the clone is named after the constants it substitutes, so that it
+      // is shared by partial applications binding the same ones
+      llvm::ValueToValueMapTy VMap;
+      std::string name;
+      llvm::raw_string_ostream os{name};
+      os << func->getName() << "::partial";
+      bound.clear();
+      for (size_t i = 0; i < args.size(); ++i) {
+        if (llvm::isa<llvm::Constant>(args[i])) {
+          VMap[&func->arg_begin()[i]] = args[i];
+          os << '.' << i << '=';
+          args[i]->printAsOperand(os, false);
+        } else {
+          bound.push_back(args[i]);
+        }
+      }
+      auto clone = module->getFunction(os.str());
+      if (!clone) {
+        clone = llvm::CloneFunction(func, VMap);
+        clone->setName(name);
+        clone->setLinkage(llvm::Function::PrivateLinkage);
+      }
+      callee = clone;
+    }
+
+    if (bound.empty()) {
+      return getFunctionClosure(builder, llvm::cast<llvm::Function>(callee));
+    }
+
+    // dynamic arguments (and a callee closure) are stored in an environment
+    const auto isClosure = Type::isClosureType(callee->getType());
+    const auto funcType =
+        isClosure ? Type::getClosureFuncType(callee->getType())
+                  : llvm::cast<llvm::FunctionType>(
+                        callee->getType()->getPointerElementType());
+    small_vector<llvm::Type*> fields;
+    for (const auto arg : bound) {
+      fields.push_back(arg->getType());
+    }
+    if (isClosure) {
+      fields.push_back(callee->getType());
+    }
+    const auto env =
+        llvm::StructType::create(ctx, fields, "::closure::partial");
+
+    small_vector<llvm::Type*> params{env->getPointerTo(0)};
+    params.append(funcType->param_begin() + bound.size(),
+                  funcType->param_end());
+    const auto thunk = llvm::Function::Create(
+        llvm::FunctionType::get(funcType->getReturnType(), params,
+                                funcType->isVarArg()),
+        llvm::Function::PrivateLinkage, env->getName(), module);
+    thunk->arg_begin()[0].setName(".env");
+    {
+      llvm::IRBuilder<> thunkBuilder{
+          llvm::BasicBlock::Create(ctx, "entry", thunk)};
+      const auto envArg = &thunk->arg_begin()[0];
+      small_vector<llvm::Value*> arguments;
+      for (size_t i = 0; i < bound.size(); ++i) {
+        arguments.push_back(thunkBuilder.CreateLoad(
+            thunkBuilder.CreateStructGEP(env, envArg, i, "")));
+      }
+      for (auto arg = thunk->arg_begin() + 1; arg != thunk->arg_end(); ++arg) {
+        arguments.push_back(&*arg);
+      }
+      llvm::Value* ret;
+      if (isClosure) {
+        const auto closure = thunkBuilder.CreateLoad(
+            thunkBuilder.CreateStructGEP(env, envArg, bound.size(), ""));
+        ret = callClosure(thunkBuilder, closure, arguments);
+      } else {
+        ret = thunkBuilder.CreateCall(callee, arguments);
+      }
+      if (ret->getType() == BasicTypes["void"]) {
+        thunkBuilder.CreateRetVoid();
+      } else {
+        thunkBuilder.CreateRet(ret);
+      }
+    }
+
+    // environments live in the entry block, and are lowered (stack/heap)
+    // like those of closures
+    const auto enclosingFn = builder.GetInsertBlock()->getParent();
+    auto& entry = enclosingFn->getEntryBlock();
+    llvm::IRBuilder<> entryBuilder{&entry, entry.begin()};
+    const auto envPtr = entryBuilder.CreateAlloca(env, 0, nullptr, "");
+    builder.CreateLifetimeStart(
+        envPtr,
+        builder.getInt64(module->getDataLayout().getTypeAllocSize(env)));
+    for (size_t i = 0; i < fields.size(); ++i) {
+      builder.CreateStore(i < bound.size() ? bound[i] : callee,
+                          builder.CreateStructGEP(env, envPtr, i, ""));
+    }
+    return makeClosure(builder, thunk, envPtr);
+  }
+
+  inline static llvm::Value* createCall(llvm::IRBuilder<>& builder,
+                                        llvm::Value* const callee,
+                                        llvm::ArrayRef<llvm::Value*> args) {
+    if (Type::isClosureType(callee->getType())) {
+      return callClosure(builder, callee, args);
+    }
+    return builder.CreateCall(callee, args);
+  }
+
+  /// @brief Declares a function of the task scheduler (see runtime.c)
+  static llvm::Constant* getSchedFunction(llvm::Module* const module,
+                                          llvm::StringRef name) {
+    auto& ctx = module->getContext();
+    const auto ptr = BasicTypes["char"]->getPointerTo(0);
+    llvm::FunctionType* type;
+    if (name == "__builtin_async") {
+      const auto task =
+          llvm::FunctionType::get(BasicTypes["void"], {ptr, ptr}, false);
+      const auto i64 = llvm::Type::getInt64Ty(ctx);
+      type = llvm::FunctionType::get(
+          ptr, {task->getPointerTo(0), ptr, i64, i64}, false);
+    } else { // await
+      type = llvm::FunctionType::get(BasicTypes["void"], {ptr, ptr}, false);
+    }
+    const auto func = module->getOrInsertFunction(name, type);
+    if (const auto f = llvm::dyn_cast<llvm::Function>(func)) {
+      f->addFnAttr(llvm::Attribute::NoUnwind);
+    }
+    return func;
+  }
+
+  /// @brief Checks that the arguments of an asynchronous call (and a callee
+  /// which is not a function) outlive the caller: tasks may run after the
+  /// caller returns, so pointers into its frame (including `this` of local
+  /// objects) and closures with environments (which may be in the frame)
+  /// cannot be passed
+  static llvm::Error checkAsyncArgs(llvm::IRBuilder<>& builder,
+                                    llvm::Value* const callee,
+                                    llvm::ArrayRef<llvm::Value*> args,
+                                    const mpc_state_t state) {
+    const auto& DL = builder.GetInsertBlock()->getModule()->getDataLayout();
+    // (whether a closure value may have an environment)
+    const auto hasEnvironment = [](llvm::Value* value) {
+      while (const auto insert = llvm::dyn_cast<llvm::InsertValueInst>(value)) {
+        if (insert->getIndices()[0] == 1) {
+          value = insert->getInsertedValueOperand();
+          return !llvm::isa<llvm::Constant>(value) ||
+                 !llvm::cast<llvm::Constant>(value)->isNullValue();
+        }
+        value = insert->getAggregateOperand();
+      }
+      const auto closure = llvm::dyn_cast<llvm::Constant>(value);
+      return !closure || !closure->getAggregateElement(1u)->isNullValue();
+    };
+    small_vector<llvm::Value*> values{args.begin(), args.end()};
+    if (!llvm::isa<llvm::Function>(callee)) {
+      values.push_back(callee);
+    }
+    for (const auto value : values) {
+      if (value->getType()->isPointerTy() &&
+          llvm::isa<llvm::AllocaInst>(llvm::GetUnderlyingObject(value, DL))) {
+        return error("cannot pass a reference to local variable(s) to an "
+                     "asynchronous call at line {}",
+                     state.row + 1);
+      }
+      if (Type::isClosureType(value->getType()) && hasEnvironment(value)) {
+        return error("cannot pass a closure with an environment to an "
+                     "asynchronous call at line {}",
+                     state.row + 1);
+      }
     }
+    return llvm::Error::success();
+  }
+
+  /// @brief Launches a call of callee as a task of the scheduler, returning
+  /// its future. The arguments (and a callee which is not a function) are
+  /// stored in an environment, copied into the task, which a task thunk
+  /// calls callee with.
+  static llvm::Value* spawn(llvm::IRBuilder<>& builder,
+                            llvm::Value* const callee,
+                            llvm::ArrayRef<llvm::Value*> args) {
+    const auto module = builder.GetInsertBlock()->getModule();
+    auto& ctx = module->getContext();
+    const auto isClosure = Type::isClosureType(callee->getType());
+    const auto funcType =
+        isClosure ? Type::getClosureFuncType(callee->getType())
+                  : llvm::cast<llvm::FunctionType>(
+                        callee->getType()->getPointerElementType());
+    const auto direct = llvm::isa<llvm::Function>(callee);
+    small_vector<llvm::Type*> fields;
+    for (const auto arg : args) {
+      fields.push_back(arg->getType());
+    }
+    if (!direct) {
+      fields.push_back(callee->getType());
+    }
+    const auto env = llvm::StructType::create(ctx, fields, "::async");
+
+    const auto ptr = BasicTypes["char"]->getPointerTo(0);
+    const auto task = llvm::Function::Create(
+        llvm::FunctionType::get(BasicTypes["void"], {ptr, ptr}, false),
+        llvm::Function::PrivateLinkage, callee->getName() + "::async",
+        module);
+    task->arg_begin()[0].setName(".env");
+    task->arg_begin()[1].setName(".result");
+    {
+      llvm::IRBuilder<> taskBuilder{
+          llvm::BasicBlock::Create(ctx, "entry", task)};
+      const auto envArg = taskBuilder.CreateBitCast(&task->arg_begin()[0],
+                                                    env->getPointerTo(0));
+      small_vector<llvm::Value*> arguments;
+      for (size_t i = 0; i < args.size(); ++i) {
+        arguments.push_back(taskBuilder.CreateLoad(
+            taskBuilder.CreateStructGEP(env, envArg, i, "")));
+      }
+      const auto func =
+          direct ? callee
+                 : taskBuilder.CreateLoad(
+                       taskBuilder.CreateStructGEP(env, envArg, args.size(),
+                                                   ""));
+      const auto ret = createCall(taskBuilder, func, arguments);
+      if (ret->getType() != BasicTypes["void"]) {
+        taskBuilder.CreateStore(
+            ret, taskBuilder.CreateBitCast(&task->arg_begin()[1],
+                                           ret->getType()->getPointerTo(0)));
+      }
+      taskBuilder.CreateRetVoid();
+    }
+
+    // (the arguments outlive the task, see checkAsyncArgs)
+    const auto enclosingFn = builder.GetInsertBlock()->getParent();
+    auto& entry = enclosingFn->getEntryBlock();
+    llvm::IRBuilder<> entryBuilder{&entry, entry.begin()};
+    const auto envPtr = entryBuilder.CreateAlloca(env, 0, nullptr, "");
+    const auto& dataLayout = module->getDataLayout();
+    const auto envSize = builder.getInt64(dataLayout.getTypeAllocSize(env));
+    builder.CreateLifetimeStart(envPtr, envSize);
+    for (size_t i = 0; i < fields.size(); ++i) {
+      builder.CreateStore(i < args.size() ? args[i] : callee,
+                          builder.CreateStructGEP(env, envPtr, i, ""));
+    }
+    const auto result = funcType->getReturnType();
+    const auto future = builder.CreateCall(
+        getSchedFunction(module, "__builtin_async"),
+        {task, builder.CreateBitCast(envPtr, ptr), envSize,
+         builder.getInt64(result == BasicTypes["void"]
+                              ? 0
+                              : dataLayout.getTypeAllocSize(result))});
+    checkAllocation(builder, future);
+    builder.CreateLifetimeEnd(envPtr, envSize);
+    return builder.CreateBitCast(future, Type::getFutureType(module, result));
+  }
 
-    small_vector<llvm::Value*> funcs;
+  /// @brief Awaits a future (returning the result of its call) or a
+  /// coroutine (returning its next value). Coroutines suspend until the
+  /// future is ready, while other functions block on it.
+  static llvm::Expected<llvm::Value*> join(llvm::IRBuilder<>& builder,
+                                           llvm::Value* const future,
+                                           const mpc_state_t state) {
+    if (Type::getCoroValueType(future->getType())) {
+      return awaitCoroutine(builder, future);
+    }
+    const auto result = Type::getFutureResultType(future->getType());
+    if (!result) {
+      return error("expected a future or coroutine to await at line {}",
+                   state.row + 1);
+    }
+    const auto module = builder.GetInsertBlock()->getModule();
+    const auto ptr = BasicTypes["char"]->getPointerTo(0);
+    const auto handle = builder.CreateBitCast(future, ptr);
+    const auto func = builder.GetInsertBlock()->getParent();
+    if (const auto coroutine = getCoroutine(func)) {
+      auto& ctx = module->getContext();
+      const auto save = builder.CreateCall(
+          getCoroIntrinsic(module, llvm::Intrinsic::coro_save), coroutine);
+      const auto suspend =
+          llvm::BasicBlock::Create(ctx, "::await.suspend", func);
+      const auto ready = llvm::BasicBlock::Create(ctx, "::await.ready", func);
+      builder.CreateCondBr(
+          builder.CreateIsNotNull(builder.CreateCall(
+              getCoroFunction(module, "__builtin_await_suspend"),
+              {handle, coroutine})),
+          suspend, ready);
+      builder.SetInsertPoint(suspend);
+      suspendCoroutine(builder, save, ready);
+    }
+
+    // (ready futures are not waited for)
+    const auto await = getSchedFunction(module, "__builtin_await");
+    if (result == BasicTypes["void"]) {
+      return builder.CreateCall(
+          await, {handle, llvm::ConstantPointerNull::get(ptr)});
+    }
+    llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                            func->getEntryBlock().begin()};
+    const auto buffer = entry.CreateAlloca(result, 0, nullptr, "");
+    builder.CreateCall(await, {handle, builder.CreateBitCast(buffer, ptr)});
+    return builder.CreateLoad(buffer);
+  }
+
+  llvm::Expected<llvm::Value*> call(llvm::IRBuilder<>& builder) const {
+    // callables with their bound `this` (for member functions)
+    small_vector<StructMember::callee_t> funcs;
     int idx = static_cast<int>(await_ || async_);
     for (; idx < ast_->children_num; ++idx) {
       const auto ref = ast_->children[idx];
@@ -160,39 +524,45 @@ private:
         ++idx;
         break;
       }
+      // we call member functions directly with `this` as first argument
+      if (getInnermostAstTag(ref) == "structmember") {
+        if (auto callee = StructMember{ref}.callee(builder)) {
+          auto [fun, thiz] = *callee;
+          if (!thiz && llvm::isa<llvm::AllocaInst>(fun)) {
+            fun = builder.CreateLoad(fun);
+          }
+          funcs.emplace_back(StructMember::callee_t{fun, thiz});
+          continue;
+        } else {
+          return callee.takeError();
+        }
+      }
       if (auto func = getFactor(ref)->codegen(builder)) {
         auto fun = *func;
         // @todo: Delegate to Loader, based on use context?
         if (llvm::isa<llvm::AllocaInst>(fun)) {
           fun = builder.CreateLoad(fun);
         }
-        funcs.push_back(fun);
+        funcs.emplace_back(StructMember::callee_t{fun, nullptr});
       } else {
         return func.takeError();
       }
     }
-
-    const auto partialApply =
-        [&builder, state = ast_->state](llvm::Value* const fun,
-                                        llvm::ArrayRef<llvm::Value*> args)
-        -> llvm::Expected<llvm::Function*> {
-      auto func = llvm::cast<llvm::Function>(fun);
-      const auto numParams = func->getFunctionType()->params().size();
-      if (numParams <= args.size()) {
-        return error("cannot partially applicate function `{}` "
-                     "(number of arguments exceeds {}, got {}) "
-                     "at line {}",
-                     func->getName().str(), numParams, args.size(),
-                     state.row + 1);
-      }
-      for (const auto arg : args) {
-        const auto newFuncType = llvm::FunctionType::get(
-            func->getReturnType(),
-            func->getFunctionType()->params().drop_front(), func->isVarArg());
-        func = bindFirstFuncArgument(builder, func, arg, newFuncType);
-      }
-      return func;
-    };
+    if (idx >= ast_->children_num) { // await <variable>
+      return join(builder, funcs.front().first, ast_->state);
+    }
+    // only a single call may be launched asynchronously
+    const auto end = ast_->children + ast_->children_num;
+    if (async_ && (funcs.size() != 1 ||
+                   std::any_of(ast_->children + idx, end,
+                               [](const mpc_ast_t* const child) {
+                                 return std::string_view{child->contents} ==
+                                        "(";
+                               }))) {
+      return error("expected a single function call to launch "
+                   "asynchronously at line {}",
+                   ast_->state.row + 1);
+    }
 
     llvm::Value* value;
     for (auto i = 0; idx < ast_->children_num; idx += 2, ++i) {
@@ -207,51 +577,80 @@ private:
         ++idx;
       }
       const auto state = ref->state;
+      small_vector<llvm::Value*> trampolines;
       if (i == 0) {
         for (size_t j = 0; j < funcs.size(); ++j) {
-          const auto func = funcs[j];
+          auto [func, thiz] = funcs[j];
           if (j == 0) {
-            if (auto err =
-                    checkTransformArgs(builder, func, arguments, state)) {
-              return err;
-            }
             if (!arguments.empty() &&
                 arguments.back()->getName() == "::expansion") {
-              arguments.pop_back();
-              if (auto apply = partialApply(func, arguments)) {
-                value = *apply;
-              } else {
-                return apply.takeError();
+              // a partially applied member function binds `this` first
+              if (thiz) {
+                arguments.insert(arguments.begin(), thiz);
+              }
+              if (auto err = checkTransformArgs(builder, func, arguments,
+                                                trampolines, state)) {
+                return err;
               }
-            } else {
-              value = builder.CreateCall(func, arguments);
+              if (async_) {
+                return error("cannot launch a partial application "
+                             "asynchronously at line {}",
+                             state.row + 1);
+              }
+              arguments.pop_back();
+              value = partialApply(builder, func, arguments);
+              continue;
+            }
+            if (thiz) {
+              arguments.insert(arguments.begin(), thiz);
             }
           } else {
             arguments = {value};
-            if (auto err =
-                    checkTransformArgs(builder, func, arguments, state)) {
+            if (thiz) {
+              arguments.insert(arguments.begin(), thiz);
+            }
+          }
+          if (auto err = checkTransformArgs(builder, func, arguments,
+                                            trampolines, state)) {
+            return err;
+          }
+          if (async_ && !trampolines.empty()) {
+            return error("cannot pass a closure as a function pointer to an "
+                         "asynchronous call at line {}",
+                         state.row + 1);
+          }
+          if (async_) {
+            if (auto err = checkAsyncArgs(builder, func, arguments, state)) {
               return err;
             }
-            value = builder.CreateCall(func, arguments);
           }
+          value = async_ ? spawn(builder, func, arguments)
+                         : createCall(builder, func, arguments);
+          for (const auto slot : trampolines) {
+            freeTrampoline(builder, slot);
+          }
+          trampolines.clear();
         }
       } else {
-        if (auto err = checkTransformArgs(builder, value, arguments, state)) {
+        if (auto err = checkTransformArgs(builder, value, arguments,
+                                          trampolines, state)) {
           return err;
         }
         if (!arguments.empty() &&
             arguments.back()->getName() == "::expansion") {
           arguments.pop_back();
-          if (auto apply = partialApply(value, arguments)) {
-            value = *apply;
-          } else {
-            return apply.takeError();
-          }
+          value = partialApply(builder, value, arguments);
         } else {
-          value = builder.CreateCall(value, arguments);
+          value = createCall(builder, value, arguments);
+          for (const auto slot : trampolines) {
+            freeTrampoline(builder, slot);
+          }
         }
       }
     }
+    if (await_) {
+      return join(builder, value, ast_->state);
+    }
     return value;
   }
 };
@@ -21,6 +21,7 @@
 #include "args.hpp"
 #include "ast.hpp"
 #include "body.hpp"
+#include "heap.hpp"
 #include "typelist.hpp"
 #include <folly/Likely.h>
 #include <folly/ScopeGuard.h>
@@ -101,46 +102,257 @@ deduceFuncReturnType(const llvm::Function* const func,
   return deduced;
 };
 
-static llvm::Function*
+/// @brief Returns a forwarder of func whose first parameter is `nest`,
+/// so that trampolines don't change the calling convention of func.
+static llvm::Function* getNestFunction(llvm::Function* const func) {
+  if (func->hasParamAttribute(0, llvm::Attribute::Nest)) {
+    return func;
+  }
+  if (func->isVarArg()) { // @todo cannot forward varargs
+    func->addParamAttr(0, llvm::Attribute::Nest);
+    return func;
+  }
+  const auto module = func->getParent();
+  const auto name = func->getName().str() + "::nest";
+  if (const auto nest = module->getFunction(name)) {
+    return nest;
+  }
+  const auto nest = llvm::Function::Create(
+      func->getFunctionType(), llvm::Function::PrivateLinkage, name, module);
+  nest->addParamAttr(0, llvm::Attribute::Nest);
+  llvm::IRBuilder<> builder{
+      llvm::BasicBlock::Create(module->getContext(), "entry", nest)};
+  small_vector<llvm::Value*> args;
+  for (auto& arg : nest->args()) {
+    args.push_back(&arg);
+  }
+  const auto ret = builder.CreateCall(func, args);
+  if (ret->getType() == BasicTypes["void"]) {
+    builder.CreateRetVoid();
+  } else {
+    builder.CreateRet(ret);
+  }
+  return nest;
+}
+
+/// @brief Binds the first argument of func (a pointer) in a trampoline,
+/// returning a pointer to it (of type newFunctionType) and its slot, which
+/// is freed by freeTrampoline
+static trampoline_t
 bindFirstFuncArgument(llvm::IRBuilder<>& builder, llvm::Function* const func,
                       llvm::Value* const firstArgument,
                       llvm::FunctionType* const newFunctionType) {
   assert(firstArgument->getType()->isPointerTy()); // @todo
-  if (!func->hasParamAttribute(0, llvm::Attribute::Nest)) {
-    func->addParamAttr(0, llvm::Attribute::Nest);
-  }
+  const auto nest = getNestFunction(func);
   const static auto charPtrTy = BasicTypes["char"]->getPointerTo(0);
   const auto module = builder.GetInsertBlock()->getModule();
   const auto tramp = builder.CreateCall(module->getOrInsertFunction(
       "__builtin_virtual_alloc", llvm::FunctionType::get(charPtrTy, false)));
-  SCOPE_EXIT {
-    builder.CreateCall(
-        module->getOrInsertFunction(
-            "__builtin_virtual_free",
-            llvm::FunctionType::get(BasicTypes["void"], charPtrTy, false)),
-        tramp);
-  };
+  checkAllocation(builder, tramp);
   const auto initFunc = module->getOrInsertFunction(
       "llvm.init.trampoline",
       llvm::FunctionType::get(BasicTypes["void"],
                               {charPtrTy, charPtrTy, charPtrTy}, false));
   builder.CreateCall(initFunc,
-                     {tramp, builder.CreateBitCast(func, charPtrTy),
+                     {tramp, builder.CreateBitCast(nest, charPtrTy),
                       builder.CreateBitCast(firstArgument, charPtrTy)});
+  // trampolines are written through a writable view of the slot, and
+  // executed through its (possibly distinct) executable view
+  const auto exec = builder.CreateCall(
+      module->getOrInsertFunction(
+          "__builtin_virtual_exec",
+          llvm::FunctionType::get(charPtrTy, charPtrTy, false)),
+      tramp);
   const auto adjustFunc = module->getOrInsertFunction(
       "llvm.adjust.trampoline",
       llvm::FunctionType::get(charPtrTy, charPtrTy, false));
-  const auto newFunc = builder.CreateBitCast(
-      builder.CreateCall(adjustFunc, tramp), newFunctionType->getPointerTo(0));
-  return llvm::cast<llvm::Function>(newFunc);
+  return {builder.CreateBitCast(builder.CreateCall(adjustFunc, exec),
+                                newFunctionType->getPointerTo(0)),
+          tramp};
+}
+
+/// @brief Returns the trampoline slot to the runtime's pool
+static void freeTrampoline(llvm::IRBuilder<>& builder,
+                           llvm::Value* const slot) {
+  const auto module = builder.GetInsertBlock()->getModule();
+  const auto charPtrTy = BasicTypes["char"]->getPointerTo(0);
+  builder.CreateCall(
+      module->getOrInsertFunction(
+          "__builtin_virtual_free",
+          llvm::FunctionType::get(BasicTypes["void"], charPtrTy, false)),
+      slot);
+}
+
+static llvm::Value* makeClosure(llvm::IRBuilder<>& builder,
+                                llvm::Value* const code,
+                                llvm::Value* const env) {
+  const auto codeType =
+      llvm::cast<llvm::FunctionType>(code->getType()->getPointerElementType());
+  const auto type = Type::getClosureType(llvm::FunctionType::get(
+      codeType->getReturnType(), codeType->params().drop_front(),
+      codeType->isVarArg()));
+  llvm::Value* closure = llvm::UndefValue::get(type);
+  closure = builder.CreateInsertValue(
+      closure, builder.CreateBitCast(code, type->getElementType(0)), 0);
+  return builder.CreateInsertValue(
+      closure,
+      env ? builder.CreateBitCast(env, type->getElementType(1))
+          : llvm::Constant::getNullValue(type->getElementType(1)),
+      1);
+}
+
+/// @brief Wraps a plain function as a closure with a null environment
+static llvm::Value* getFunctionClosure(llvm::IRBuilder<>& builder,
+                                       llvm::Function* const func) {
+  const auto module = func->getParent();
+  const auto name = func->getName().str() + "::thunk";
+  auto thunk = module->getFunction(name);
+  if (!thunk) {
+    const auto type = llvm::cast<llvm::FunctionType>(
+        Type::getClosureType(func->getFunctionType())
+            ->getElementType(0)
+            ->getPointerElementType());
+    thunk = llvm::Function::Create(type, llvm::Function::PrivateLinkage, name,
+                                   module);
+    llvm::IRBuilder<> thunkBuilder{
+        llvm::BasicBlock::Create(module->getContext(), "entry", thunk)};
+    small_vector<llvm::Value*> args;
+    for (auto& arg : thunk->args()) {
+      args.push_back(&arg);
+    }
+    args.erase(args.begin());
+    const auto ret = thunkBuilder.CreateCall(func, args);
+    if (ret->getType() == BasicTypes["void"]) {
+      thunkBuilder.CreateRetVoid();
+    } else {
+      thunkBuilder.CreateRet(ret);
+    }
+  }
+  return makeClosure(builder, thunk, nullptr);
+}
+
+/// @brief Returns a closure of func with its first argument (a pointer, e.g.
+/// `this`) bound. The pointer is held in an environment, so that the
+/// closure is lowered (and released) like those of closure expressions.
+static llvm::Value* bindClosure(llvm::IRBuilder<>& builder,
+                                llvm::Function* const func,
+                                llvm::Value* const first) {
+  const auto module = func->getParent();
+  auto& ctx = module->getContext();
+  const auto name = "::closure::" + func->getName().str() + "::bound";
+  llvm::StructType* env = module->getTypeByName(name);
+  auto thunk = module->getFunction(name);
+  if (!thunk) {
+    env = llvm::StructType::create(ctx, {first->getType()}, name);
+    small_vector<llvm::Type*> params{env->getPointerTo(0)};
+    params.append(func->getFunctionType()->param_begin() + 1,
+                  func->getFunctionType()->param_end());
+    thunk = llvm::Function::Create(
+        llvm::FunctionType::get(func->getReturnType(), params,
+                                func->isVarArg()),
+        llvm::Function::PrivateLinkage, name, module);
+    llvm::IRBuilder<> thunkBuilder{
+        llvm::BasicBlock::Create(ctx, "entry", thunk)};
+    small_vector<llvm::Value*> args;
+    for (auto& arg : thunk->args()) {
+      args.push_back(&arg);
+    }
+    args.front() = thunkBuilder.CreateLoad(
+        thunkBuilder.CreateStructGEP(env, args.front(), 0, ""));
+    const auto ret = thunkBuilder.CreateCall(func, args);
+    if (ret->getType() == BasicTypes["void"]) {
+      thunkBuilder.CreateRetVoid();
+    } else {
+      thunkBuilder.CreateRet(ret);
+    }
+  }
+  const auto enclosingFn = builder.GetInsertBlock()->getParent();
+  llvm::IRBuilder<> entry{&enclosingFn->getEntryBlock(),
+                          enclosingFn->getEntryBlock().begin()};
+  const auto envPtr = entry.CreateAlloca(env, 0, nullptr, "");
+  builder.CreateLifetimeStart(
+      envPtr,
+      builder.getInt64(module->getDataLayout().getTypeAllocSize(env)));
+  builder.CreateStore(builder.CreateBitCast(first, env->getElementType(0)),
+                      builder.CreateStructGEP(env, envPtr, 0, ""));
+  return makeClosure(builder, thunk, envPtr);
+}
+
+static llvm::CallInst* callClosure(llvm::IRBuilder<>& builder,
+                                   llvm::Value* const closure,
+                                   llvm::ArrayRef<llvm::Value*> args) {
+  small_vector<llvm::Value*> arguments{builder.CreateExtractValue(closure, 1)};
+  arguments.append(args.begin(), args.end());
+  return builder.CreateCall(builder.CreateExtractValue(closure, 0), arguments);
+}
+
+/// @brief Materializes a plain function pointer from a closure value.
+/// This is only needed when closures cross `extern func` boundaries. The
+/// pointer (and the copy of the closure it calls) is owned by the call it
+/// is passed to, which frees its trampoline when it returns: C code must
+/// not keep it past the call.
+static trampoline_t getClosureFuncPointer(llvm::IRBuilder<>& builder,
+                                          llvm::Value* const closure) {
+  const auto module = builder.GetInsertBlock()->getModule();
+  const auto funcType = Type::getClosureFuncType(closure->getType());
+  // there is a single forwarder per closure type
+  std::string name;
+  llvm::raw_string_ostream os{name};
+  os << "::closure::extern::";
+  funcType->print(os);
+  auto forward = module->getFunction(os.str());
+  if (!forward) {
+    small_vector<llvm::Type*> params{closure->getType()->getPointerTo(0)};
+    params.append(funcType->param_begin(), funcType->param_end());
+    forward = llvm::Function::Create(
+        llvm::FunctionType::get(funcType->getReturnType(), params,
+                                funcType->isVarArg()),
+        llvm::Function::PrivateLinkage, name, module);
+    forward->addParamAttr(0, llvm::Attribute::Nest);
+    llvm::IRBuilder<> forwardBuilder{
+        llvm::BasicBlock::Create(module->getContext(), "entry", forward)};
+    small_vector<llvm::Value*> args;
+    for (auto& arg : forward->args()) {
+      args.push_back(&arg);
+    }
+    const auto ret = callClosure(
+        forwardBuilder, forwardBuilder.CreateLoad(args.front()),
+        llvm::ArrayRef<llvm::Value*>{args}.drop_front());
+    if (ret->getType() == BasicTypes["void"]) {
+      forwardBuilder.CreateRetVoid();
+    } else {
+      forwardBuilder.CreateRet(ret);
+    }
+  }
+  const auto func = builder.GetInsertBlock()->getParent();
+  llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                          func->getEntryBlock().begin()};
+  const auto ptr = entry.CreateAlloca(closure->getType(), 0, nullptr, "");
+  builder.CreateStore(closure, ptr);
+  return bindFirstFuncArgument(builder, forward, ptr, funcType);
 }
 
 static llvm::Expected<llvm::Function*> buildFunction(llvm::Function* func,
                                                      const Body* const body,
                                                      const mpc_state_t state) {
+  // coroutines return a handle to their frame (main blocks on `await`s)
+  const auto coroutine = body->isCoroutine() && func->getName() != "main";
+  const auto value = func->getReturnType();
+  if (coroutine) {
+    if (value == BasicTypes["auto"]) {
+      return error("expected a value type for coroutine `{}` at line {}",
+                   func->getName().str(), state.row + 1);
+    }
+    func = changeFuncReturnType(func,
+                                Type::getCoroType(func->getParent(), value));
+  }
+
   const auto entry =
       llvm::BasicBlock::Create(func->getContext(), "entry", func);
   llvm::IRBuilder<> builder{entry};
+  if (coroutine) {
+    beginCoroutine(builder, value);
+  }
   if (auto err = body->codegen(builder)) {
     return err;
   }
@@ -148,6 +360,16 @@ static llvm::Expected<llvm::Function*> buildFunction(llvm::Function* func,
     return err;
   }
 
+  if (coroutine) {
+    if (!builder.GetInsertBlock()->getTerminator()) {
+      builder.CreateBr(getCoroBlock(func, "::coro.final"));
+    }
+    if (auto err = lowerClosureEnvironments(func, state)) {
+      return err;
+    }
+    return func;
+  }
+
   auto deduced = deduceFuncReturnType(func, state);
   if (!deduced) {
     return deduced.takeError();
@@ -183,6 +405,10 @@ static llvm::Expected<llvm::Function*> buildFunction(llvm::Function* func,
       builder.CreateRetVoid();
     }
   }
+
+  if (auto err = lowerClosureEnvironments(func, state)) {
+    return err;
+  }
   return func;
 }
 
@@ -222,17 +448,15 @@ public:
       for (size_t i = 0; i < names.size(); ++i) {
         func->arg_begin()[i].setName(names[i]);
       }
-      for (size_t i = 0; i < func->arg_size(); ++i) {
-        if (!args_->arg(i).mut) {
-          func->addParamAttr(i, llvm::Attribute::ReadOnly);
-        }
-      }
     }
 
     auto built = buildFunction(func, body_.get(), state_);
     if (!built) {
       return built.takeError();
     }
+    if (args_) {
+      return args_->addAttributes(*built, 0, state_);
+    }
     return llvm::Error::success();
   }
 
@@ -0,0 +1,58 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_HEAP_HPP
+#define WHACK_HEAP_HPP
+
+#pragma once
+
+#include "ast.hpp"
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/ValueSymbolTable.h>
+
+namespace whack::ast {
+
+/// @brief Traps if ptr, the result of an allocation (of size bytes, if
+/// given, in which case zero sizes may give null), is null. All the checks
+/// of a function share a trap.
+static void checkAllocation(llvm::IRBuilder<>& builder,
+                            llvm::Value* const ptr,
+                            llvm::Value* const size = nullptr) {
+  const auto func = builder.GetInsertBlock()->getParent();
+  auto& ctx = func->getContext();
+  auto trap = llvm::dyn_cast_or_null<llvm::BasicBlock>(
+      func->getValueSymbolTable()->lookup("outofmemory"));
+  if (!trap) {
+    trap = llvm::BasicBlock::Create(ctx, "outofmemory", func);
+    llvm::IRBuilder<> fail{trap};
+    fail.CreateCall(llvm::Intrinsic::getDeclaration(func->getParent(),
+                                                    llvm::Intrinsic::trap));
+    fail.CreateUnreachable();
+  }
+  const auto ok = llvm::BasicBlock::Create(ctx, "", func);
+  llvm::MDBuilder MDBuilder{ctx};
+  auto failed = builder.CreateIsNull(ptr);
+  if (size) {
+    failed = builder.CreateAnd(failed, builder.CreateIsNotNull(size));
+  }
+  builder.CreateCondBr(failed, trap, ok,
+                       MDBuilder.createBranchWeights(1, 1 << 20));
+  builder.SetInsertPoint(ok);
+}
+
+} // end namespace whack::ast
+
+#endif // WHACK_HEAP_HPP
@@ -42,14 +42,11 @@ public:
     // captured variables in closure
     const auto module = func->getParent();
     if (func->getName().startswith("::closure")) {
-      const auto env = func->getValueSymbolTable()->lookup(".env");
-      const auto structure = env->getType()->getPointerElementType();
-      const auto idx =
-          StructMember::getIndex(*module, structure->getStructName(), name_);
-      if (idx) {
-        const auto ptr =
-            builder.CreateStructGEP(structure, env, idx.value(), name_);
-        return builder.CreateLoad(ptr);
+      // closures capturing no variables have no environment
+      if (const auto env = func->getValueSymbolTable()->lookup(".env")) {
+        if (const auto captured = getCaptured(builder, env, name_)) {
+          return captured;
+        }
       }
     }
 
@@ -76,6 +73,36 @@ public:
 
   inline const auto& name() const { return name_; }
 
+  /// @brief Looks up variable name in closure environment env, following
+  /// links to enclosing environments. Variables captured by reference are
+  /// returned as pointers (lvalues), others by value.
+  static llvm::Value* getCaptured(llvm::IRBuilder<>& builder, llvm::Value* env,
+                                  llvm::StringRef name) {
+    const auto& module = *builder.GetInsertBlock()->getModule();
+    while (env) {
+      const auto structure = env->getType()->getPointerElementType();
+      const auto envName = structure->getStructName();
+      if (const auto idx = StructMember::getIndex(module, envName, name)) {
+        const auto ptr =
+            builder.CreateStructGEP(structure, env, idx.value(), name);
+        if (getMetadataPartIndex(module, "captures", envName, name)) {
+          const auto var = builder.CreateLoad(ptr);
+          return tagBinding(builder.CreateConstInBoundsGEP1_32(
+              var->getType()->getPointerElementType(), var, 0, name));
+        }
+        return builder.CreateLoad(ptr);
+      }
+      if (const auto parent =
+              StructMember::getIndex(module, envName, ".parent")) {
+        env = builder.CreateLoad(
+            builder.CreateStructGEP(structure, env, parent.value(), ""));
+      } else {
+        env = nullptr;
+      }
+    }
+    return nullptr;
+  }
+
   static llvm::Error isUnique(const llvm::Module* const module,
                               llvm::StringRef name, const mpc_state_t state) {
     const auto line = state.row + 1;
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "ast.hpp"
+#include "dynamicarray.hpp"
 #include "structmember.hpp"
 #include "type.hpp"
 #include <folly/Likely.h>
@@ -67,24 +68,14 @@ public:
 
     // Variable-length array
     else if (Type::isVariableLengthArray(type)) {
-      const auto eltType = type->getStructElementType(1)->getArrayElementType();
       // we check against first elem's type (list is homogenous)
-      if (eltType != list[0]->getType()) {
+      if (getDynamicArrayElementType(type) != list[0]->getType()) {
         return error("type mismatch: cannot construct array at "
                      "line {}",
                      state.row + 1);
       }
-      // @todo FIXME
-      // %numElts = load i32* @SIZE
-      // %val = alloca float, i32 %numElts
-      auto size = llvm::ConstantInt::get(BasicTypes["int"], list.size());
-      // auto elts = builder.CreateAlloca(eltType, size, nullptr, "");
-      auto elts =
-          llvm::ConstantArray::get(llvm::ArrayType::get(eltType, 0), list);
-      const std::vector<llvm::Constant*> array = {
-          size, llvm::dyn_cast<llvm::Constant>(elts)};
-      const auto module = builder.GetInsertBlock()->getParent()->getParent();
-      return llvm::ConstantStruct::getAnon(module->getContext(), array);
+      const small_vector<llvm::Value*> values(list.begin(), list.end());
+      return makeDynamicArray(builder, type, values);
     }
 
     // Fixed-length array
@@ -104,10 +95,7 @@ public:
       }
       return llvm::ConstantArray::get(llvm::dyn_cast<llvm::ArrayType>(type),
                                       list);
-    }
-
-    // @todo Support in AST
-    else if (type->isVectorTy()) {
+    } else if (type->isVectorTy()) {
       if (list[0]->getType() != type->getVectorElementType()) {
         return error("type mismatch: cannot initialize vector "
                      "with the given values in initializer list "
@@ -71,13 +71,21 @@ public:
         if (!funcsInfo) {
           return funcsInfo.takeError();
         }
-        std::tie(funcs, funcNames) = std::move(*funcsInfo);
-        for (size_t i = 0; i < funcs.size(); ++i) {
-          const auto domain = reinterpret_cast<llvm::MDNode*>(
-              MDBuilder.createConstant(llvm::Constant::getNullValue(funcs[i])));
+        // we append inherited functions (in order of inheritance)
+        const auto& [inheritedFuncs, inheritedNames] = *funcsInfo;
+        for (size_t i = 0; i < inheritedFuncs.size(); ++i) {
+          if (std::find(funcNames.begin(), funcNames.end(),
+                        inheritedNames[i]) != funcNames.end()) {
+            continue; // diamond inheritance
+          }
+          const auto domain =
+              reinterpret_cast<llvm::MDNode*>(MDBuilder.createConstant(
+                  llvm::Constant::getNullValue(inheritedFuncs[i])));
           const auto nameMD =
-              MDBuilder.createAnonymousAliasScope(domain, funcNames[i]);
-          metadata.emplace_back(std::pair{nameMD, i});
+              MDBuilder.createAnonymousAliasScope(domain, inheritedNames[i]);
+          metadata.emplace_back(std::pair{nameMD, funcs.size()});
+          funcs.push_back(inheritedFuncs[i]);
+          funcNames.push_back(inheritedNames[i]);
         }
       }
       }
@@ -88,7 +96,10 @@ public:
       if (!tp) {
         return tp.takeError();
       }
-      const auto fnType = (*tp)->getPointerTo(0);
+      // vtable slots take the (opaque) implementing object as first argument
+      const auto fnType =
+          Type::getClosureType(llvm::cast<llvm::FunctionType>(*tp))
+              ->getElementType(0);
       const auto domain = reinterpret_cast<llvm::MDNode*>(
           MDBuilder.createConstant(llvm::Constant::getNullValue(fnType)));
       if (std::find(funcNames.begin(), funcNames.end(), name) !=
@@ -103,12 +114,16 @@ public:
       funcs.push_back(fnType);
     }
 
-    const auto impl =
-        llvm::StructType::create(ctx, funcs, "interface::" + name_);
+    // interface values are {data, vtable} pairs
+    const auto vtable =
+        llvm::StructType::create(ctx, funcs, "vtable::" + name_);
+    (void)llvm::StructType::create(
+        ctx, {BasicTypes["char"]->getPointerTo(0), vtable->getPointerTo(0)},
+        "interface::" + name_);
     const auto interfaceMD =
         MDBuilder.createTBAAStructTypeNode(name_, metadata);
     module->getOrInsertNamedMetadata("interfaces")->addOperand(interfaceMD);
-    Structure::addMetadata(module, impl->getName(), funcNames);
+    Structure::addMetadata(module, vtable->getName(), funcNames);
     return llvm::Error::success();
   }
 
@@ -148,76 +163,141 @@ public:
     return std::pair{std::move(funcs), std::move(funcNames)};
   }
 
-  static llvm::Expected<small_vector<llvm::Function*>>
-  implements(llvm::IRBuilder<>& builder, llvm::Type* const interface,
-             llvm::Value* const value, const mpc_state_t state) {
-    const auto [type, isStruct] = Type::isStructKind(value->getType());
-    if (!isStruct) {
-      return error("expected value `{}` to be a struct kind at line {}",
-                   value->getName().str(), state.row + 1);
+  /// @brief Returns the (memoized) constant vtable of struct type structType
+  /// implementing interface, checking for a valid implementation
+  static llvm::Expected<llvm::GlobalVariable*>
+  getVTable(llvm::Module* const module, llvm::Type* const interface,
+            llvm::Type* const structType, const mpc_state_t state) {
+    const auto structName = structType->getStructName().str();
+    const auto interfaceName = getName(interface).str();
+    const auto name = format("vtable::{}::{}", structName, interfaceName);
+    if (const auto vtable = module->getNamedGlobal(name)) {
+      return vtable;
     }
-    const auto structName = type->getStructName().str();
-    const auto module = builder.GetInsertBlock()->getModule();
     auto funcsInfo = getFuncsInfo(module, interface, state);
     if (!funcsInfo) {
       return funcsInfo.takeError();
     }
     const auto& [funcs, funcNames] = *funcsInfo;
-    small_vector<llvm::Function*> funcsImpl;
+    small_vector<llvm::Constant*> funcsImpl;
     for (size_t i = 0; i < funcs.size(); ++i) {
       const auto funcName = funcNames[i].str();
-      if (auto structFunc = module->getFunction(
-              format("struct::{}::{}", structName, funcName))) {
-        const auto func = StructMember::bindThis(builder, structFunc, value);
-        if (func->getType() != funcs[i]) {
-          return error("struct `{}` does not implement interface `{}` "
-                       "(type mismatch for function `{}`) at line {}",
-                       structName, getName(interface).str(), funcName,
-                       state.row + 1);
-        }
-        funcsImpl.push_back(func);
-      } else {
+      const auto structFunc =
+          module->getFunction(format("struct::{}::{}", structName, funcName));
+      if (!structFunc) {
         return error("struct `{}` does not implement interface `{}` "
                      "(no implementation found for function `{}`) at line {}",
-                     structName, getName(interface).str(), funcName,
-                     state.row + 1);
+                     structName, interfaceName, funcName, state.row + 1);
       }
+      const auto type = structFunc->getFunctionType();
+      const auto slotType =
+          Type::getClosureType(
+              llvm::FunctionType::get(type->getReturnType(),
+                                      type->params().drop_front(),
+                                      type->isVarArg()))
+              ->getElementType(0);
+      if (slotType != funcs[i]) {
+        return error("struct `{}` does not implement interface `{}` "
+                     "(type mismatch for function `{}`) at line {}",
+                     structName, interfaceName, funcName, state.row + 1);
+      }
+      funcsImpl.push_back(llvm::ConstantExpr::getBitCast(structFunc, slotType));
     }
-    return std::move(funcsImpl);
+    const auto vtableType = getVTableType(module, interface);
+    return new llvm::GlobalVariable(
+        *module, vtableType, true, llvm::GlobalValue::PrivateLinkage,
+        llvm::ConstantStruct::get(vtableType, funcsImpl), name);
   }
 
-  /// @brief Casts a struct pointer into an object implementing an interface
-  /// checking for a valid implementation
+  /// @brief Casts a struct (pointer) into an interface value
+  /// {data, vtable} checking for a valid implementation
   static llvm::Expected<llvm::Value*> cast(llvm::IRBuilder<>& builder,
                                            llvm::Type* const interface,
                                            llvm::Value* const value,
                                            const mpc_state_t state) {
     const auto [interfaceType, isStruct] = Type::isStructKind(interface);
     assert(isStruct);
-    auto impl = implements(builder, interfaceType, value, state);
-    if (!impl) {
-      return impl.takeError();
+    const auto [type, isObject] = Type::isStructKind(value->getType());
+    if (!isObject) {
+      return error("expected value `{}` to be a struct kind at line {}",
+                   value->getName().str(), state.row + 1);
     }
-    const auto& funcsImpl = *impl;
-    auto interfaceImpl = builder.CreateAlloca(interfaceType, 0, nullptr, "");
-    for (size_t i = 0; i < funcsImpl.size(); ++i) {
-      const auto ptr =
-          builder.CreateStructGEP(interfaceType, interfaceImpl, i, "");
-      builder.CreateStore(funcsImpl[i], ptr);
+    const auto module = builder.GetInsertBlock()->getModule();
+    const auto charPtrTy = BasicTypes["char"]->getPointerTo(0);
+
+    if (type->getStructName().startswith("interface::")) {
+      auto object = value;
+      if (object->getType()->isPointerTy()) {
+        object = builder.CreateLoad(object);
+      }
+      if (type == interfaceType) {
+        return object;
+      }
+      // upcasts reuse the vtable when it starts with the base's functions
+      auto from = getFuncsInfo(module, type, state);
+      if (!from) {
+        return from.takeError();
+      }
+      auto to = getFuncsInfo(module, interfaceType, state);
+      if (!to) {
+        return to.takeError();
+      }
+      const auto& fromNames = from->second;
+      const auto& toNames = to->second;
+      if (toNames.size() > fromNames.size() ||
+          !std::equal(toNames.begin(), toNames.end(), fromNames.begin())) {
+        return error("cannot cast interface `{}` to interface `{}` "
+                     "at line {}",
+                     getName(type).str(), getName(interfaceType).str(),
+                     state.row + 1);
+      }
+      const auto vtable = builder.CreateBitCast(
+          builder.CreateExtractValue(object, 1),
+          getVTableType(module, interfaceType)->getPointerTo(0));
+      return builder.CreateInsertValue(
+          builder.CreateInsertValue(llvm::UndefValue::get(interfaceType),
+                                    builder.CreateExtractValue(object, 0), 0),
+          vtable, 1);
+    }
+
+    auto vtable = getVTable(module, interfaceType, type, state);
+    if (!vtable) {
+      return vtable.takeError();
+    }
+    // (interface values referring to the frame must not outlive it, see
+    // lowerClosureEnvironments)
+    auto data = value;
+    if (!data->getType()->isPointerTy()) {
+      const auto func = builder.GetInsertBlock()->getParent();
+      llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                              func->getEntryBlock().begin()};
+      const auto alloc = entry.CreateAlloca(type, 0, nullptr, "");
+      builder.CreateStore(data, alloc);
+      data = alloc;
     }
-    return interfaceImpl;
+    return builder.CreateInsertValue(
+        builder.CreateInsertValue(llvm::UndefValue::get(interfaceType),
+                                  builder.CreateBitCast(data, charPtrTy), 0),
+        *vtable, 1);
   }
 
-private:
-  const mpc_state_t state_;
-  const std::string name_;
-  std::vector<identifier_t> inherits_;
-  std::vector<std::pair<Type, llvm::StringRef>> functions_;
+  inline static llvm::StructType*
+  getVTableType(const llvm::Module* const module,
+                llvm::Type* const interface) {
+    return module->getTypeByName(
+        format("vtable::{}", getName(interface).str()));
+  }
 
   inline static llvm::StringRef getName(llvm::Type* const interface) {
     constexpr static auto nameOffset = std::strlen("interface::");
     return interface->getStructName().substr(nameOffset);
   }
+
+private:
+  const mpc_state_t state_;
+  const std::string name_;
+  std::vector<identifier_t> inherits_;
+  std::vector<std::pair<Type, llvm::StringRef>> functions_;
 };
 
 } // end namespace whack::ast
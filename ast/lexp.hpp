@@ -20,6 +20,7 @@
 
 #include "term.hpp"
 #include "type.hpp"
+#include "vector.hpp"
 
 namespace whack::ast {
 
@@ -53,7 +54,8 @@ public:
       if (!right) {
         return right.takeError();
       }
-      const auto rhs = *right;
+      auto rhs = *right;
+      std::tie(lhs, rhs) = splatOperands(builder, lhs, rhs);
       if (lhs->getType() != rhs->getType()) {
         return error("type mismatch: cannot apply op at line {}",
                      state_.row + 1);
@@ -71,7 +73,7 @@ public:
         }
       } else {
         auto ops = op;
-        if (lhs->getType()->isFloatingPointTy() &&
+        if (lhs->getType()->getScalarType()->isFloatingPointTy() &&
             (op == "+" || op == "-" || op == "*" || op == "/")) {
           ops += "f";
         }
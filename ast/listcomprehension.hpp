@@ -19,92 +19,96 @@
 #pragma once
 
 #include "comparison.hpp"
+#include "dynamicarray.hpp"
 #include "forinexpr.hpp"
 #include "opeq.hpp"
 
 namespace whack::ast {
 
+/// @brief `{<exprlist> <forinexpr>...}` collects the values of the
+/// expressions for each iteration of the (nested) loops into a dynamic
+/// array, stored straight from the innermost loop. When the number of
+/// iterations is known upfront (arrays, and intervals which do not depend
+/// on enclosing loops), its buffer is allocated once (filters leave spare
+/// capacity). Otherwise (e.g. for generators), it grows geometrically; we
+/// never build intermediate collections.
 class ListComprehension final : public Factor {
 public:
   explicit ListComprehension(const mpc_ast_t* const ast)
-      : Factor(kListComprehension), identList_{getIdentList(ast->children[1])} {
+      : Factor(kListComprehension), state_{ast->state},
+        exprList_{getExprList(ast->children[1])} {
     for (auto i = 2; i < ast->children_num - 1; i += 2) {
       expr_.emplace_back(ForInExpr{ast->children[i]});
     }
   }
 
   llvm::Expected<llvm::Value*> codegen(llvm::IRBuilder<>& builder) const final {
-    auto& ctx = builder.getContext();
     const auto func = builder.GetInsertBlock()->getParent();
-    for (const auto& expr : expr_) {
-      const auto& range = expr.range();
-      auto beg = range.begin(builder);
-      if (!beg) {
-        return beg.takeError();
-      }
-      const auto begin = *beg;
-      const auto type = begin->getType();
-      // we only loop over unnamed constants now...
-      if (type->isPointerTy()) {
-        if (type->isStructTy()) {
-          // @todo : If next/end are provided, compile error
-          if (Type::isVariableLengthArray(type)) {
-            // @todo: get length, loop
-          } else {
-            // @todo: check for .begin() && .end()
-          }
-        }
-        llvm_unreachable("not implemented");
-      } else {
-        // @todo: If no end require that we must be yielding if in a function,
-        //  (otherwise yield on access for a variable??)
-        auto e = range.end(builder);
-        if (!e) {
-          return e.takeError();
-        }
-        const auto end = *e;
-        assert(end && "We require an end for now...");
-        auto n = range.next(builder);
-        if (!n) {
-          return n.takeError();
-        }
-
-        const auto incr = range.hasNext() ? *n : Integral::get(1, type);
-        const auto ret = builder.CreateAlloca(
-            ArrayType::getVarLenType(ctx, type), 0, nullptr, "");
-        const auto retType = ret->getType()->getPointerElementType();
-        const auto sizePtr = builder.CreateStructGEP(retType, ret, 0);
-        builder.CreateStore(Integral::get(0), sizePtr);
-
-        const auto block = llvm::BasicBlock::Create(ctx, "block", func);
-        const auto cont = llvm::BasicBlock::Create(ctx, "cont", func);
-        const auto cmp = INTCMP[range.endInclusive() ? "<=" : "<"];
-        const auto current = builder.CreateAlloca(type, 0, nullptr, "");
-
-        builder.CreateStore(begin, current);
-        builder.CreateCondBr(
-            builder.CreateICmp(cmp, builder.CreateLoad(current), end), block,
-            cont);
-        builder.SetInsertPoint(block);
-
-        const auto step = builder.CreateAdd(builder.CreateLoad(current), incr);
-        builder.CreateStore(step, current);
-        const auto arrPtr = builder.CreateStructGEP(retType, ret, 1);
-        const auto ptr = builder.CreateInBoundsGEP(
-            arrPtr, {Integral::get(0), builder.CreateLoad(sizePtr)});
-        builder.CreateStore(builder.CreateLoad(current), ptr);
-        const auto size =
-            builder.CreateAdd(builder.CreateLoad(sizePtr), Integral::get(1));
-        builder.CreateStore(size, sizePtr);
+    const auto module = func->getParent();
+    const auto ptr = BasicTypes["char"]->getPointerTo(0);
+    auto c = this->getSize(builder);
+    if (!c) {
+      return c.takeError();
+    }
+    const auto count = *c;
+    llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                            func->getEntryBlock().begin()};
+    // (the element type is only known once the innermost loop is built,
+    // and so is the allocation for a known count)
+    const auto data = entry.CreateAlloca(ptr, 0, nullptr, "");
+    const auto size = entry.CreateAlloca(BasicTypes["int"], 0, nullptr, "");
+    const auto capacity =
+        entry.CreateAlloca(BasicTypes["int"], 0, nullptr, "");
+    builder.CreateStore(Integral::zero(), size);
+    builder.CreateStore(Integral::zero(), capacity);
+    const auto preheader = builder.CreateStore(
+        llvm::ConstantPointerNull::get(ptr), data);
 
-        builder.CreateCondBr(
-            builder.CreateICmp(cmp, builder.CreateLoad(current), end), block,
-            cont);
-        builder.SetInsertPoint(cont);
-        return builder.CreateLoad(ret);
+    llvm::Type* type = nullptr;
+    std::function<llvm::Error(size_t)> loop;
+    loop = [&](const size_t i) -> llvm::Error {
+      if (i < expr_.size()) {
+        return expr_[i].codegen(builder, [&]() { return loop(i + 1); });
       }
+      auto value = this->getValue(builder);
+      if (!value) {
+        return value.takeError();
+      }
+      type = (*value)->getType();
+      if (!count) {
+        const auto needed =
+            builder.CreateNSWAdd(builder.CreateLoad(size), Integral::one());
+        reserveDynamicArray(builder, type, data, capacity, needed);
+      }
+      store(builder, type, data, size, *value);
+      return llvm::Error::success();
+    };
+    if (auto err = loop(0)) {
+      return err;
+    }
+
+    if (count) {
+      // (the allocation is checked before the loops)
+      const auto loops = preheader->getParent()->splitBasicBlock(preheader);
+      const auto pre = loops->getSinglePredecessor();
+      pre->getTerminator()->eraseFromParent();
+      llvm::IRBuilder<> preBuilder{pre};
+      const auto bytes = getAllocSize(preBuilder, type, count);
+      const auto mem =
+          preBuilder.CreateCall(getHeapFunction(module, "malloc"), bytes);
+      checkAllocation(preBuilder, mem, bytes);
+      preBuilder.CreateStore(mem, data);
+      preBuilder.CreateStore(count, capacity);
+      preBuilder.CreateBr(loops);
+      preheader->eraseFromParent();
     }
-    return error("list comprehension failed"); // @todo
+    const auto elements =
+        builder.CreateBitCast(builder.CreateLoad(data), type->getPointerTo(0));
+    llvm::Value* array =
+        llvm::UndefValue::get(ArrayType::getVarLenType(module, type));
+    array = builder.CreateInsertValue(array, elements, 0);
+    array = builder.CreateInsertValue(array, builder.CreateLoad(size), 1);
+    return builder.CreateInsertValue(array, builder.CreateLoad(capacity), 2);
   }
 
   llvm::Expected<llvm::Value*> codegen(llvm::IRBuilder<>& builder,
@@ -125,8 +129,68 @@ public:
   }
 
 private:
-  ident_list_t identList_;
+  const mpc_state_t state_;
+  small_vector<expr_t> exprList_;
   small_vector<ForInExpr> expr_;
+
+  /// @brief Returns the number of iterations of the loop nest (regardless
+  /// of conditions) if every loop's is known upfront, or nullptr
+  llvm::Expected<llvm::Value*> getSize(llvm::IRBuilder<>& builder) const {
+    llvm::Value* size = Integral::one();
+    ident_list_t bound;
+    for (const auto& expr : expr_) {
+      auto count = expr.getTripCount(builder, bound);
+      if (!count || !*count) {
+        return count;
+      }
+      size = builder.CreateNSWMul(size, *count);
+      bound.append(expr.identList().begin(), expr.identList().end());
+    }
+    return size;
+  }
+
+  /// @brief Returns the value collected for the current iteration (a
+  /// struct, for several expressions)
+  llvm::Expected<llvm::Value*> getValue(llvm::IRBuilder<>& builder) const {
+    small_vector<llvm::Value*> values;
+    for (const auto& expression : exprList_) {
+      auto expr = expression->codegen(builder);
+      if (!expr) {
+        return expr.takeError();
+      }
+      auto value = *expr;
+      // (struct values are not loaded by Term)
+      if (llvm::isa<llvm::AllocaInst>(value) || isBinding(value)) {
+        value = builder.CreateLoad(value);
+      }
+      values.push_back(value);
+    }
+    if (values.size() == 1) {
+      return values.front();
+    }
+    small_vector<llvm::Type*> types;
+    for (const auto value : values) {
+      types.push_back(value->getType());
+    }
+    llvm::Value* value = llvm::UndefValue::get(
+        llvm::StructType::get(builder.getContext(), types));
+    for (unsigned i = 0; i < values.size(); ++i) {
+      value = builder.CreateInsertValue(value, values[i], i);
+    }
+    return value;
+  }
+
+  /// @brief Stores value as the next element (of type type) of the
+  /// buffer at data
+  static void store(llvm::IRBuilder<>& builder, llvm::Type* const type,
+                    llvm::Value* const data, llvm::Value* const size,
+                    llvm::Value* const value) {
+    const auto len = builder.CreateLoad(size);
+    const auto elements =
+        builder.CreateBitCast(builder.CreateLoad(data), type->getPointerTo(0));
+    builder.CreateStore(value, builder.CreateInBoundsGEP(elements, len));
+    builder.CreateStore(builder.CreateNSWAdd(len, Integral::one()), size);
+  }
 };
 
 } // end namespace whack::ast
@@ -19,21 +19,51 @@
 #pragma once
 
 #include "ast.hpp"
-#include "typelist.hpp"
+#include "dataclass.hpp"
+#include "integral.hpp"
+#include "metadata.hpp"
+#include "range.hpp"
+#include "type.hpp"
+#include <llvm/Analysis/ValueTracking.h>
+#include <map>
 
 namespace whack::ast {
 
+/// @brief Lowers match statements to decision trees. Integers (and enum
+/// values) are switched on directly, with large ranges checked after the
+/// switch; strings are switched on by length, then by hash, and compared
+/// with memcmp; data classes are switched on by tag, with variant fields
+/// bound in place (no copies).
 class Match final : public Stmt {
 public:
   explicit constexpr Match(const mpc_ast_t* const ast) noexcept
       : Stmt(kMatch), ast_{ast} {}
 
   llvm::Error codegen(llvm::IRBuilder<>& builder) const final {
-    if (getOutermostAstTag(ast_->children[5]) == "exprlist") {
-      return this->exprMatch(builder);
+    auto val = getExpressionValue(ast_->children[2])->codegen(builder);
+    if (!val) {
+      return val.takeError();
+    }
+    auto subject = *val;
+    const auto type = subject->getType();
+    if (const auto [structType, isStruct] = Type::isStructKind(type);
+        isStruct && structType->getStructName().startswith("class::")) {
+      if (!type->isPointerTy()) {
+        // we bind into an addressable copy
+        const auto copy = builder.CreateAlloca(type, 0, nullptr, "");
+        builder.CreateStore(subject, copy);
+        subject = copy;
+      }
+      return this->dataClassMatch(builder, subject);
+    }
+    if (type == BasicTypes["char"]->getPointerTo(0)) {
+      return this->stringMatch(builder, subject);
+    }
+    if (type->isIntegerTy()) {
+      return this->exprMatch(builder, subject);
     }
-    // @todo Refactor
-    return this->dataClassMatch(builder);
+    return error("invalid type for match subject at line {}",
+                 ast_->state.row + 1);
   }
 
   inline static bool classof(const Stmt* const stmt) {
@@ -41,104 +71,459 @@ public:
   }
 
 private:
-  const mpc_ast_t* const ast_;
+  using stmt_t = std::unique_ptr<Stmt>;
+  using option_t = std::pair<llvm::Value*, llvm::BasicBlock*>;
 
-  llvm::Error exprMatch(llvm::IRBuilder<>& builder) const {
-    using exprlist_t = small_vector<llvm::Value*>;
-    using stmt_t = std::unique_ptr<Stmt>;
+  // ranges of at most this many values become switch cases
+  constexpr static int64_t kMaxRangeCases = 16;
+  // strings of the same length (and hash) compared in turn before hashing
+  constexpr static size_t kMaxCompareChain = 2;
 
-    auto val = getExpressionValue(ast_->children[2])->codegen(builder);
-    if (!val) {
-      return val.takeError();
-    }
-    const auto subject = *val;
-    const auto type = subject->getType();
-    small_vector<std::pair<exprlist_t, stmt_t>> options;
-    stmt_t defaultStmt;
-    small_vector<llvm::Value*> allOptions;
+  const mpc_ast_t* const ast_;
+
+  llvm::Error exprMatch(llvm::IRBuilder<>& builder,
+                        llvm::Value* const subject) const {
+    const auto type = llvm::cast<llvm::IntegerType>(subject->getType());
+    const auto entry = builder.GetInsertBlock();
+    const auto func = entry->getParent();
+    auto& ctx = func->getContext();
+    const auto contBlock = llvm::BasicBlock::Create(ctx, "block", func);
+    small_vector<std::pair<llvm::ConstantInt*, llvm::BasicBlock*>> cases;
+    small_vector<std::tuple<llvm::ConstantInt*, llvm::ConstantInt*,
+                            llvm::BasicBlock*>>
+        ranges;
+    small_vector<std::pair<int64_t, int64_t>> covered;
+    uint64_t numCovered = 0;
 
     for (auto i = 5; i < ast_->children_num - 1; i += 3) {
       const auto ref = ast_->children[i];
       if (std::string_view(ref->contents) == "default") {
-        defaultStmt = getStmt(ast_->children[i + 2]);
-      } else {
-        exprlist_t values;
-        for (const auto& expr : getExprList(ref)) {
-          auto opt = expr->codegen(builder);
+        continue;
+      }
+      const auto caseBlock =
+          llvm::BasicBlock::Create(ctx, "case", func, contBlock);
+      for (const auto pattern : getPatterns(ref)) {
+        const auto line = pattern->state.row + 1;
+        builder.SetInsertPoint(entry);
+        llvm::ConstantInt* lo;
+        llvm::ConstantInt* hi;
+        if (getInnermostAstTag(pattern) == "pattern") {
+          const Range range{pattern};
+          auto begin = range.begin(builder);
+          if (!begin) {
+            return begin.takeError();
+          }
+          auto end = range.end(builder);
+          if (!end) {
+            return end.takeError();
+          }
+          lo = getConstant(*begin);
+          hi = getConstant(*end);
+          if (!lo || !hi) {
+            return error("expected constant bounds for match range "
+                         "at line {}",
+                         line);
+          }
+          if (!range.endInclusive()) {
+            hi = llvm::ConstantInt::get(hi->getType(), hi->getSExtValue() - 1,
+                                        true);
+          }
+        } else {
+          auto opt = getExpressionValue(pattern)->codegen(builder);
           if (!opt) {
             return opt.takeError();
           }
-          const auto option = *opt;
-          if (option->getType() != type) {
-            return error("invalid type for match option at line {}",
-                         ref->state.row + 1);
+          lo = hi = getConstant(*opt);
+          if (!lo) {
+            return error("expected constant for match option at line {}",
+                         line);
           }
-          if (std::find(allOptions.begin(), allOptions.end(), option) !=
-              allOptions.end()) {
-            return error("duplicate option for match at line {}",
-                         ref->state.row + 1);
+        }
+        if (lo->getType() != type || hi->getType() != type) {
+          return error("invalid type for match option at line {}", line);
+        }
+
+        const auto first = lo->getSExtValue();
+        const auto last = hi->getSExtValue();
+        if (last < first) {
+          return error("empty range for match option at line {}", line);
+        }
+        for (const auto& [begin, end] : covered) {
+          if (first <= end && begin <= last) {
+            return error("duplicate option for match at line {}", line);
+          }
+        }
+        covered.emplace_back(first, last);
+        numCovered += static_cast<uint64_t>(last - first) + 1;
+        if (last - first < kMaxRangeCases) {
+          for (int64_t k = 0; k <= last - first; ++k) {
+            cases.emplace_back(llvm::ConstantInt::get(type, first + k, true),
+                               caseBlock);
           }
-          values.push_back(option);
-          allOptions.push_back(option);
+        } else {
+          ranges.emplace_back(lo, hi, caseBlock);
         }
-        options.emplace_back(
-            std::pair{std::move(values), getStmt(ast_->children[i + 2])});
+      }
+      if (auto err = emitCase(builder, caseBlock,
+                              *getStmt(ast_->children[i + 2]), contBlock)) {
+        return err;
       }
     }
 
-    const auto func = builder.GetInsertBlock()->getParent();
+    // ranges too large for the switch are checked (x - lo <u size) after it
+    const auto defaultBlock =
+        llvm::BasicBlock::Create(ctx, "default", func, contBlock);
+    auto fallback = defaultBlock;
+    for (auto it = ranges.rbegin(); it != ranges.rend(); ++it) {
+      const auto& [lo, hi, caseBlock] = *it;
+      const auto check =
+          llvm::BasicBlock::Create(ctx, "range", func, defaultBlock);
+      builder.SetInsertPoint(check);
+      const auto size =
+          llvm::ConstantInt::get(ctx, hi->getValue() - lo->getValue() + 1);
+      if (size->isZero()) { // the whole domain
+        builder.CreateBr(caseBlock);
+      } else {
+        const auto offset = builder.CreateSub(subject, lo);
+        builder.CreateCondBr(builder.CreateICmpULT(offset, size), caseBlock,
+                             fallback);
+      }
+      fallback = check;
+    }
+
+    builder.SetInsertPoint(entry);
+    const auto switcher = builder.CreateSwitch(subject, fallback, cases.size());
+    for (const auto& [value, caseBlock] : cases) {
+      switcher->addCase(value, caseBlock);
+    }
+
+    const auto bits = type->getBitWidth();
+    const auto exhaustive = bits < 64 && numCovered == (uint64_t{1} << bits);
+    if (auto err = this->emitDefault(builder, defaultBlock, contBlock,
+                                     exhaustive)) {
+      return err;
+    }
+    builder.SetInsertPoint(contBlock);
+    return llvm::Error::success();
+  }
+
+  llvm::Error stringMatch(llvm::IRBuilder<>& builder,
+                          llvm::Value* const subject) const {
+    const auto entry = builder.GetInsertBlock();
+    const auto func = entry->getParent();
+    const auto module = func->getParent();
     auto& ctx = func->getContext();
-    auto defaultBlock = llvm::BasicBlock::Create(ctx, "default", func);
     const auto contBlock = llvm::BasicBlock::Create(ctx, "block", func);
-    const auto switcher =
-        builder.CreateSwitch(subject, defaultBlock, options.size());
+    // options by length, then by hash
+    std::map<uint64_t, std::map<uint64_t, small_vector<option_t>>> buckets;
+    small_vector<std::string> options;
 
-    for (const auto& [alternatives, stmt] : options) {
-      auto caseBlock = llvm::BasicBlock::Create(ctx, "case", func);
-      for (const auto& value : alternatives) {
-        switcher->addCase(llvm::dyn_cast<llvm::ConstantInt>(value), caseBlock);
+    for (auto i = 5; i < ast_->children_num - 1; i += 3) {
+      const auto ref = ast_->children[i];
+      if (std::string_view(ref->contents) == "default") {
+        continue;
       }
-      caseBlock->moveBefore(contBlock);
-      builder.SetInsertPoint(caseBlock);
-      if (auto err = stmt->codegen(builder)) {
-        return err;
+      const auto caseBlock =
+          llvm::BasicBlock::Create(ctx, "case", func, contBlock);
+      for (const auto pattern : getPatterns(ref)) {
+        const auto line = pattern->state.row + 1;
+        builder.SetInsertPoint(entry);
+        llvm::StringRef str;
+        llvm::Value* option = nullptr;
+        if (getInnermostAstTag(pattern) != "pattern") {
+          auto opt = getExpressionValue(pattern)->codegen(builder);
+          if (!opt) {
+            return opt.takeError();
+          }
+          option = *opt;
+        }
+        if (!option || !llvm::getConstantStringInfo(option, str)) {
+          return error("expected string literal for match option "
+                       "at line {}",
+                       line);
+        }
+        if (std::find(options.begin(), options.end(), str) != options.end()) {
+          return error("duplicate option for match at line {}", line);
+        }
+        options.push_back(str.str());
+        buckets[str.size()][hashBytes(str)].emplace_back(option, caseBlock);
       }
-      if (auto err = stmt->runScopeExit(builder)) {
+      if (auto err = emitCase(builder, caseBlock,
+                              *getStmt(ast_->children[i + 2]), contBlock)) {
         return err;
       }
-      caseBlock = builder.GetInsertBlock();
-      if (!caseBlock->back().isTerminator()) {
-        builder.CreateBr(contBlock);
+    }
+
+    const auto defaultBlock =
+        llvm::BasicBlock::Create(ctx, "default", func, contBlock);
+    const auto charPtrTy = subject->getType();
+    const auto sizeType = module->getDataLayout().getIntPtrType(ctx);
+    const auto strlen = module->getOrInsertFunction(
+        "strlen", llvm::FunctionType::get(sizeType, charPtrTy, false));
+    const auto hash = module->getOrInsertFunction(
+        "__builtin_hash_bytes",
+        llvm::FunctionType::get(builder.getInt64Ty(), {charPtrTy, sizeType},
+                                false));
+
+    builder.SetInsertPoint(entry);
+    const auto length = builder.CreateCall(strlen, subject, "len");
+    const auto switcher =
+        builder.CreateSwitch(length, defaultBlock, buckets.size());
+    for (const auto& [size, hashes] : buckets) {
+      const auto len = llvm::ConstantInt::get(sizeType, size);
+      const auto block =
+          llvm::BasicBlock::Create(ctx, "len", func, defaultBlock);
+      switcher->addCase(len, block);
+      builder.SetInsertPoint(block);
+
+      small_vector<option_t> sameLength;
+      for (const auto& [_, sameHash] : hashes) {
+        sameLength.insert(sameLength.end(), sameHash.begin(), sameHash.end());
+      }
+      if (sameLength.size() <= kMaxCompareChain) {
+        compare(builder, subject, len, sameLength, defaultBlock);
+        continue;
+      }
+      const auto hashSwitch =
+          builder.CreateSwitch(builder.CreateCall(hash, {subject, len}, "hash"),
+                               defaultBlock, hashes.size());
+      for (const auto& [value, sameHash] : hashes) {
+        const auto hashBlock =
+            llvm::BasicBlock::Create(ctx, "hash", func, defaultBlock);
+        hashSwitch->addCase(builder.getInt64(value), hashBlock);
+        builder.SetInsertPoint(hashBlock);
+        compare(builder, subject, len, sameHash, defaultBlock);
       }
     }
 
-    if (defaultStmt) {
-      builder.SetInsertPoint(defaultBlock);
-      if (auto err = defaultStmt->codegen(builder)) {
-        return err;
+    if (auto err = this->emitDefault(builder, defaultBlock, contBlock,
+                                     /*exhaustive*/ false)) {
+      return err;
+    }
+    builder.SetInsertPoint(contBlock);
+    return llvm::Error::success();
+  }
+
+  llvm::Error dataClassMatch(llvm::IRBuilder<>& builder,
+                             llvm::Value* const subject) const {
+    const auto module = builder.GetInsertBlock()->getModule();
+    constexpr static auto prefixLength = std::strlen("class::");
+    const auto className = subject->getType()
+                               ->getPointerElementType()
+                               ->getStructName()
+                               .drop_front(prefixLength);
+    const auto numVariants =
+        getMetadataParts(*module, "classes", className).size();
+    const auto tag = DataClass::getTag(builder, subject, className);
+    const auto tagType = llvm::cast<llvm::IntegerType>(tag->getType());
+    const auto entry = builder.GetInsertBlock();
+    const auto func = entry->getParent();
+    auto& ctx = func->getContext();
+    const auto contBlock = llvm::BasicBlock::Create(ctx, "block", func);
+    small_vector<std::pair<unsigned, llvm::BasicBlock*>> cases;
+
+    for (auto i = 5; i < ast_->children_num - 1; i += 3) {
+      const auto ref = ast_->children[i];
+      if (std::string_view(ref->contents) == "default") {
+        continue;
+      }
+      const auto caseBlock =
+          llvm::BasicBlock::Create(ctx, "case", func, contBlock);
+      const auto patterns = getPatterns(ref);
+      small_vector<llvm::Value*> bindings;
+      builder.SetInsertPoint(caseBlock);
+
+      for (const auto pattern : patterns) {
+        const auto line = pattern->state.row + 1;
+        // Class::Variant or Class::Variant(bindings...)
+        auto ctor = pattern;
+        const mpc_ast_t* names = nullptr;
+        if (getInnermostAstTag(pattern) == "funccall") {
+          ctor = pattern->children[0];
+          if (pattern->children_num == 4) {
+            names = pattern->children[2];
+          }
+        }
+        if (getInnermostAstTag(ctor) != "scoperes" ||
+            ctor->children_num != 3 ||
+            className != ctor->children[0]->contents) {
+          return error("invalid pattern for data class `{}` at line {}",
+                       className.str(), line);
+        }
+        const auto ctorName = ctor->children[2]->contents;
+        const auto idx = DataClass::getIndex(module, className, ctorName);
+        if (!idx) {
+          return error("data class `{}` has no constructor `{}` at line {}",
+                       className.str(), ctorName, line);
+        }
+        if (std::find_if(cases.begin(), cases.end(), [&](const auto& c) {
+              return c.first == idx.value();
+            }) != cases.end()) {
+          return error("duplicate option for match at line {}", line);
+        }
+        cases.emplace_back(idx.value(), caseBlock);
+        if (!names) {
+          continue;
+        }
+        if (patterns.size() > 1) {
+          return error("cannot bind variables in alternative patterns "
+                       "at line {}",
+                       line);
+        }
+
+        // bindings address the payload of the subject
+        const auto variant = module->getTypeByName(
+            format("class::{}::{}", className.str(), ctorName));
+        small_vector<const mpc_ast_t*> idents;
+        if (getInnermostAstTag(names) == "exprlist") {
+          for (auto j = 0; j < names->children_num; j += 2) {
+            idents.push_back(names->children[j]);
+          }
+        } else {
+          idents.push_back(names);
+        }
+        if (idents.size() != variant->getStructNumElements()) {
+          return error("invalid number of bindings for constructor `{}` "
+                       "of data class `{}` at line {}",
+                       ctorName, className.str(), line);
+        }
+        const auto payload = DataClass::getPayload(builder, subject, variant);
+        for (unsigned j = 0; j < idents.size(); ++j) {
+          if (getInnermostAstTag(idents[j]) != "ident") {
+            return error("expected identifier for binding at line {}", line);
+          }
+          if (std::string_view(idents[j]->contents) != "_") {
+            bindings.push_back(tagBinding(builder.CreateStructGEP(
+                variant, payload, j, idents[j]->contents)));
+          }
+        }
       }
-      if (auto err = defaultStmt->runScopeExit(builder)) {
+
+      if (auto err = emitCase(builder, caseBlock,
+                              *getStmt(ast_->children[i + 2]), contBlock)) {
         return err;
       }
-      defaultBlock = builder.GetInsertBlock();
-      if (!defaultBlock->back().isTerminator()) {
-        builder.CreateBr(contBlock);
+      // bindings go out of scope
+      for (const auto binding : bindings) {
+        binding->setName("");
       }
     }
 
+    const auto defaultBlock =
+        llvm::BasicBlock::Create(ctx, "default", func, contBlock);
+    builder.SetInsertPoint(entry);
+    const auto switcher = builder.CreateSwitch(tag, defaultBlock, cases.size());
+    for (const auto& [idx, caseBlock] : cases) {
+      switcher->addCase(llvm::ConstantInt::get(tagType, idx), caseBlock);
+    }
+    if (auto err = this->emitDefault(builder, defaultBlock, contBlock,
+                                     cases.size() == numVariants)) {
+      return err;
+    }
     builder.SetInsertPoint(contBlock);
     return llvm::Error::success();
   }
 
-  llvm::Error patternMatch(llvm::IRBuilder<>& builder) const {
-    // @todo: Proper pattern matching w/+ structured bindings
+  // emits the statement of a case into block, falling through to cont
+  static llvm::Error emitCase(llvm::IRBuilder<>& builder,
+                              llvm::BasicBlock* block, const Stmt& stmt,
+                              llvm::BasicBlock* const cont) {
+    builder.SetInsertPoint(block);
+    if (auto err = stmt.codegen(builder)) {
+      return err;
+    }
+    if (auto err = stmt.runScopeExit(builder)) {
+      return err;
+    }
+    block = builder.GetInsertBlock();
+    if (block->empty() || !block->back().isTerminator()) {
+      builder.CreateBr(cont);
+    }
     return llvm::Error::success();
   }
 
-  llvm::Error dataClassMatch(llvm::IRBuilder<>& builder) const {
-    // @todo
+  // emits the default case; exhaustive matches without one never reach it
+  llvm::Error emitDefault(llvm::IRBuilder<>& builder,
+                          llvm::BasicBlock* const block,
+                          llvm::BasicBlock* const cont,
+                          const bool exhaustive) const {
+    for (auto i = 5; i < ast_->children_num - 1; i += 3) {
+      if (std::string_view(ast_->children[i]->contents) == "default") {
+        return emitCase(builder, block, *getStmt(ast_->children[i + 2]),
+                        cont);
+      }
+    }
+    builder.SetInsertPoint(block);
+    if (exhaustive) {
+      builder.CreateUnreachable();
+    } else {
+      builder.CreateBr(cont);
+    }
     return llvm::Error::success();
   }
+
+  // compares subject to each option (of length len) in turn
+  static void compare(llvm::IRBuilder<>& builder, llvm::Value* const subject,
+                      llvm::ConstantInt* const len,
+                      const small_vector<option_t>& options,
+                      llvm::BasicBlock* const defaultBlock) {
+    const auto func = builder.GetInsertBlock()->getParent();
+    const auto module = func->getParent();
+    if (len->isZero()) { // only the empty string
+      builder.CreateBr(options.front().second);
+      return;
+    }
+    const auto memcmp = module->getOrInsertFunction(
+        "memcmp",
+        llvm::FunctionType::get(
+            BasicTypes["int"], {subject->getType(), subject->getType(),
+                                len->getType()},
+            false));
+    for (size_t i = 0; i < options.size(); ++i) {
+      const auto& [option, caseBlock] = options[i];
+      const auto next =
+          i + 1 < options.size()
+              ? llvm::BasicBlock::Create(func->getContext(), "cmp", func,
+                                         defaultBlock)
+              : defaultBlock;
+      const auto cmp = builder.CreateCall(memcmp, {subject, option, len});
+      builder.CreateCondBr(builder.CreateICmpEQ(cmp, Integral::zero()),
+                           caseBlock, next);
+      builder.SetInsertPoint(next);
+    }
+  }
+
+  static small_vector<const mpc_ast_t*>
+  getPatterns(const mpc_ast_t* const ast) {
+    small_vector<const mpc_ast_t*> patterns;
+    if (getInnermostAstTag(ast) == "patternlist") {
+      for (auto i = 0; i < ast->children_num; i += 2) {
+        patterns.push_back(ast->children[i]);
+      }
+    } else {
+      patterns.push_back(ast);
+    }
+    return patterns;
+  }
+
+  // options are constants, or enum values (constant globals)
+  static llvm::ConstantInt* getConstant(llvm::Value* const value) {
+    if (const auto global = llvm::dyn_cast<llvm::GlobalVariable>(value)) {
+      return global->isConstant() && global->hasInitializer()
+                 ? llvm::dyn_cast<llvm::ConstantInt>(global->getInitializer())
+                 : nullptr;
+    }
+    return llvm::dyn_cast<llvm::ConstantInt>(value);
+  }
+
+  // FNV-1a, as computed at runtime by __builtin_hash_bytes
+  static uint64_t hashBytes(llvm::StringRef bytes) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const auto byte : bytes.bytes()) {
+      hash = (hash ^ byte) * 0x100000001b3ULL;
+    }
+    return hash;
+  }
 };
 
 } // end namespace whack::ast
@@ -61,12 +61,21 @@ public:
           return v.takeError();
         }
         const auto val = *v;
-        if (val->getType() != ptr->getType()->getPointerElementType()) {
+        const auto bitField =
+            StructMember::getBitField(*module, structName, member);
+        const auto fieldType = bitField
+                                   ? bitField.value().second->getType()
+                                   : ptr->getType()->getPointerElementType();
+        if (val->getType() != fieldType) {
           return error("type mismatch: cannot assign value to "
                        "field `{}` of struct `{}` at line {}",
                        member, structName, state.row + 1);
         }
-        builder.CreateStore(val, ptr);
+        if (bitField) {
+          StructMember::storeBitField(builder, ptr, bitField.value(), val);
+        } else {
+          builder.CreateStore(val, ptr);
+        }
       } else {
         return error("field `{}` does not exist for struct `{}` at line {}",
                      member, structName, state.row + 1);
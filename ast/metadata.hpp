@@ -101,6 +101,21 @@ getMetadataPartIndex(const llvm::Module& module, llvm::StringRef metadata,
   return std::nullopt;
 }
 
+/// @brief Tags a variable addressed through a GEP rather than an alloca
+/// (captures by reference, and the names bound by for-in, match and select)
+/// so that it is loaded like any other variable
+static llvm::Value* tagBinding(llvm::Value* const variable) {
+  if (const auto inst = llvm::dyn_cast<llvm::Instruction>(variable)) {
+    inst->setMetadata("binding", llvm::MDNode::get(inst->getContext(), {}));
+  }
+  return variable;
+}
+
+inline static bool isBinding(const llvm::Value* const value) {
+  const auto inst = llvm::dyn_cast<llvm::Instruction>(value);
+  return inst && inst->getMetadata("binding");
+}
+
 } // end namespace whack::ast
 
 #endif // WHACK_METADATA_HPP
@@ -20,6 +20,7 @@
 
 #include "ast.hpp"
 #include "metadata.hpp"
+#include "receive.hpp"
 #include <llvm/IR/MDBuilder.h>
 
 namespace whack::ast {
@@ -33,7 +34,7 @@ public:
     const auto block = builder.GetInsertBlock();
     const auto module = block->getParent()->getParent();
     // we cast the provided memory
-    if (ast_->children_num > 2) {
+    if (std::string_view(ast_->children[1]->contents) == "(") {
       // @todo Check if memory is "enough"??
       auto expr = getExpressionValue(ast_->children[2])->codegen(builder);
       if (!expr) {
@@ -51,14 +52,14 @@ public:
       return tp.takeError();
     }
     const auto type = *tp;
-    const auto allocSize =
-        type->isArrayTy() ? Integral{ast_->children[1]->children[1]}.value()
-                          : 1;
+    if (const auto element = Type::getChanElementType(type)) {
+      return makeChan(builder, type, element);
+    }
+    // (arrays, including structure-of-arrays, are allocated whole)
+    const auto allocSize = llvm::ConstantExpr::getTruncOrBitCast(
+        llvm::ConstantExpr::getSizeOf(type), BasicTypes["int"]);
     const auto call = llvm::CallInst::CreateMalloc(
-        block, BasicTypes["int"], type,
-        llvm::dyn_cast<llvm::Value>(
-            llvm::ConstantInt::get(BasicTypes["int"], allocSize)),
-        nullptr, nullptr, "");
+        block, BasicTypes["int"], type, allocSize, nullptr, nullptr, "");
     builder.Insert(call);
     return llvm::cast<llvm::Value>(call);
   }
@@ -69,6 +70,37 @@ public:
 
 private:
   const mpc_ast_t* const ast_;
+
+  /// @brief `new chan<T>` makes an unbuffered channel, and
+  /// `new chan<T>{capacity}` a buffered one
+  llvm::Expected<llvm::Value*> makeChan(llvm::IRBuilder<>& builder,
+                                        llvm::Type* const type,
+                                        llvm::Type* const element) const {
+    const auto module = builder.GetInsertBlock()->getModule();
+    llvm::Value* capacity = builder.getInt32(0);
+    if (ast_->children_num > 2) {
+      const auto init = ast_->children[2];
+      if (getInnermostAstTag(init) != "initlist" || init->children_num != 3) {
+        return error("expected a channel capacity at line {}",
+                     ast_->state.row + 1);
+      }
+      auto expr = getExpressionValue(init->children[1])->codegen(builder);
+      if (!expr) {
+        return expr.takeError();
+      }
+      if (!(*expr)->getType()->isIntegerTy()) {
+        return error("type error: channel capacity must be an integer "
+                     "at line {}",
+                     ast_->state.row + 1);
+      }
+      capacity = builder.CreateIntCast(*expr, builder.getInt32Ty(), false);
+    }
+    const auto chan = builder.CreateCall(
+        getChanFunction(module, "__builtin_chan_make"),
+        {builder.getInt64(Type::getAllocSize(module, element)), capacity});
+    return builder.CreateBitCast(chan, type);
+  }
+
 };
 
 } // end namespace whack::ast
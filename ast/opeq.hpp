@@ -19,6 +19,10 @@
 #pragma once
 
 #include "ast.hpp"
+#include "atomic.hpp"
+#include "element.hpp"
+#include "structmember.hpp"
+#include "vector.hpp"
 
 namespace whack::ast {
 
@@ -35,8 +39,28 @@ public:
       return var.takeError();
     }
     const auto variable = *var;
-    const auto type = variable->getType()->getPointerElementType();
+    // bitfields have no address: apply the operator to the loaded value and
+    // read-modify-write the storage through the member (or element)
+    const auto member = dynamic_cast<const StructMember*>(variable_.get());
+    const auto element = dynamic_cast<const Element*>(variable_.get());
+    const auto bitField =
+        (member && member->isBitField()) || (element && element->isBitField());
+    const auto type = bitField ? variable->getType()
+                               : variable->getType()->getPointerElementType();
     auto op = op_;
+    if (Type::getAtomicValueType(type)) {
+      auto e = expr_->codegen(builder);
+      if (!e) {
+        return e.takeError();
+      }
+      auto value = rmwAtomic(builder, op, variable, *e,
+                             llvm::AtomicOrdering::SequentiallyConsistent,
+                             state_);
+      if (!value) {
+        return value.takeError();
+      }
+      return llvm::Error::success();
+    }
     if (const auto [structType, isStruct] = Type::isStructKind(type);
         isStruct) {
       const auto module = builder.GetInsertBlock()->getModule();
@@ -56,8 +80,9 @@ public:
                      " at line {}",
                      op_, structName, state_.row + 1);
       }
-    } else if (type->isIntegerTy() || type->isFloatingPointTy()) {
-      if (type->isFloatingPointTy() &&
+    } else if (type->getScalarType()->isIntegerTy() ||
+               type->getScalarType()->isFloatingPointTy()) {
+      if (type->getScalarType()->isFloatingPointTy() &&
           (op == "+" || op == "-" || op == "*" || op == "/")) {
         op += "f";
       }
@@ -68,11 +93,16 @@ public:
       if (!e) {
         return e.takeError();
       }
-      const auto expr = *e;
+      const auto [lhs, expr] = splatOperands(
+          builder, bitField ? variable : builder.CreateLoad(variable), *e);
       const auto value = reinterpret_cast<llvm::Value*>(OpsTable[op](
           reinterpret_cast<LLVMBuilderRef>(&builder),
-          reinterpret_cast<LLVMValueRef>(builder.CreateLoad(variable)),
+          reinterpret_cast<LLVMValueRef>(lhs),
           reinterpret_cast<LLVMValueRef>(expr), ""));
+      if (bitField) {
+        return member ? member->assign(builder, value)
+                      : element->assignBitField(builder, value);
+      }
       builder.CreateStore(value, variable);
       return llvm::Error::success();
     }
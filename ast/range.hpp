@@ -22,8 +22,15 @@ namespace whack::ast {
 
 class Range final : public AST {
 public:
-  explicit Range(const mpc_ast_t* const ast)
-      : begin_{getFactor(ast->children[0])} {
+  explicit Range(const mpc_ast_t* const ast) : ast_{ast} {
+    // a bare rangeable (e.g. an array or a generator call) is iterated over
+    if (ast->children_num < 2 ||
+        std::string_view(ast->children[1]->contents) != "..") {
+      begin_ = getFactor(ast);
+      return;
+    }
+    interval_ = true;
+    begin_ = getFactor(ast->children[0]);
     if (ast->children_num > 4) {
       if (getOutermostAstTag(ast->children[2]) == "rangeable") {
         next_ = getFactor(ast->children[2]);
@@ -38,6 +45,10 @@ public:
     }
   }
 
+  /// @brief Whether this is an (integer) interval `begin..[next..][=]end`,
+  /// rather than a value to iterate over
+  inline const bool isInterval() const { return interval_; }
+
   inline auto begin(llvm::IRBuilder<>& builder) const {
     return begin_->codegen(builder);
   }
@@ -52,13 +63,46 @@ public:
     return end_ ? end_->codegen(builder) : error("no end"); //
   }
 
+  inline const bool hasEnd() const { return end_ != nullptr; }
+
   inline const bool endInclusive() const { return endInclusive_; }
 
+  /// @brief Whether evaluating the range again gives the same values (it
+  /// has no calls or side effects) as long as names are unchanged, i.e.
+  /// it does not depend on names
+  bool isInvariant(const ident_list_t& names) const {
+    return isInvariant(ast_, names);
+  }
+
 private:
+  const mpc_ast_t* ast_;
   std::unique_ptr<Factor> begin_;
   std::unique_ptr<Factor> next_;
   std::unique_ptr<Factor> end_;
+  bool interval_{false};
   bool endInclusive_{false};
+
+  static bool isInvariant(const mpc_ast_t* const ast,
+                          const ident_list_t& names) {
+    const std::string_view tag{ast->tag};
+    for (const auto kind : {"funccall", "preop", "postop", "receive",
+                            "newexpr", "fnappend", "closure"}) {
+      if (tag.find(kind) != std::string_view::npos) {
+        return false;
+      }
+    }
+    if (!ast->children_num) {
+      return tag.find("ident") == std::string_view::npos ||
+             std::find(names.begin(), names.end(), ast->contents) ==
+                 names.end();
+    }
+    for (auto i = 0; i < ast->children_num; ++i) {
+      if (!isInvariant(ast->children[i], names)) {
+        return false;
+      }
+    }
+    return true;
+  }
 };
 
 } // end namespace whack::ast
@@ -19,20 +19,102 @@
 #pragma once
 
 #include "ast.hpp"
+#include "type.hpp"
 
 namespace whack::ast {
 
+/// @brief Declares a function of the channel runtime (see runtime.c)
+static llvm::Constant* getChanFunction(llvm::Module* const module,
+                                       llvm::StringRef name) {
+  auto& ctx = module->getContext();
+  const auto ptr = BasicTypes["char"]->getPointerTo(0);
+  const auto i32 = llvm::Type::getInt32Ty(ctx);
+  llvm::FunctionType* type;
+  if (name == "__builtin_chan_make") {
+    type = llvm::FunctionType::get(ptr, {llvm::Type::getInt64Ty(ctx), i32},
+                                   false);
+  } else if (name == "__builtin_chan_select") {
+    // {chan, value, send} cases
+    const auto caseType = llvm::StructType::get(ctx, {ptr, ptr, i32});
+    type = llvm::FunctionType::get(i32, {caseType->getPointerTo(0), i32, i32},
+                                   false);
+  } else if (name == "__builtin_chan_free") {
+    type = llvm::FunctionType::get(BasicTypes["void"], {ptr}, false);
+  } else { // send, recv
+    type = llvm::FunctionType::get(BasicTypes["void"], {ptr, ptr}, false);
+  }
+  const auto func = module->getOrInsertFunction(name, type);
+  if (const auto f = llvm::dyn_cast<llvm::Function>(func)) {
+    f->addFnAttr(llvm::Attribute::NoUnwind);
+  }
+  return func;
+}
+
+/// @brief Returns a temporary (entry block) buffer for a channel element
+static llvm::AllocaInst* getChanBuffer(llvm::IRBuilder<>& builder,
+                                       llvm::Type* const type) {
+  const auto func = builder.GetInsertBlock()->getParent();
+  llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                          func->getEntryBlock().begin()};
+  return entry.CreateAlloca(type, 0, nullptr, "");
+}
+
 class Receive final : public Factor {
 public:
-  explicit Receive(const mpc_ast_t* const ast) : Factor(kReceive) {}
+  explicit Receive(const mpc_ast_t* const ast)
+      : Factor(kReceive), state_{ast->state}, chan_{getFactor(
+                                                  ast->children[1])} {}
 
-  llvm::Expected<llvm::Value*> codegen(llvm::IRBuilder<>&) const final {
-    return error("not implemented");
+  llvm::Expected<llvm::Value*> codegen(llvm::IRBuilder<>& builder) const final {
+    auto chan = getChan(builder, *chan_, state_);
+    if (!chan) {
+      return chan.takeError();
+    }
+    const auto buffer =
+        getChanBuffer(builder, Type::getChanElementType((*chan)->getType()));
+    receive(builder, *chan, buffer);
+    return builder.CreateLoad(buffer);
+  }
+
+  inline const auto& chan() const { return *chan_; }
+
+  /// @brief Evaluates a channel (variable)
+  static llvm::Expected<llvm::Value*>
+  getChan(llvm::IRBuilder<>& builder, const Factor& factor,
+          const mpc_state_t state) {
+    auto ch = factor.codegen(builder);
+    if (!ch) {
+      return ch.takeError();
+    }
+    auto chan = *ch;
+    if (llvm::isa<llvm::AllocaInst>(chan) ||
+        llvm::isa<llvm::GetElementPtrInst>(chan)) {
+      chan = builder.CreateLoad(chan);
+    }
+    if (!Type::getChanElementType(chan->getType())) {
+      return error("type error: expected a channel at line {}",
+                   state.row + 1);
+    }
+    return chan;
+  }
+
+  /// @brief Receives from chan into buffer, blocking while it is empty
+  static void receive(llvm::IRBuilder<>& builder, llvm::Value* const chan,
+                      llvm::Value* const buffer) {
+    const auto module = builder.GetInsertBlock()->getModule();
+    const auto ptr = BasicTypes["char"]->getPointerTo(0);
+    builder.CreateCall(getChanFunction(module, "__builtin_chan_recv"),
+                       {builder.CreateBitCast(chan, ptr),
+                        builder.CreateBitCast(buffer, ptr)});
   }
 
   inline static bool classof(const Factor* const factor) {
     return factor->getKind() == kReceive;
   }
+
+private:
+  const mpc_state_t state_;
+  std::unique_ptr<Factor> chan_;
 };
 
 class ReceiveStmt final : public Stmt {
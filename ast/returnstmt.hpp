@@ -19,6 +19,7 @@
 #pragma once
 
 #include "ast.hpp"
+#include "coroutine.hpp"
 #include "structure.hpp"
 #include <folly/ScopeGuard.h>
 #include <llvm/IR/ValueSymbolTable.h>
@@ -35,6 +36,10 @@ public:
   }
 
   llvm::Error codegen(llvm::IRBuilder<>& builder) const final {
+    // returning from a coroutine completes it (as `co_return` does)
+    if (getCoroutine(builder.GetInsertBlock()->getParent())) {
+      return returnCoroutine(builder, exprList_, state_);
+    }
     if (exprList_.empty()) {
       builder.CreateRetVoid();
     } else if (exprList_.size() == 1) {
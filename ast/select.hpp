@@ -19,19 +19,174 @@
 #pragma once
 
 #include "ast.hpp"
+#include "ident.hpp"
+#include "receive.hpp"
+#include "send.hpp"
 
 namespace whack::ast {
 
+/// @brief Runs one ready case of those given, chosen by the runtime at
+/// random among the ready ones; the default case runs if none is ready
 class Select final : public Stmt {
 public:
-  explicit Select(const mpc_ast_t* const ast) : Stmt(kSelect) {}
+  explicit Select(const mpc_ast_t* const ast)
+      : Stmt(kSelect), state_{ast->state} {
+    // (i ends on the statement of each case)
+    for (auto i = 2; i < ast->children_num - 1; ++i) {
+      const auto ref = ast->children[i];
+      const std::string_view contents{ref->contents};
+      if (contents == "default") {
+        default_ = getStmt(ast->children[i += 2]);
+        continue;
+      }
+      case_t c;
+      if (contents == "let") {
+        c.names = getIdentList(ast->children[i + 1]);
+        i += 3;
+      }
+      if (getInnermostAstTag(ast->children[i]) == "send") {
+        c.send = std::make_unique<Send>(ast->children[i]);
+      } else {
+        c.receive = std::make_unique<Receive>(ast->children[i]);
+      }
+      c.stmt = getStmt(ast->children[i += 2]);
+      cases_.emplace_back(std::move(c));
+    }
+  }
 
   llvm::Error codegen(llvm::IRBuilder<>& builder) const final {
+    auto& ctx = builder.getContext();
+    const auto module = builder.GetInsertBlock()->getModule();
+    const auto func = builder.GetInsertBlock()->getParent();
+    const auto ptr = BasicTypes["char"]->getPointerTo(0);
+    const auto i32 = builder.getInt32Ty();
+    const auto caseType = llvm::StructType::get(ctx, {ptr, ptr, i32});
+    const auto n = static_cast<unsigned>(cases_.size());
+    const auto cases =
+        getChanBuffer(builder, llvm::ArrayType::get(caseType, n));
+
+    small_vector<llvm::Value*> buffers;
+    for (unsigned i = 0; i < n; ++i) {
+      const auto& c = cases_[i];
+      auto chan = Receive::getChan(
+          builder, c.send ? c.send->chan() : c.receive->chan(), state_);
+      if (!chan) {
+        return chan.takeError();
+      }
+      llvm::Value* buffer;
+      if (c.send) {
+        auto buf = c.send->getBuffer(builder, *chan);
+        if (!buf) {
+          return buf.takeError();
+        }
+        buffer = *buf;
+      } else {
+        buffer = getChanBuffer(builder,
+                               Type::getChanElementType((*chan)->getType()));
+      }
+      buffers.push_back(buffer);
+      const auto slot = builder.CreateConstInBoundsGEP2_32(
+          cases->getAllocatedType(), cases, 0, i);
+      builder.CreateStore(builder.CreateBitCast(*chan, ptr),
+                          builder.CreateStructGEP(caseType, slot, 0));
+      builder.CreateStore(builder.CreateBitCast(buffer, ptr),
+                          builder.CreateStructGEP(caseType, slot, 1));
+      builder.CreateStore(builder.getInt32(c.send ? 1 : 0),
+                          builder.CreateStructGEP(caseType, slot, 2));
+    }
+
+    const auto chosen = builder.CreateCall(
+        getChanFunction(module, "__builtin_chan_select"),
+        {builder.CreateConstInBoundsGEP2_32(cases->getAllocatedType(), cases,
+                                            0, 0),
+         builder.getInt32(n), builder.getInt32(default_ ? 1 : 0)});
+    const auto contBlock = llvm::BasicBlock::Create(ctx, "select.end", func);
+    const auto defaultBlock =
+        llvm::BasicBlock::Create(ctx, "select.default", func, contBlock);
+    const auto switcher = builder.CreateSwitch(chosen, defaultBlock, n);
+
+    for (unsigned i = 0; i < n; ++i) {
+      const auto& c = cases_[i];
+      const auto caseBlock =
+          llvm::BasicBlock::Create(ctx, "select.case", func, defaultBlock);
+      switcher->addCase(builder.getInt32(i), caseBlock);
+      builder.SetInsertPoint(caseBlock);
+      // received values are bound to the given names for the case
+      small_vector<llvm::Value*> bindings;
+      if (!c.names.empty()) {
+        if (auto err = bind(builder, buffers[i], c.names, bindings)) {
+          return err;
+        }
+      }
+      if (auto err = c.stmt->codegen(builder)) {
+        return err;
+      }
+      if (!builder.GetInsertBlock()->getTerminator()) {
+        builder.CreateBr(contBlock);
+      }
+      for (const auto binding : bindings) {
+        binding->setName("");
+      }
+    }
+
+    builder.SetInsertPoint(defaultBlock);
+    if (default_) {
+      if (auto err = default_->codegen(builder)) {
+        return err;
+      }
+      if (!builder.GetInsertBlock()->getTerminator()) {
+        builder.CreateBr(contBlock);
+      }
+    } else {
+      // we block until a case is ready
+      builder.CreateUnreachable();
+    }
+    builder.SetInsertPoint(contBlock);
     return llvm::Error::success();
   }
 
   inline static bool classof(const Stmt* const stmt) {
-    return stmt->getKind() == kFuncCall;
+    return stmt->getKind() == kSelect;
+  }
+
+private:
+  struct case_t {
+    ident_list_t names;
+    std::unique_ptr<Send> send;
+    std::unique_ptr<Receive> receive;
+    std::unique_ptr<Stmt> stmt;
+  };
+  const mpc_state_t state_;
+  std::vector<case_t> cases_;
+  std::unique_ptr<Stmt> default_;
+
+  /// @brief Binds a received value (or its fields, for several names)
+  llvm::Error bind(llvm::IRBuilder<>& builder, llvm::Value* const buffer,
+                   const ident_list_t& names,
+                   small_vector<llvm::Value*>& bindings) const {
+    const auto type = buffer->getType()->getPointerElementType();
+    if (names.size() > 1 && (!type->isStructTy() ||
+                             type->getStructNumElements() != names.size())) {
+      return error("invalid number of bindings for received value "
+                   "at line {}",
+                   state_.row + 1);
+    }
+    for (unsigned i = 0; i < names.size(); ++i) {
+      if (names[i] == "_") {
+        continue;
+      }
+      if (auto err = Ident::isUnique(builder, names[i], state_)) {
+        return err;
+      }
+      if (names.size() == 1) {
+        buffer->setName(names[i]);
+        bindings.push_back(buffer);
+      } else {
+        bindings.push_back(tagBinding(
+            builder.CreateStructGEP(type, buffer, i, names[i])));
+      }
+    }
+    return llvm::Error::success();
   }
 };
 
@@ -19,20 +19,78 @@
 #pragma once
 
 #include "ast.hpp"
+#include "receive.hpp"
 
 namespace whack::ast {
 
 class Send final : public Stmt {
 public:
-  explicit Send(const mpc_ast_t* const ast) : Stmt(kSend) {}
+  explicit Send(const mpc_ast_t* const ast)
+      : Stmt(kSend), state_{ast->state}, chan_{getFactor(ast->children[0])},
+        values_{getExprList(ast->children[2])} {}
 
   llvm::Error codegen(llvm::IRBuilder<>& builder) const final {
+    auto chan = Receive::getChan(builder, *chan_, state_);
+    if (!chan) {
+      return chan.takeError();
+    }
+    auto buffer = this->getBuffer(builder, *chan);
+    if (!buffer) {
+      return buffer.takeError();
+    }
+    const auto module = builder.GetInsertBlock()->getModule();
+    const auto ptr = BasicTypes["char"]->getPointerTo(0);
+    builder.CreateCall(getChanFunction(module, "__builtin_chan_send"),
+                       {builder.CreateBitCast(*chan, ptr),
+                        builder.CreateBitCast(*buffer, ptr)});
     return llvm::Error::success();
   }
 
+  inline const auto& chan() const { return *chan_; }
+
+  /// @brief Stores the values to send over chan in a temporary (several
+  /// values are sent as a single struct)
+  llvm::Expected<llvm::AllocaInst*> getBuffer(llvm::IRBuilder<>& builder,
+                                              llvm::Value* const chan) const {
+    const auto type = Type::getChanElementType(chan->getType());
+    small_vector<llvm::Value*> values;
+    for (const auto& expr : values_) {
+      auto v = expr->codegen(builder);
+      if (!v) {
+        return v.takeError();
+      }
+      values.push_back(*v);
+    }
+    llvm::Value* value = values.front();
+    if (values.size() > 1) {
+      small_vector<llvm::Type*> types;
+      for (const auto v : values) {
+        types.push_back(v->getType());
+      }
+      value = llvm::UndefValue::get(
+          llvm::StructType::get(builder.getContext(), types));
+      for (unsigned i = 0; i < values.size(); ++i) {
+        value = builder.CreateInsertValue(value, values[i], i);
+      }
+    }
+    if (value->getType() != type) {
+      return error("type mismatch: cannot send value over channel "
+                   "at line {}",
+                   state_.row + 1);
+    }
+    const auto buffer = getChanBuffer(builder, type);
+    builder.CreateStore(value, buffer);
+    return buffer;
+  }
+
   inline static bool classof(const Stmt* const stmt) {
     return stmt->getKind() == kSend;
   }
+
+private:
+  const mpc_state_t state_;
+  std::unique_ptr<Factor> chan_;
+  small_vector<expr_t> values_;
 };
 
 } // end namespace whack::ast
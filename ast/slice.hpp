@@ -0,0 +1,154 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_SLICE_HPP
+#define WHACK_SLICE_HPP
+
+#pragma once
+
+#include "arraytype.hpp"
+#include "ast.hpp"
+#include "compileropt.hpp"
+#include "dynamicarray.hpp"
+#include "element.hpp"
+
+namespace whack::ast {
+
+/// @brief `xs[a..b]` (`xs[a..=b]`, or `xs[a..]` up to the end) views the
+/// elements a up to b of a fixed or dynamic array, a slice or a string
+/// literal (or, given an end, of the elements a pointer points to). A
+/// slice `[..]T` is a {T* data, int len} value which shares the elements
+/// it views, so slicing and passing slices around copies no elements.
+/// With the `boundscheck` option, slicing traps unless 0 <= a <= b <= len.
+class Slice final : public Factor {
+public:
+  explicit Slice(const mpc_ast_t* const ast)
+      : Factor(kSlice), state_{ast->state}, ast_{ast},
+        begin_{getFactor(ast->children[2])} {
+    const auto idx = ast->children_num - 2;
+    if (getOutermostAstTag(ast->children[idx]) == "rangeable") {
+      end_ = getFactor(ast->children[idx]);
+      endInclusive_ =
+          std::string_view(ast->children[idx - 1]->contents) == "=";
+    }
+  }
+
+  llvm::Expected<llvm::Value*> codegen(llvm::IRBuilder<>& builder) const final {
+    auto e = elements(builder, ast_->children[0]);
+    if (!e) {
+      return e.takeError();
+    }
+    const auto [data, len] = *e;
+    auto b = this->bound(builder, begin_.get());
+    if (!b) {
+      return b.takeError();
+    }
+    const auto begin = *b;
+    llvm::Value* end = len;
+    if (end_) {
+      auto n = this->bound(builder, end_.get());
+      if (!n) {
+        return n.takeError();
+      }
+      end = endInclusive_ ? builder.CreateNSWAdd(*n, Integral::one()) : *n;
+    } else if (!len) {
+      return error("cannot slice through a pointer without an end "
+                   "at line {}",
+                   state_.row + 1);
+    }
+    const auto module = builder.GetInsertBlock()->getModule();
+    if (CompilerOpt::isSet(module, "boundscheck")) {
+      // (as unsigned, so that negative bounds fail too; see checkBounds)
+      if (len) {
+        Element::checkBounds(builder, end,
+                             builder.CreateAdd(len, Integral::one()));
+      }
+      Element::checkBounds(builder, begin,
+                           builder.CreateAdd(end, Integral::one()));
+    }
+    const auto type = data->getType()->getPointerElementType();
+    llvm::Value* slice =
+        llvm::UndefValue::get(ArrayType::getSliceType(module, type));
+    slice = builder.CreateInsertValue(
+        slice, builder.CreateInBoundsGEP(data, begin), 0);
+    return builder.CreateInsertValue(slice, builder.CreateNSWSub(end, begin),
+                                     1);
+  }
+
+  inline static bool classof(const Factor* const factor) {
+    return factor->getKind() == kSlice;
+  }
+
+  /// @brief Returns a pointer to the first of the elements of ref (a fixed
+  /// or dynamic array, slice, string literal or pointer), and their number
+  /// (nullptr through a pointer)
+  static llvm::Expected<std::pair<llvm::Value*, llvm::Value*>>
+  elements(llvm::IRBuilder<>& builder, const mpc_ast_t* const ref) {
+    auto v = getFactor(ref)->codegen(builder);
+    if (!v) {
+      return v.takeError();
+    }
+    const auto value = *v;
+    using elements_t = std::pair<llvm::Value*, llvm::Value*>;
+    if (getInnermostAstTag(ref) == "string") {
+      // (the quotes are not part of the string)
+      const auto len = std::string_view(ref->contents).size() - 2;
+      return elements_t{value, Integral::get(len)};
+    }
+    const auto type = value->getType()->isPointerTy()
+                          ? value->getType()->getPointerElementType()
+                          : value->getType();
+    if (type->isArrayTy() && value->getType()->isPointerTy()) {
+      const auto first = builder.CreateInBoundsGEP(
+          value, {Integral::zero(), Integral::zero()});
+      return elements_t{first, Integral::get(type->getArrayNumElements())};
+    }
+    if (Type::isVariableLengthArray(type) || ArrayType::isSlice(type)) {
+      return elements_t{getDynamicArrayField(builder, value, 0),
+                        getDynamicArrayField(builder, value, 1)};
+    }
+    if (type->isPointerTy() && value->getType()->isPointerTy()) {
+      return elements_t{builder.CreateLoad(value), nullptr};
+    }
+    return error("expected an array, slice or pointer at line {}",
+                 ref->state.row + 1);
+  }
+
+private:
+  const mpc_state_t state_;
+  const mpc_ast_t* const ast_;
+  std::unique_ptr<Factor> begin_;
+  std::unique_ptr<Factor> end_;
+  bool endInclusive_{false};
+
+  /// @brief Returns a bound of the slice as an int
+  llvm::Expected<llvm::Value*> bound(llvm::IRBuilder<>& builder,
+                                     const Factor* const factor) const {
+    auto b = factor->codegen(builder);
+    if (!b) {
+      return b.takeError();
+    }
+    const auto bound = *b;
+    if (!bound->getType()->isIntegerTy()) {
+      return error("expected integer slice bounds at line {}",
+                   state_.row + 1);
+    }
+    return builder.CreateSExtOrTrunc(bound, BasicTypes["int"]);
+  }
+};
+
+} // end namespace whack::ast
+
+#endif // WHACK_SLICE_HPP
@@ -29,6 +29,7 @@
 #include "deferstmt.hpp"
 #include "deletestmt.hpp"
 #include "enumeration.hpp"
+#include "fnappend.hpp"
 #include "forstmt.hpp"
 #include "funccall.hpp"
 #include "ifstmt.hpp"
@@ -71,6 +72,7 @@ static std::unique_ptr<Stmt> getStmt(const mpc_ast_t* const ast) {
   OPT("forstmt", For)
   OPT("assign", Assign)
   OPT("funccall", FuncCallStmt)
+  OPT("fnappend", FnAppendStmt)
   OPT("preop", PreOpStmt)
   OPT("postop", PostOpStmt)
   OPT("match", Match)
@@ -103,21 +103,12 @@ public:
     auto func = llvm::Function::Create(type, llvm::Function::ExternalLinkage,
                                        name, module);
     func->arg_begin()[0].setName("this");
-    func->addParamAttr(0, llvm::Attribute::Nest);
-    if (!mutatesMembers_) {
-      func->addParamAttr(0, llvm::Attribute::ReadOnly);
-    }
 
     if (args_) {
       const auto names = args_->names();
       for (size_t i = 0; i < names.size(); ++i) {
         func->arg_begin()[i + 1].setName(names[i]);
       }
-      for (size_t i = 0; i < func->arg_size() - 1; ++i) {
-        if (!args_->arg(i).mut) {
-          func->addParamAttr(i + 1, llvm::Attribute::ReadOnly);
-        }
-      }
     }
 
     if (!body_) {
@@ -138,6 +129,16 @@ public:
     if (!built) {
       return built.takeError();
     }
+    // (constructors and destructors write to their members)
+    if (auto err = addThisAttributes(*built,
+                                     mutatesMembers_ || funcName_ == "__ctor" ||
+                                         funcName_ == "__dtor",
+                                     state_)) {
+      return err;
+    }
+    if (args_) {
+      return args_->addAttributes(*built, 1, state_);
+    }
     return llvm::Error::success();
   }
 
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "ast.hpp"
+#include "atomic.hpp"
 #include "metadata.hpp"
 #include "type.hpp"
 #include <llvm/IR/ValueSymbolTable.h>
@@ -31,6 +32,34 @@ public:
       : Factor(kStructMember), ast_{ast} {}
 
   llvm::Expected<llvm::Value*> codegen(llvm::IRBuilder<>& builder) const final {
+    auto member = this->callee(builder);
+    if (!member) {
+      return member.takeError();
+    }
+    const auto [value, thiz] = *member;
+    if (bitField_) {
+      return loadBitField(builder, value, bitField_.value());
+    }
+    if (!thiz) {
+      return value;
+    }
+    // the member function escapes as a closure binding `this` (interface
+    // functions, from vtables, take their data as environment)
+    const auto func = llvm::dyn_cast<llvm::Function>(value);
+    const auto bound = func && !func->isVarArg()
+                           ? bindClosure(builder, func, thiz)
+                           : makeClosure(builder, value, thiz);
+    bound->setName(thiz->getName().str() + "." +
+                   value->getName().rsplit("::").second.str());
+    return bound;
+  }
+
+  using callee_t = std::pair<llvm::Value*, llvm::Value*>;
+
+  /// @brief Resolves the member without binding member functions, returning
+  /// the member function and its `this` value (or the field and nullptr)
+  llvm::Expected<callee_t> callee(llvm::IRBuilder<>& builder) const {
+    bitField_.reset();
     const auto func = builder.GetInsertBlock()->getParent();
     const auto symTable = func->getValueSymbolTable();
     auto extracted = symTable->lookup(ast_->children[0]->contents);
@@ -62,39 +91,179 @@ public:
       }
 
       const auto structName = type->getStructName();
+      if (structName.startswith("interface::")) {
+        // we call interface functions through the vtable, passing data
+        const auto vtableName = "vtable::" + structName.substr(11).str();
+        const auto idx = getIndex(module, vtableName, member);
+        if (!idx) {
+          return error("`{}` is not a function for interface `{}` "
+                       "at line {}",
+                       member, structName.substr(11).str(),
+                       memberRef->state.row + 1);
+        }
+        if (i != ast_->children_num - 1) {
+          return error("cannot access a member of interface function `{}` "
+                       "at line {}",
+                       member, memberRef->state.row + 1);
+        }
+        if (extracted->getType()->isPointerTy()) {
+          extracted = builder.CreateLoad(extracted);
+        }
+        const auto data = builder.CreateExtractValue(extracted, 0);
+        const auto vtable = builder.CreateExtractValue(extracted, 1);
+        const auto slot = builder.CreateStructGEP(
+            vtable->getType()->getPointerElementType(), vtable, idx.value(),
+            "");
+        const auto func = builder.CreateLoad(slot, member);
+        // we tag vtable loads for devirtualization
+        auto& ctx = module.getContext();
+        func->setMetadata(
+            "interface.slot",
+            llvm::MDNode::get(
+                ctx, {llvm::MDString::get(ctx, structName.substr(11)),
+                      llvm::ConstantAsMetadata::get(
+                          llvm::ConstantInt::get(BasicTypes["int"], *idx))}));
+        return callee_t{func, data};
+      }
       if (const auto idx = getIndex(module, structName, member)) {
         extracted =
             builder.CreateStructGEP(type, extracted, idx.value(), member);
-        if (structName.startswith("interface::")) { // @todo Necessary??
-          extracted = builder.CreateLoad(extracted);
+        // bitfields resolve to their storage
+        if ((bitField_ = getBitField(module, structName, member)) &&
+            i != ast_->children_num - 1) {
+          return error("cannot access a member of bitfield `{}` "
+                       "for struct `{}` at line {}",
+                       member, structName.str(), memberRef->state.row + 1);
         }
       } else if (const auto memFun = module.getFunction(
                      format("struct::{}::{}", structName.str(), member))) {
-        // assert(ast_->children_num == 3);
-        extracted = bindThis(builder, memFun, extracted);
-        extracted->setName(extracted->getName().str() + "." + member);
+        if (i != ast_->children_num - 1) {
+          return error("cannot access a member of member function `{}` "
+                       "for struct `{}` at line {}",
+                       member, structName.str(), memberRef->state.row + 1);
+        }
+        auto thiz = extracted;
+        if (!thiz->getType()->isPointerTy()) {
+          llvm::IRBuilder<> entry{&func->getEntryBlock(),
+                                  func->getEntryBlock().begin()};
+          const auto alloc = entry.CreateAlloca(type, 0, nullptr, "");
+          builder.CreateStore(thiz, alloc);
+          thiz = alloc;
+        }
+        return callee_t{memFun, thiz};
       } else {
         return error("`{}` is not a field or member function "
                      "for struct `{}` at line {}",
                      member, structName.str(), memberRef->state.row + 1);
       }
     }
-    return extracted;
+    return callee_t{extracted, nullptr};
   }
 
-  inline static llvm::Function* bindThis(llvm::IRBuilder<>& builder,
-                                         llvm::Function* const memFun,
-                                         llvm::Value* const thiz) {
-    const auto newFuncType = llvm::FunctionType::get(
-        memFun->getReturnType(),
-        memFun->getFunctionType()->params().drop_front(), memFun->isVarArg());
-    return bindFirstFuncArgument(builder, memFun, thiz, newFuncType);
+  /// @brief Whether the member last resolved by codegen or callee is a
+  /// bitfield, whose value is loaded rather than addressed
+  bool isBitField() const noexcept { return bitField_.has_value(); }
+
+  /// @brief Stores value to the member (bitfields are read-modify-written)
+  llvm::Error assign(llvm::IRBuilder<>& builder,
+                     llvm::Value* const value) const {
+    auto member = this->callee(builder);
+    if (!member) {
+      return member.takeError();
+    }
+    const auto [ptr, thiz] = *member;
+    if (thiz) {
+      return error("cannot assign to member function at line {}",
+                   ast_->state.row + 1);
+    }
+    if (!bitField_ && getAtomicValueType(ptr) == value->getType()) {
+      storeAtomic(builder, value, ptr);
+      return llvm::Error::success();
+    }
+    const auto type = bitField_ ? bitField_.value().second->getType()
+                                : ptr->getType()->getPointerElementType();
+    if (value->getType() != type) {
+      return error("type mismatch: cannot assign at line {}",
+                   ast_->state.row + 1);
+    }
+    if (bitField_) {
+      storeBitField(builder, ptr, bitField_.value(), value);
+    } else {
+      builder.CreateStore(value, ptr);
+    }
+    return llvm::Error::success();
   }
 
   inline static std::optional<unsigned> getIndex(const llvm::Module& module,
                                                  llvm::StringRef structName,
                                                  llvm::StringRef memberName) {
-    return getMetadataPartIndex(module, "structures", structName, memberName);
+    // the metadata maps members to struct elements (as their "offsets")
+    const auto part =
+        getMetadataPartIndex(module, "structures", structName, memberName);
+    if (!part) {
+      return std::nullopt;
+    }
+    const auto MD = getMetadataOperand(module, "structures", structName);
+    return llvm::mdconst::extract<llvm::ConstantInt>(
+               MD.value()->getOperand(part.value() * 2 + 2))
+        ->getZExtValue();
+  }
+
+  /// @brief A bitfield: its bit offset in its storage, and its width (typed
+  /// as the field)
+  using bitfield_t = std::pair<unsigned, llvm::ConstantInt*>;
+
+  static std::optional<bitfield_t> getBitField(const llvm::Module& module,
+                                               llvm::StringRef structName,
+                                               llvm::StringRef memberName) {
+    for (const auto MD :
+         getAllMetadataOperands(module, "bitfields", structName)) {
+      if (llvm::cast<llvm::MDString>(MD->getOperand(1))->getString() ==
+          memberName) {
+        return bitfield_t{
+            llvm::mdconst::extract<llvm::ConstantInt>(MD->getOperand(2))
+                ->getZExtValue(),
+            llvm::mdconst::extract<llvm::ConstantInt>(MD->getOperand(3))};
+      }
+    }
+    return std::nullopt;
+  }
+
+  /// @brief Loads the bitfield from its storage. Integers are signed, so
+  /// they are sign-extended (by shifting the field to the top of the
+  /// storage, then back down); bools are not.
+  static llvm::Value* loadBitField(llvm::IRBuilder<>& builder,
+                                   llvm::Value* const storage,
+                                   const bitfield_t& bitField) {
+    const auto [offset, bits] = bitField;
+    const auto type = storage->getType()->getPointerElementType();
+    const auto width = type->getIntegerBitWidth();
+    const auto size = static_cast<unsigned>(bits->getZExtValue());
+    auto value = builder.CreateLoad(storage);
+    if (bits->getType()->isIntegerTy(1)) {
+      value = builder.CreateAnd(builder.CreateLShr(value, offset),
+                                llvm::APInt::getLowBitsSet(width, size));
+      return builder.CreateZExtOrTrunc(value, bits->getType());
+    }
+    value = builder.CreateAShr(builder.CreateShl(value, width - offset - size),
+                               width - size);
+    return builder.CreateSExtOrTrunc(value, bits->getType());
+  }
+
+  static void storeBitField(llvm::IRBuilder<>& builder,
+                            llvm::Value* const storage,
+                            const bitfield_t& bitField,
+                            llvm::Value* const value) {
+    const auto [offset, bits] = bitField;
+    const auto type = storage->getType()->getPointerElementType();
+    const auto mask =
+        llvm::APInt::getBitsSet(type->getIntegerBitWidth(), offset,
+                                offset + bits->getZExtValue());
+    const auto field = builder.CreateAnd(
+        builder.CreateShl(builder.CreateZExtOrTrunc(value, type), offset),
+        mask);
+    const auto rest = builder.CreateAnd(builder.CreateLoad(storage), ~mask);
+    builder.CreateStore(builder.CreateOr(rest, field), storage);
   }
 
   inline static bool classof(const Factor* const factor) {
@@ -103,6 +272,7 @@ public:
 
 private:
   const mpc_ast_t* const ast_;
+  mutable std::optional<bitfield_t> bitField_;
 };
 
 } // end namespace whack::ast
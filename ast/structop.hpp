@@ -143,10 +143,6 @@ public:
     auto func = llvm::Function::Create(type, llvm::Function::ExternalLinkage,
                                        funcName, module);
     func->arg_begin()[0].setName("this");
-    func->addParamAttr(0, llvm::Attribute::Nest);
-    if (!mutatesMembers_) {
-      func->addParamAttr(0, llvm::Attribute::ReadOnly);
-    }
 
     if (argsOrTypeList_) {
       if (argsOrTypeList_->index() == 0) { // args
@@ -168,6 +164,13 @@ public:
     if (!built) {
       return built.takeError();
     }
+    if (auto err = addThisAttributes(*built, mutatesMembers_, state_)) {
+      return err;
+    }
+    if (argsOrTypeList_ && argsOrTypeList_->index() == 0) { // args
+      return std::get<Args>(*argsOrTypeList_)
+          .addAttributes(*built, 1, state_);
+    }
     return llvm::Error::success();
   }
 
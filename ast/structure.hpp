@@ -21,6 +21,7 @@
 #include "ast.hpp"
 #include "declassign.hpp"
 #include "tags.hpp"
+#include "type.hpp"
 #include <llvm/IR/MDBuilder.h>
 
 namespace whack::ast {
@@ -32,7 +33,12 @@ public:
   explicit Structure(const mpc_ast_t* const ast)
       : state_{ast->state}, name_{ast->children[1]->contents} {
     const auto& def = ast->children[2];
-    for (auto i = 2; i < def->children_num - 1; ++i) {
+    auto i = 2;
+    if (getInnermostAstTag(def->children[1]) == "tags") {
+      tags_.emplace(def->children[1]);
+      ++i;
+    }
+    for (; i < def->children_num - 1; ++i) {
       const auto& ref = def->children[i];
       if (getInnermostAstTag(ref) == "tags") {
         members_.emplace_back(std::pair{std::optional{Tags{ref}},
@@ -43,10 +49,44 @@ public:
     }
   }
 
+  // Fields are laid out in declaration order (or by decreasing alignment
+  // with @reorder), each run of @bits fields sharing an integer. Explicit
+  // padding precedes over-aligned fields, and a zero-sized vector array
+  // raises the alignment of over-aligned structs. The "structures" metadata
+  // maps fields to struct elements.
   llvm::Error codegen(llvm::Module* const module) const {
-    auto structure = llvm::StructType::create(module->getContext(), name_);
-    small_vector<llvm::Type*> fields;
+    auto& ctx = module->getContext();
+    auto structure = llvm::StructType::create(ctx, name_);
+    auto l = getLayout(module, tags_);
+    if (!l) {
+      return l.takeError();
+    }
+    const auto layout = *l;
+    if (layout.bits) {
+      return error("tag `bits` is not applicable to struct `{}` at line {}",
+                   name_, state_.row + 1);
+    }
+    if (layout.soa && (layout.packed || layout.align)) {
+      return error("cannot use layout tags with tag `soa` for struct `{}` "
+                   "at line {}",
+                   name_, state_.row + 1);
+    }
+    if (layout.packed && layout.align) {
+      return error("cannot use tags `packed` and `align` together for "
+                   "struct `{}` at line {}",
+                   name_, state_.row + 1);
+    }
+
+    struct unit_t {
+      llvm::Type* type;
+      uint64_t align;
+      small_vector<llvm::StringRef> names;
+      uint64_t bits;
+    };
+    small_vector<unit_t> units;
     small_vector<llvm::StringRef> fieldNames;
+    small_vector<std::tuple<llvm::StringRef, uint64_t, llvm::ConstantInt*>>
+        bitFields;
     for (const auto& [tags, decl] : members_) {
       if (!decl.initializers().empty()) {
         warning("member initializers ignored in struct "
@@ -54,41 +94,209 @@ public:
                 "instead to assign values to fields)",
                 name_, state_.row + 1);
       }
-      // @todo Use tags
       auto type = decl.type(module);
       if (!type) {
         return type.takeError();
       }
+      auto f = getLayout(module, tags);
+      if (!f) {
+        return f.takeError();
+      }
+      const auto field = *f;
+      if (field.packed || field.reorder || field.soa) {
+        return error("tags `packed`, `reorder` and `soa` are not applicable "
+                     "to fields of struct `{}` at line {}",
+                     name_, state_.row + 1);
+      }
+      if (layout.soa && (field.align || field.bits)) {
+        return error("cannot use layout tags with tag `soa` for struct `{}` "
+                     "at line {}",
+                     name_, state_.row + 1);
+      }
+      if (field.align && (layout.packed || field.bits)) {
+        return error("cannot align packed fields of struct `{}` at line {}",
+                     name_, state_.row + 1);
+      }
       for (const auto& var : decl.variables()) {
         fieldNames.push_back(var);
-        fields.push_back(*type);
+        if (!field.bits) {
+          units.push_back({*type, field.align, {var}, 0});
+          continue;
+        }
+        if (!(*type)->isIntegerTy() ||
+            field.bits > (*type)->getIntegerBitWidth()) {
+          return error("invalid width for bitfield `{}` of struct `{}` "
+                       "at line {}",
+                       var, name_, state_.row + 1);
+        }
+        // bitfields share the integer of the preceding run of bitfields
+        if (units.empty() || !units.back().bits ||
+            units.back().bits + field.bits > 64) {
+          units.push_back({nullptr, 0, {}, 0});
+        }
+        auto& unit = units.back();
+        bitFields.emplace_back(
+            var, unit.bits,
+            llvm::ConstantInt::get(llvm::cast<llvm::IntegerType>(*type),
+                                   field.bits));
+        unit.names.push_back(var);
+        unit.bits += field.bits;
+      }
+    }
+
+    for (auto& unit : units) {
+      if (unit.bits) {
+        unit.type = llvm::Type::getIntNTy(
+            ctx, std::max<uint64_t>(8, llvm::PowerOf2Ceil(unit.bits)));
+      }
+    }
+    const auto alignOf = [&](const unit_t& unit) {
+      return std::max<uint64_t>(unit.align,
+                                Type::getAlignment(module, unit.type));
+    };
+    if (layout.reorder) {
+      // decreasing alignment leaves the least padding
+      std::stable_sort(units.begin(), units.end(),
+                       [&](const auto& a, const auto& b) {
+                         return alignOf(a) > alignOf(b);
+                       });
+    }
+
+    small_vector<llvm::Type*> fields;
+    llvm::StringMap<unsigned> elements;
+    uint64_t offset = 0;
+    uint64_t structAlign = layout.align;
+    uint64_t naturalAlign = 1;
+    for (const auto& unit : units) {
+      const auto natural = Type::getAlignment(module, unit.type);
+      const auto align = layout.packed ? 1 : alignOf(unit);
+      if (align > natural) {
+        if (const auto padding = llvm::alignTo(offset, align) - offset) {
+          fields.push_back(llvm::ArrayType::get(BasicTypes["char"], padding));
+        }
       }
+      offset = llvm::alignTo(offset, align) +
+               Type::getAllocSize(module, unit.type);
+      for (const auto& name : unit.names) {
+        elements[name] = fields.size();
+      }
+      fields.push_back(unit.type);
+      structAlign = std::max<uint64_t>(structAlign, align);
+      naturalAlign = std::max<uint64_t>(naturalAlign, natural);
+    }
+    if (!layout.packed && structAlign > naturalAlign) {
+      fields.insert(fields.begin(),
+                    llvm::ArrayType::get(
+                        llvm::VectorType::get(BasicTypes["char"], structAlign),
+                        0));
+      for (auto& element : elements) {
+        ++element.second;
+      }
+    }
+
+    small_vector<unsigned> indices;
+    for (const auto& name : fieldNames) {
+      indices.push_back(elements[name]);
     }
-    addMetadata(module, name_, fieldNames);
-    structure->setBody(fields);
+    addMetadata(module, name_, fieldNames, "structures", indices);
+    for (const auto& [name, bitOffset, bits] : bitFields) {
+      module->getOrInsertNamedMetadata("bitfields")
+          ->addOperand(llvm::MDNode::get(
+              ctx, {llvm::MDString::get(ctx, name_),
+                    llvm::MDString::get(ctx, name),
+                    llvm::ConstantAsMetadata::get(
+                        llvm::ConstantInt::get(BasicTypes["int"], bitOffset)),
+                    llvm::ConstantAsMetadata::get(bits)}));
+    }
+    if (layout.soa) {
+      module->getOrInsertNamedMetadata("soa")->addOperand(
+          llvm::MDNode::get(ctx, llvm::MDString::get(ctx, name_)));
+    }
+    structure->setBody(fields, layout.packed);
     return llvm::Error::success();
   }
 
   const auto& name() const { return name_; }
 
+  // fields map to their index in the struct, unless indices are given
   template <typename T>
   static void addMetadata(llvm::Module* const module, llvm::StringRef name,
-                          const small_vector<T>& fields) {
+                          const small_vector<T>& fields,
+                          llvm::StringRef metadataName = "structures",
+                          llvm::ArrayRef<unsigned> indices = llvm::None) {
     std::vector<std::pair<llvm::MDNode*, uint64_t>> metadata;
     llvm::MDBuilder MDBuilder{module->getContext()};
     for (const auto& field : fields) {
       const auto MD =
           reinterpret_cast<llvm::MDNode*>(MDBuilder.createString(field));
-      metadata.emplace_back(std::pair{MD, metadata.size()});
+      const auto idx = metadata.size();
+      metadata.emplace_back(
+          std::pair{MD, indices.empty() ? idx : indices[idx]});
     }
     const auto structMD = MDBuilder.createTBAAStructTypeNode(name, metadata);
-    module->getOrInsertNamedMetadata("structures")->addOperand(structMD);
+    module->getOrInsertNamedMetadata(metadataName)->addOperand(structMD);
   }
 
 private:
   const mpc_state_t state_;
   const std::string name_;
+  std::optional<Tags> tags_;
   std::vector<member_t> members_;
+
+  struct layout_t {
+    bool packed{false};
+    bool reorder{false};
+    bool soa{false};
+    uint64_t align{0};
+    uint64_t bits{0};
+  };
+
+  // reads the layout tags @packed, @reorder, @soa, @align(N) and @bits(N)
+  llvm::Expected<layout_t> getLayout(llvm::Module* const module,
+                                     const std::optional<Tags>& tags) const {
+    layout_t layout;
+    if (!tags) {
+      return layout;
+    }
+    llvm::IRBuilder<> builder{module->getContext()};
+    for (const auto& [name, args] : tags.value().get()) {
+      if (name.index() == 0) { // <scoperes>
+        return error("tag not implemented for struct `{}` at line {}", name_,
+                     state_.row + 1);
+      }
+      const auto& tag = std::get<Ident>(name).name();
+      if (tag == "packed" || tag == "reorder" || tag == "soa") {
+        (tag == "packed" ? layout.packed
+                         : tag == "reorder" ? layout.reorder : layout.soa) =
+            true;
+        continue;
+      }
+      if (tag != "align" && tag != "bits") {
+        return error("tag `{}` not implemented for struct `{}` at line {}",
+                     tag.str(), name_, state_.row + 1);
+      }
+      if (!args || args.value().size() != 1) {
+        return error("tag `{}` expects a single argument at line {}",
+                     tag.str(), state_.row + 1);
+      }
+      auto v = args.value().front()->codegen(builder);
+      if (!v) {
+        return v.takeError();
+      }
+      const auto value = llvm::dyn_cast<llvm::ConstantInt>(*v);
+      if (!value || value->isNegative() || value->isZero()) {
+        return error("expected a positive constant for tag `{}` at line {}",
+                     tag.str(), state_.row + 1);
+      }
+      (tag == "align" ? layout.align : layout.bits) = value->getZExtValue();
+    }
+    if (layout.align && !llvm::isPowerOf2_64(layout.align)) {
+      return error("alignment must be a power of 2 for struct `{}` "
+                   "at line {}",
+                   name_, state_.row + 1);
+    }
+    return layout;
+  }
 };
 
 class StructureStmt final : public Stmt {
@@ -19,7 +19,10 @@
 #pragma once
 
 #include "ast.hpp"
+#include "atomic.hpp"
+#include "metadata.hpp"
 #include "type.hpp"
+#include "vector.hpp"
 
 namespace whack::ast {
 
@@ -44,18 +47,21 @@ public:
     }
     auto lhs = *init;
     if (others_.empty()) {
+      if (isVariable(lhs) && getAtomicValueType(lhs)) {
+        return loadAtomic(builder, lhs);
+      }
       if (const auto [_, isStruct] = Type::isStructKind(lhs->getType());
           isStruct) {
         return lhs;
       }
-      if (llvm::isa<llvm::AllocaInst>(lhs)) {
+      if (isVariable(lhs)) {
         return builder.CreateLoad(lhs);
       }
       return lhs;
     }
 
-    if (llvm::isa<llvm::AllocaInst>(lhs)) {
-      lhs = builder.CreateLoad(lhs);
+    if (isVariable(lhs)) {
+      lhs = load(builder, lhs);
     }
 
     const auto module = builder.GetInsertBlock()->getModule();
@@ -65,9 +71,8 @@ public:
         return val.takeError();
       }
       auto value = *val;
-      const auto rhs = llvm::isa<llvm::AllocaInst>(value)
-                           ? builder.CreateLoad(value)
-                           : value;
+      auto rhs = isVariable(value) ? load(builder, value) : value;
+      std::tie(lhs, rhs) = splatOperands(builder, lhs, rhs);
       const auto [structType, isStruct] = Type::isStructKind(lhs->getType());
       if (isStruct) {
         const auto structName = structType->getStructName().str();
@@ -81,7 +86,7 @@ public:
         }
       } else {
         auto ops = op;
-        if (lhs->getType()->isFloatingPointTy() &&
+        if (lhs->getType()->getScalarType()->isFloatingPointTy() &&
             (op == "+" || op == "-" || op == "*" || op == "/")) {
           ops += "f";
         }
@@ -102,6 +107,20 @@ private:
   using factor_t = std::unique_ptr<Factor>;
   factor_t initial_;
   std::vector<std::pair<std::string, factor_t>> others_;
+
+  // (atomics are loaded atomically)
+  inline static llvm::Value* load(llvm::IRBuilder<>& builder,
+                                  llvm::Value* const variable) {
+    return getAtomicValueType(variable) ? loadAtomic(builder, variable)
+                                        : builder.CreateLoad(variable);
+  }
+
+  // @todo: Delegate to Loader, based on use context?
+  inline static bool isVariable(const llvm::Value* const value) {
+    // (bindings and captured by reference variables are addressed through
+    // a GEP)
+    return llvm::isa<llvm::AllocaInst>(value) || isBinding(value);
+  }
 };
 
 } // end namespace whack::ast
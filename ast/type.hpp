@@ -51,10 +51,27 @@ public:
            std::string_view(ast_->children[0]->contents) == "mut";
   }
 
+  inline bool isReference() const {
+    return ast_->children_num &&
+           std::string_view(
+               ast_->children[ast_->children_num - 1]->contents) == "&";
+  }
+
   llvm::Expected<llvm::Type*> codegen(const llvm::Module* const module) const {
     auto ref = ast_;
     if (this->isMutable()) {
       ref = ast_->children[1];
+    } else if (this->isReference()) {
+      ref = ast_->children[0];
+    }
+
+    // references are (non-null) pointers to the referenced type
+    if (this->isReference()) {
+      auto type = getType(ref, module);
+      if (!type) {
+        return type.takeError();
+      }
+      return (*type)->getPointerTo(0);
     }
 
     const auto tag = getInnermostAstTag(ref);
@@ -70,6 +87,61 @@ public:
       return ArrayType{ref}.codegen(module);
     }
 
+    if (tag == "chantype") {
+      auto list = getTypeList(ref->children[2], module);
+      if (!list) {
+        return list.takeError();
+      }
+      const auto& types = list->first;
+      return getChanType(module, types.size() == 1
+                                     ? types.front()
+                                     : llvm::StructType::get(
+                                           module->getContext(), types));
+    }
+
+    if (tag == "atomictype") {
+      auto type = getType(ref->children[2], module);
+      if (!type) {
+        return type.takeError();
+      }
+      // (wider types would not be lock-free)
+      const auto& dataLayout = module->getDataLayout();
+      if (!(*type)->isPointerTy() &&
+          (!(*type)->isIntegerTy() ||
+           dataLayout.getTypeSizeInBits(*type) > 64)) {
+        return error("type error: atomic<T> expects an integer (of up to 64 "
+                     "bits), bool or pointer type at line {}",
+                     ast_->state.row + 1);
+      }
+      // atomic accesses must be naturally aligned, which the storage of T
+      // (on the stack, in structures or arrays) only is if the target
+      // aligns T to its size
+      const auto atomic = getAtomicType(module, *type);
+      const auto storage = atomic->getElementType(0);
+      if (dataLayout.getABITypeAlignment(storage) !=
+          dataLayout.getTypeAllocSize(storage)) {
+        return error("type error: atomic<T> is not naturally aligned on "
+                     "the target at line {}",
+                     ast_->state.row + 1);
+      }
+      return atomic;
+    }
+
+    if (tag == "vectype") {
+      const Integral lanes{ref->children[2]};
+      auto type = getType(ref->children[4], module);
+      if (!type) {
+        return type.takeError();
+      }
+      if ((!(*type)->isIntegerTy() && !(*type)->isFloatingPointTy()) ||
+          lanes.value() <= 0) {
+        return error("type error: vec<N, T> expects a number of lanes and an "
+                     "integer, bool or floating point type at line {}",
+                     ast_->state.row + 1);
+      }
+      return llvm::VectorType::get(*type, lanes.value());
+    }
+
     if (tag == "ident") {
       if (auto type = getFromTypeName(module, ref->contents)) {
         return type.value();
@@ -119,11 +191,86 @@ public:
     return module->getDataLayout().getTypeSizeInBits(type);
   }
 
+  inline static auto getAllocSize(const llvm::Module* const module,
+                                  llvm::Type* const type) {
+    return module->getDataLayout().getTypeAllocSize(type);
+  }
+
+  inline static auto getAlignment(const llvm::Module* const module,
+                                  llvm::Type* const type) {
+    return module->getDataLayout().getABITypeAlignment(type);
+  }
+
+  /// @brief chan<T> is a pointer to a runtime channel. Its pointee
+  /// `chan<T>` is never accessed; it only records the element type
+  inline static llvm::PointerType*
+  getChanType(const llvm::Module* const module, llvm::Type* const element) {
+    return getHandleType(module, "chan", element);
+  }
+
+  /// @brief Returns the element type of a channel type, if type is one
+  inline static llvm::Type* getChanElementType(const llvm::Type* const type) {
+    return getHandleElementType(type, "chan");
+  }
+
+  /// @brief The future of an `async` call is a pointer to a runtime task,
+  /// whose pointee `future<T>` records the result type (as chan<T> does)
+  inline static llvm::PointerType*
+  getFutureType(const llvm::Module* const module, llvm::Type* const result) {
+    return getHandleType(module, "future", result);
+  }
+
+  /// @brief Returns the result type of a future type, if type is one
+  inline static llvm::Type* getFutureResultType(const llvm::Type* const type) {
+    return getHandleElementType(type, "future");
+  }
+
+  /// @brief Calling a coroutine returns a pointer to its frame, whose
+  /// pointee `coro<T>` records the type of its values (yielded or returned)
+  inline static llvm::PointerType*
+  getCoroType(const llvm::Module* const module, llvm::Type* const value) {
+    return getHandleType(module, "coro", value);
+  }
+
+  /// @brief Returns the value type of a coroutine type, if type is one
+  inline static llvm::Type* getCoroValueType(const llvm::Type* const type) {
+    return getHandleElementType(type, "coro");
+  }
+
+  /// @brief atomic<T> is a named struct holding T (bools are held as
+  /// bytes), which marks accesses to it as atomic (see atomic.hpp)
+  static llvm::StructType* getAtomicType(const llvm::Module* const module,
+                                         llvm::Type* const value) {
+    std::string name;
+    llvm::raw_string_ostream os{name};
+    os << "atomic<";
+    value->print(os);
+    os << '>';
+    if (const auto type = module->getTypeByName(os.str())) {
+      return type;
+    }
+    return llvm::StructType::create(
+        module->getContext(),
+        {value->isIntegerTy(1) ? BasicTypes["char"] : value}, name);
+  }
+
+  /// @brief Returns T if type is atomic<T>
+  static llvm::Type* getAtomicValueType(const llvm::Type* const type) {
+    const auto atomic = llvm::dyn_cast<llvm::StructType>(type);
+    if (!atomic || atomic->isLiteral() ||
+        !atomic->getName().startswith("atomic<")) {
+      return nullptr;
+    }
+    if (atomic->getName() == "atomic<i1>") {
+      return BasicTypes["bool"];
+    }
+    return atomic->getElementType(0);
+  }
+
+  /// @brief Whether type is the header of a dynamic array []T
   inline static bool isVariableLengthArray(const llvm::Type* const type) {
-    return type->isStructTy() && type->getStructNumElements() == 2 &&
-           type->getStructElementType(0) == BasicTypes["int"] &&
-           type->getStructElementType(1)->isArrayTy() &&
-           type->getStructElementType(1)->getArrayNumElements() == 0;
+    const auto array = llvm::dyn_cast<llvm::StructType>(type);
+    return array && !array->isLiteral() && array->getName().startswith("[]");
   }
 
   static std::pair<llvm::Type*, bool> isStructKind(llvm::Type* const type) {
@@ -142,6 +289,54 @@ public:
             type->getPointerElementType()->isFunctionTy());
   }
 
+  /// @brief Closure values are {code, env} pairs, where code receives
+  /// the (opaque) environment pointer as its first argument.
+  static llvm::StructType* getClosureType(llvm::FunctionType* const type) {
+    small_vector<llvm::Type*> params{BasicTypes["char"]->getPointerTo(0)};
+    params.append(type->param_begin(), type->param_end());
+    const auto code = llvm::FunctionType::get(type->getReturnType(), params,
+                                              type->isVarArg());
+    return llvm::StructType::get(type->getContext(),
+                                 {code->getPointerTo(0), params.front()});
+  }
+
+  static bool isClosureType(const llvm::Type* const type) {
+    if (!type->isStructTy() || type->getStructNumElements() != 2 ||
+        !llvm::cast<llvm::StructType>(type)->isLiteral()) {
+      return false;
+    }
+    const auto env = type->getStructElementType(1);
+    const auto code = type->getStructElementType(0);
+    if (env != BasicTypes["char"]->getPointerTo(0) || !code->isPointerTy() ||
+        !code->getPointerElementType()->isFunctionTy()) {
+      return false;
+    }
+    const auto codeType =
+        llvm::cast<llvm::FunctionType>(code->getPointerElementType());
+    return codeType->getNumParams() && codeType->getParamType(0) == env;
+  }
+
+  /// @brief Returns the function type a closure type is callable as
+  static llvm::FunctionType* getClosureFuncType(const llvm::Type* const type) {
+    assert(isClosureType(type));
+    const auto code = llvm::cast<llvm::FunctionType>(
+        type->getStructElementType(0)->getPointerElementType());
+    return llvm::FunctionType::get(code->getReturnType(),
+                                   code->params().drop_front(),
+                                   code->isVarArg());
+  }
+
+  /// @brief Replaces the underlying function type of type by its closure type
+  static llvm::Type* getClosureKind(llvm::Type* const type) {
+    if (type->isPointerTy()) {
+      return getClosureKind(type->getPointerElementType())->getPointerTo(0);
+    }
+    if (type->isFunctionTy()) {
+      return getClosureType(llvm::cast<llvm::FunctionType>(type));
+    }
+    return type;
+  }
+
   static llvm::Expected<llvm::Type*>
   getPointerType(const mpc_ast_t* const ast, const llvm::Module* const module) {
     auto tp = getType(ast->children[0], module);
@@ -190,6 +385,44 @@ public:
 
 private:
   const mpc_ast_t* const ast_;
+
+  /// @brief Returns a pointer to the (never accessed) named struct
+  /// `kind<T>`, which records T as a zero-sized array (or no body for void)
+  static llvm::PointerType* getHandleType(const llvm::Module* const module,
+                                          llvm::StringRef kind,
+                                          llvm::Type* const type) {
+    std::string name;
+    llvm::raw_string_ostream os{name};
+    os << kind << '<';
+    type->print(os);
+    os << '>';
+    auto handle = module->getTypeByName(os.str());
+    if (!handle) {
+      handle = type->isVoidTy()
+                   ? llvm::StructType::create(module->getContext(), name)
+                   : llvm::StructType::create(
+                         module->getContext(),
+                         {llvm::ArrayType::get(type, 0)}, name);
+    }
+    return handle->getPointerTo(0);
+  }
+
+  static llvm::Type* getHandleElementType(const llvm::Type* const type,
+                                          llvm::StringRef kind) {
+    if (!type->isPointerTy()) {
+      return nullptr;
+    }
+    const auto handle =
+        llvm::dyn_cast<llvm::StructType>(type->getPointerElementType());
+    if (!handle || handle->isLiteral() ||
+        !handle->getName().startswith((kind + "<").str())) {
+      return nullptr;
+    }
+    if (handle->isOpaque()) {
+      return BasicTypes["void"];
+    }
+    return handle->getElementType(0)->getArrayElementType();
+  }
 };
 
 static llvm::Expected<llvm::Type*> getType(const mpc_ast_t* const ast,
@@ -198,11 +431,8 @@ static llvm::Expected<llvm::Type*> getType(const mpc_ast_t* const ast,
   if (!tp) {
     return tp.takeError();
   }
-  const auto type = *tp;
-  if (Type::getUnderlyingType(type)->isFunctionTy()) {
-    return type->getPointerTo(0);
-  }
-  return type;
+  // function types denote closure values
+  return Type::getClosureKind(*tp);
 }
 
 } // end namespace whack::ast
@@ -0,0 +1,365 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_VECTOR_HPP
+#define WHACK_VECTOR_HPP
+
+#pragma once
+
+#include "ast.hpp"
+#include "compileropt.hpp"
+#include "element.hpp"
+#include "integral.hpp"
+#include "slice.hpp"
+
+// vec<N, T> is an LLVM vector of N lanes of T. Arithmetic, bitwise and shift
+// operators apply lane-wise (a scalar T operand is broadcast), and
+// comparisons yield masks (vec<N, bool>). The builtins
+//   vec::splat(x, N), vec::extract(v, i), vec::insert(v, i, x),
+//   vec::shuffle(a, b, i0, i1...) (constant lane indices into a and b),
+//   vec::select(mask, a, b),
+//   vec::sum/min/max/umin/umax/and/or/xor(v) (horizontal reductions; umin
+//     and umax compare integer lanes as unsigned, as min and max do masks),
+//   vec::load(xs, i, N), vec::store(xs, i, v) and their aligned_ variants
+//     (from and to element i of an array, slice or pointer; with the
+//     `boundscheck` option, they trap unless elements i to i + N - 1 are
+//     those of an array or slice)
+// are lowered inline.
+
+namespace whack::ast {
+
+/// @brief Broadcasts a scalar operand of an operation on a vector to the
+/// vector's type (e.g. for `v * x`)
+static std::pair<llvm::Value*, llvm::Value*>
+splatOperands(llvm::IRBuilder<>& builder, llvm::Value* const lhs,
+              llvm::Value* const rhs) {
+  const auto lhsType = lhs->getType();
+  const auto rhsType = rhs->getType();
+  if (lhsType->isVectorTy() && lhsType->getVectorElementType() == rhsType) {
+    return {lhs, builder.CreateVectorSplat(lhsType->getVectorNumElements(),
+                                           rhs)};
+  }
+  if (rhsType->isVectorTy() && rhsType->getVectorElementType() == lhsType) {
+    return {builder.CreateVectorSplat(rhsType->getVectorNumElements(), lhs),
+            rhs};
+  }
+  return {lhs, rhs};
+}
+
+/// @brief Combines the lanes of v with op, halving the vector (by
+/// shuffles) while its width is even
+static llvm::Value* reduceVector(
+    llvm::IRBuilder<>& builder, llvm::Value* v,
+    const std::function<llvm::Value*(llvm::Value*, llvm::Value*)>& op) {
+  auto lanes = v->getType()->getVectorNumElements();
+  while (lanes > 1 && lanes % 2 == 0) {
+    lanes /= 2;
+    small_vector<uint32_t> low, high;
+    for (uint32_t i = 0; i < lanes; ++i) {
+      low.push_back(i);
+      high.push_back(i + lanes);
+    }
+    const auto undef = llvm::UndefValue::get(v->getType());
+    v = op(builder.CreateShuffleVector(v, undef, low),
+           builder.CreateShuffleVector(v, undef, high));
+  }
+  auto result = builder.CreateExtractElement(v, uint64_t{0});
+  for (uint64_t i = 1; i < lanes; ++i) {
+    result = op(result, builder.CreateExtractElement(v, i));
+  }
+  return result;
+}
+
+/// @brief Emits a call to a vec:: builtin (the funccall ast)
+static llvm::Expected<llvm::Value*> callVector(llvm::IRBuilder<>& builder,
+                                               const mpc_ast_t* const ast) {
+  const auto state = ast->state;
+  const llvm::StringRef name = ast->children[0]->children[2]->contents;
+  const auto module = builder.GetInsertBlock()->getModule();
+  const auto& dataLayout = module->getDataLayout();
+  small_vector<const mpc_ast_t*> args;
+  if (ast->children_num == 4) {
+    const auto list = ast->children[2];
+    if (getOutermostAstTag(list) == "exprlist") {
+      for (auto i = 0; i < list->children_num; i += 2) {
+        args.push_back(list->children[i]);
+      }
+    } else {
+      args.push_back(list);
+    }
+  }
+  const auto expect = [&](const size_t num) -> llvm::Error {
+    if (args.size() != num) {
+      return error("vec::{} expects {} argument(s) at line {}", name.str(),
+                   num, state.row + 1);
+    }
+    return llvm::Error::success();
+  };
+  const auto value = [&](const size_t i) -> llvm::Expected<llvm::Value*> {
+    auto v = getExpressionValue(args[i])->codegen(builder);
+    if (!v) {
+      return v.takeError();
+    }
+    const auto val = *v;
+    if (llvm::isa<llvm::AllocaInst>(val) ||
+        llvm::isa<llvm::GetElementPtrInst>(val)) {
+      return builder.CreateLoad(val);
+    }
+    return val;
+  };
+  // (lane counts and shuffle indices are integer literals)
+  const auto constant = [&](const size_t i) -> std::optional<uint32_t> {
+    if (getInnermostAstTag(args[i]) != "integral" ||
+        Integral{args[i]}.value() < 0) {
+      return std::nullopt;
+    }
+    return Integral{args[i]}.value();
+  };
+  const auto vectorError = [&]() {
+    return error("vec::{} expects a vector at line {}", name.str(),
+                 state.row + 1);
+  };
+  // (traps unless 0 <= index and index + lanes <= len, see checkBounds)
+  const auto checkLanes = [&](llvm::Value* const len, llvm::Value* const index,
+                              const unsigned lanes) {
+    if (!len || !CompilerOpt::isSet(module, "boundscheck")) {
+      return;
+    }
+    const auto first = Element::checkBounds(builder, index, len);
+    Element::checkBounds(
+        builder,
+        builder.CreateAdd(first, llvm::ConstantInt::get(first->getType(),
+                                                        lanes - 1)),
+        len);
+  };
+
+  if (name == "splat") {
+    if (auto err = expect(2)) {
+      return std::move(err);
+    }
+    auto x = value(0);
+    if (!x) {
+      return x.takeError();
+    }
+    const auto lanes = constant(1);
+    if (!lanes || !lanes.value()) {
+      return error("vec::splat expects a number of lanes at line {}",
+                   state.row + 1);
+    }
+    return builder.CreateVectorSplat(lanes.value(), *x);
+  }
+
+  if (name == "load" || name == "aligned_load") {
+    if (auto err = expect(3)) {
+      return std::move(err);
+    }
+    auto e = Slice::elements(builder, args[0]);
+    if (!e) {
+      return e.takeError();
+    }
+    auto i = value(1);
+    if (!i) {
+      return i.takeError();
+    }
+    const auto lanes = constant(2);
+    if (!lanes || !lanes.value()) {
+      return error("vec::{} expects a number of lanes at line {}", name.str(),
+                   state.row + 1);
+    }
+    if (!(*i)->getType()->isIntegerTy()) {
+      return error("vec::{} expects an integer index at line {}", name.str(),
+                   state.row + 1);
+    }
+    checkLanes(e->second, *i, lanes.value());
+    const auto data = e->first;
+    const auto type = llvm::VectorType::get(
+        data->getType()->getPointerElementType(), lanes.value());
+    const auto ptr = builder.CreateBitCast(builder.CreateInBoundsGEP(data, *i),
+                                           type->getPointerTo(0));
+    const auto load = builder.CreateLoad(ptr);
+    load->setAlignment(dataLayout.getABITypeAlignment(
+        name == "load" ? type->getElementType() : type));
+    return load;
+  }
+
+  if (name == "store" || name == "aligned_store") {
+    if (auto err = expect(3)) {
+      return std::move(err);
+    }
+    auto e = Slice::elements(builder, args[0]);
+    if (!e) {
+      return e.takeError();
+    }
+    auto i = value(1);
+    if (!i) {
+      return i.takeError();
+    }
+    auto v = value(2);
+    if (!v) {
+      return v.takeError();
+    }
+    const auto data = e->first;
+    const auto type = (*v)->getType();
+    if (!type->isVectorTy() || type->getVectorElementType() !=
+                                   data->getType()->getPointerElementType()) {
+      return error("type mismatch: cannot store vector at line {}",
+                   state.row + 1);
+    }
+    if (!(*i)->getType()->isIntegerTy()) {
+      return error("vec::{} expects an integer index at line {}", name.str(),
+                   state.row + 1);
+    }
+    checkLanes(e->second, *i, type->getVectorNumElements());
+    const auto ptr = builder.CreateBitCast(builder.CreateInBoundsGEP(data, *i),
+                                           type->getPointerTo(0));
+    const auto store = builder.CreateStore(*v, ptr);
+    store->setAlignment(dataLayout.getABITypeAlignment(
+        name == "store" ? type->getVectorElementType() : type));
+    return store;
+  }
+
+  if (name == "shuffle") {
+    if (args.size() < 3) {
+      return error("vec::shuffle expects two vectors and lane indices "
+                   "at line {}",
+                   state.row + 1);
+    }
+    auto a = value(0);
+    if (!a) {
+      return a.takeError();
+    }
+    auto b = value(1);
+    if (!b) {
+      return b.takeError();
+    }
+    const auto type = (*a)->getType();
+    if (!type->isVectorTy() || (*b)->getType() != type) {
+      return vectorError();
+    }
+    small_vector<uint32_t> mask;
+    for (size_t i = 2; i < args.size(); ++i) {
+      const auto lane = constant(i);
+      if (!lane || lane.value() >= 2 * type->getVectorNumElements()) {
+        return error("vec::shuffle expects constant lane indices (into both "
+                     "vectors) at line {}",
+                     state.row + 1);
+      }
+      mask.push_back(lane.value());
+    }
+    return builder.CreateShuffleVector(*a, *b, mask);
+  }
+
+  if (name == "select") {
+    if (auto err = expect(3)) {
+      return std::move(err);
+    }
+    small_vector<llvm::Value*> values;
+    for (size_t i = 0; i < 3; ++i) {
+      auto v = value(i);
+      if (!v) {
+        return v.takeError();
+      }
+      values.push_back(*v);
+    }
+    const auto type = values[1]->getType();
+    const auto mask = values[0]->getType();
+    if (!type->isVectorTy() || values[2]->getType() != type ||
+        !mask->isVectorTy() || !mask->getVectorElementType()->isIntegerTy(1) ||
+        mask->getVectorNumElements() != type->getVectorNumElements()) {
+      return error("vec::select expects a mask and two vectors (of as many "
+                   "lanes) at line {}",
+                   state.row + 1);
+    }
+    return builder.CreateSelect(values[0], values[1], values[2]);
+  }
+
+  if (name == "extract" || name == "insert") {
+    if (auto err = expect(name == "extract" ? 2 : 3)) {
+      return std::move(err);
+    }
+    auto v = value(0);
+    if (!v) {
+      return v.takeError();
+    }
+    auto i = value(1);
+    if (!i) {
+      return i.takeError();
+    }
+    if (!(*v)->getType()->isVectorTy() || !(*i)->getType()->isIntegerTy()) {
+      return vectorError();
+    }
+    if (name == "extract") {
+      return builder.CreateExtractElement(*v, *i);
+    }
+    auto x = value(2);
+    if (!x) {
+      return x.takeError();
+    }
+    if ((*x)->getType() != (*v)->getType()->getVectorElementType()) {
+      return error("type mismatch: cannot insert lane at line {}",
+                   state.row + 1);
+    }
+    return builder.CreateInsertElement(*v, *x, *i);
+  }
+
+  // horizontal reductions
+  const auto isMinMax = name == "min" || name == "max" || name == "umin" ||
+                        name == "umax";
+  if (name != "sum" && !isMinMax && name != "and" && name != "or" &&
+      name != "xor") {
+    return error("`vec::{}` is not a vector builtin at line {}", name.str(),
+                 state.row + 1);
+  }
+  if (auto err = expect(1)) {
+    return std::move(err);
+  }
+  auto v = value(0);
+  if (!v) {
+    return v.takeError();
+  }
+  const auto type = (*v)->getType();
+  if (!type->isVectorTy()) {
+    return vectorError();
+  }
+  const auto real = type->getVectorElementType()->isFloatingPointTy();
+  if (real && name != "sum" && name != "min" && name != "max") {
+    return error("invalid reduction vec::{} of floating point lanes "
+                 "at line {}",
+                 name.str(), state.row + 1);
+  }
+  return reduceVector(builder, *v, [&](llvm::Value* a, llvm::Value* b) {
+    if (name == "sum") {
+      return real ? builder.CreateFAdd(a, b) : builder.CreateAdd(a, b);
+    }
+    if (isMinMax) {
+      // (integers are signed, but masks are ordered false < true)
+      const auto isUnsigned = name.startswith("u") ||
+                              type->getVectorElementType()->isIntegerTy(1);
+      const auto lt = real         ? builder.CreateFCmpOLT(a, b)
+                      : isUnsigned ? builder.CreateICmpULT(a, b)
+                                   : builder.CreateICmpSLT(a, b);
+      return name.endswith("min") ? builder.CreateSelect(lt, a, b)
+                                  : builder.CreateSelect(lt, b, a);
+    }
+    if (name == "and") {
+      return builder.CreateAnd(a, b);
+    }
+    return name == "or" ? builder.CreateOr(a, b) : builder.CreateXor(a, b);
+  });
+}
+
+} // end namespace whack::ast
+
+#endif // WHACK_VECTOR_HPP
@@ -19,20 +19,40 @@
 #pragma once
 
 #include "ast.hpp"
+#include "coroutine.hpp"
 
 namespace whack::ast {
 
 class YieldStmt final : public Stmt {
 public:
-  explicit YieldStmt(const mpc_ast_t* const ast) : Stmt(kYield) {}
+  explicit YieldStmt(const mpc_ast_t* const ast)
+      : Stmt(kYield), state_{ast->state} {
+    if (ast->children_num > 2) {
+      exprList_ = getExprList(ast->children[1]);
+    }
+  }
 
   llvm::Error codegen(llvm::IRBuilder<>& builder) const final {
+    if (!getCoroutine(builder.GetInsertBlock()->getParent())) {
+      return error("cannot yield outside of a coroutine at line {}",
+                   state_.row + 1);
+    }
+    if (!exprList_.empty()) {
+      if (auto err = setCoroutineValue(builder, exprList_, state_)) {
+        return err;
+      }
+    }
+    yieldCoroutine(builder);
     return llvm::Error::success();
   }
 
   inline static bool classof(const Stmt* const stmt) {
     return stmt->getKind() == kYield;
   }
+
+private:
+  const mpc_state_t state_;
+  small_vector<expr_t> exprList_;
 };
 
 } // end namespace whack::ast
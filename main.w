@@ -121,6 +121,35 @@ func testDynamicMemoryAndClosures() {
 	testClosureExample2();
 }
 
+func testForIn() {
+	[4]int xs{1, 2, 3, 4};
+	[4]int ys{x * 2 for x in xs};
+	let mut s = 0;
+	for x in xs {
+		s += x;
+	}
+	for y in ys if y > 2 {
+		s += y;
+	}
+	if s == 28 {
+		_ = puts("testForIn: pass");
+	}
+}
+
+type Greeting class {
+	Quiet();
+	Loud(char*);
+}
+
+func testMatchNiche() {
+	// (a null pointer niche: the tag is selected from the pointer)
+	let g = Greeting::Loud("testMatchNiche: pass");
+	match (g) {
+		Greeting::Quiet: _ = puts("testMatchNiche: fail");
+		Greeting::Loud(msg): _ = puts(msg);
+	}
+}
+
 func main(int argc, char** argv) int {
 	Rest r;
 	r.msg = "Morty C137";
@@ -132,6 +161,8 @@ func main(int argc, char** argv) int {
 	apply("Bar!");
 	testDynamicMemoryAndClosures();
 	ttt();
+	testForIn();
+	testMatchNiche();
 	r.ama(12);
 	return ret;
 }
@@ -20,7 +20,13 @@
 
 #include "ast/asts.hpp"
 #include "parser.hpp"
+#include "pass/boundscheck.hpp"
 #include "pass/ctor.hpp"
+#include "pass/devirt.hpp"
+#include "pass/internalize.hpp"
+#include "pass/nonnull.hpp"
+#include "pass/sret.hpp"
+#include "pass/tbaa.hpp"
 #include <folly/Memory.h>
 #include <folly/ScopeGuard.h>
 #include <llvm-c/Initialization.h>
@@ -28,14 +34,19 @@
 #include <llvm-c/Support.h>
 #include <llvm-c/Target.h>
 #include <llvm-c/TargetMachine.h>
+#include <llvm/Analysis/TypeBasedAliasAnalysis.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/Program.h>
+#include <llvm/Transforms/Coroutines.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/FunctionAttrs.h>
 #include <llvm/Transforms/InstCombine/InstCombine.h>
 #include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Vectorize.h>
 
 namespace whack {
 
@@ -107,8 +118,14 @@ public:
       return ret;
     } else {
       if (llvm::sys::findProgramByName("gcc")) {
+#ifdef _WIN32
+        constexpr static auto execFileExt = ".exe";
+#else
+        constexpr static auto execFileExt = "";
+#endif
         const auto command =
-            format("gcc runtime.o {} -o {}.exe", objFileName, execFileName);
+            format("gcc -pthread runtime.o {} -o {}{}", objFileName,
+                   execFileName, execFileExt);
         system(command.c_str());
         return llvm::Error::success(); // @todo llvm::sys::ExecuteAndWait
       } else {
@@ -123,7 +140,7 @@ private:
   llvm::LLVMContext context_;
   llvm::legacy::PassManager passManager_;
   ast_t ast_;
-  LLVMTargetMachineRef targetMachine_;
+  LLVMTargetMachineRef targetMachine_{nullptr};
   small_vector<ast::CompilerOpt> compilerOpts_;
   std::unique_ptr<ast::ModuleDecl> moduleDecl_;
   small_vector<ast::ModuleUse> moduleUse_;
@@ -159,7 +176,45 @@ private:
       assert(targetMachine_);
     }
 
+    passManager_.add(llvm::createTypeBasedAAWrapperPass());
+    // coroutines are marked (pre-split) before anything else touches them
+    passManager_.add(llvm::createCoroEarlyPass());
+    // calls check the pointers they pass as references (or `this`)
+    passManager_.add(new pass::NonNull);
     passManager_.add(new pass::Ctor);
+    // large aggregates are returned (and passed) through memory
+    passManager_.add(new pass::SRet);
+    passManager_.add(new pass::TBAA);
+    // we call non-escaping closures directly
+    passManager_.add(llvm::createSROAPass());
+    passManager_.add(llvm::createInstructionCombiningPass());
+    passManager_.add(new pass::Devirt);
+    passManager_.add(llvm::createInstructionCombiningPass());
+    // unexported symbols are internal (and dropped if unused)
+    passManager_.add(new pass::Internalize);
+    passManager_.add(llvm::createGlobalDCEPass());
+    // infers nocapture/readonly parameters (after devirtualization)
+    passManager_.add(llvm::createPostOrderFunctionAttrsLegacyPass());
+    // the inliner favours internal functions with a single call site, which
+    // are then deleted
+    passManager_.add(llvm::createFunctionInliningPass());
+    // coroutines are split (callees first), so that callers inline their
+    // ramps and their frames may be elided
+    passManager_.add(llvm::createCoroSplitPass());
+    passManager_.add(llvm::createCoroElidePass());
+    passManager_.add(llvm::createCoroCleanupPass());
+    // loops (e.g. of list comprehensions) are vectorized once their bodies
+    // are inlined; they are emitted with their exit test at the top
+    passManager_.add(llvm::createSROAPass());
+    passManager_.add(llvm::createCFGSimplificationPass());
+    // bounds checks which cannot fail are dropped (before loops are
+    // rotated), so that they do not keep loops from being vectorized
+    passManager_.add(llvm::createEarlyCSEPass());
+    passManager_.add(new pass::BoundsCheck);
+    passManager_.add(llvm::createCFGSimplificationPass());
+    passManager_.add(llvm::createLoopRotatePass());
+    passManager_.add(llvm::createLoopVectorizePass());
+    passManager_.add(llvm::createInstructionCombiningPass());
   }
 
   void traverse(mpc_ast_t* const ast) {
@@ -197,10 +252,22 @@ private:
     if (!ast_) {
       return error("Invalid AST");
     }
+    if (!targetMachine_) {
+      return error("no target machine for the host");
+    }
     auto module = std::make_unique<llvm::Module>(moduleDecl_->name(), context_);
     // @todo Link in loaded modules; mangle their symbols according to exports
     // table?
     auto mod = module.get();
+    // types are sized and aligned for the target (rather than by LLVM's
+    // default layout, under which e.g. i64 is only 4-aligned) before we
+    // generate code
+    const auto dataLayout = LLVMCreateTargetDataLayout(targetMachine_);
+    SCOPE_EXIT { LLVMDisposeTargetData(dataLayout); };
+    LLVMSetModuleDataLayout(llvm::wrap(mod), dataLayout);
+    const auto targetTriple = LLVMGetTargetMachineTriple(targetMachine_);
+    SCOPE_EXIT { LLVMDisposeMessage(targetTriple); };
+    LLVMSetTarget(llvm::wrap(mod), targetTriple);
     llvm::Error err = llvm::Error::success();
     for (const auto& elem : elements_) {
       std::visit(
@@ -215,6 +282,9 @@ private:
     if (err) {
       return err;
     }
+    for (const auto& exports : exports_) {
+      exports.codegen(mod);
+    }
     passManager_.run(*module);
     return module;
   }
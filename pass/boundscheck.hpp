@@ -0,0 +1,234 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_PASSES_BOUNDSCHECK_HPP
+#define WHACK_PASSES_BOUNDSCHECK_HPP
+
+#pragma once
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpander.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/InitializePasses.h>
+#include <llvm/Pass.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+
+namespace whack::pass {
+
+/// @brief Removes the bounds checks of the `boundscheck` option (branches
+/// tagged "boundscheck" on `index ult len`, see ast::Element) which cannot
+/// fail:
+///  - those ScalarEvolution proves (e.g. of constant indices),
+///  - those dominated by a test of the same index and length, i.e. an
+///    earlier check or the test of a loop counting up from 0 to len, and
+///  - those of indices stepping up through a loop on every iteration,
+///    which become a single check (of the first and last index) before the
+///    loop. A loop which would go out of bounds still traps, if earlier.
+/// Runs before loops are rotated, while their tests dominate their bodies.
+/// For instance, with the option set, in
+///   for i in 1..n { s += xs[i]; }
+/// the check of xs[i] becomes one of xs[1] and xs[n - 1] before the loop
+/// (and the loop keeps no "boundscheck" branch), while that of
+///   for i in 0..len(xs) { s += xs[i]; }
+/// is implied by the test of the loop and removed.
+struct BoundsCheck : public llvm::FunctionPass {
+  char pid = getpid();
+  BoundsCheck() : llvm::FunctionPass(pid) {
+    auto& registry = *llvm::PassRegistry::getPassRegistry();
+    llvm::initializeDominatorTreeWrapperPassPass(registry);
+    llvm::initializeLoopInfoWrapperPassPass(registry);
+    llvm::initializeScalarEvolutionWrapperPassPass(registry);
+  }
+
+  void getAnalysisUsage(llvm::AnalysisUsage& usage) const override {
+    usage.addRequired<llvm::DominatorTreeWrapperPass>();
+    usage.addRequired<llvm::LoopInfoWrapperPass>();
+    usage.addRequired<llvm::ScalarEvolutionWrapperPass>();
+  }
+
+  bool runOnFunction(llvm::Function& func) override {
+    // (the tests of removed checks still hold where they dominate)
+    llvm::DenseMap<const llvm::BranchInst*, llvm::ICmpInst*> tests;
+    llvm::SmallVector<llvm::BranchInst*, 8> checks;
+    for (auto& block : func) {
+      const auto br = llvm::dyn_cast<llvm::BranchInst>(block.getTerminator());
+      if (!br || !br->isConditional() || !br->getMetadata("boundscheck")) {
+        continue;
+      }
+      if (const auto test =
+              llvm::dyn_cast<llvm::ICmpInst>(br->getCondition())) {
+        tests[br] = test;
+        checks.push_back(br);
+      }
+    }
+    if (checks.empty()) {
+      return false;
+    }
+
+    auto& DT = getAnalysis<llvm::DominatorTreeWrapperPass>().getDomTree();
+    auto& LI = getAnalysis<llvm::LoopInfoWrapperPass>().getLoopInfo();
+    auto& SE = getAnalysis<llvm::ScalarEvolutionWrapperPass>().getSE();
+    bool changed = false;
+    for (const auto check : checks) {
+      const auto test = tests[check];
+      const auto index = SE.getSCEV(test->getOperand(0));
+      const auto len = SE.getSCEV(test->getOperand(1));
+      if (SE.isKnownPredicate(llvm::ICmpInst::ICMP_ULT, index, len) ||
+          isDominated(check, tests, DT, SE) ||
+          hoist(check, index, len, DT, LI, SE)) {
+        check->setCondition(llvm::ConstantInt::getTrue(func.getContext()));
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+private:
+  /// @brief Whether the check is dominated by (the true edge of) a test
+  /// which implies it
+  static bool isDominated(
+      const llvm::BranchInst* const check,
+      const llvm::DenseMap<const llvm::BranchInst*, llvm::ICmpInst*>& tests,
+      llvm::DominatorTree& DT, llvm::ScalarEvolution& SE) {
+    const auto test = tests.lookup(check);
+    const auto index = SE.getSCEV(test->getOperand(0));
+    const auto len = SE.getSCEV(test->getOperand(1));
+    const auto block = check->getParent();
+    if (!DT.getNode(block)) {
+      return false;
+    }
+    for (auto node = DT.getNode(block)->getIDom(); node;
+         node = node->getIDom()) {
+      const auto br =
+          llvm::dyn_cast<llvm::BranchInst>(node->getBlock()->getTerminator());
+      if (!br || !br->isConditional() ||
+          br->getSuccessor(0) == br->getSuccessor(1)) {
+        continue;
+      }
+      auto cmp = tests.lookup(br);
+      if (!cmp) {
+        cmp = llvm::dyn_cast<llvm::ICmpInst>(br->getCondition());
+      }
+      if (!cmp || SE.getSCEV(cmp->getOperand(0)) != index ||
+          SE.getSCEV(cmp->getOperand(1)) != len ||
+          !DT.dominates(llvm::BasicBlockEdge{br->getParent(),
+                                             br->getSuccessor(0)},
+                        block)) {
+        continue;
+      }
+      const auto pred = cmp->getPredicate();
+      if (pred == llvm::ICmpInst::ICMP_ULT ||
+          (pred == llvm::ICmpInst::ICMP_SLT && SE.isKnownNonNegative(index))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// @brief Whether block only traps (e.g. that of the bounds checks of a
+  /// function, or of its allocation checks)
+  static bool isTrap(const llvm::BasicBlock* const block) {
+    return llvm::isa<llvm::UnreachableInst>(block->getTerminator());
+  }
+
+  /// @brief Replaces the check of a loop-invariant index, or of one
+  /// stepping up through the loop, by one of its first and last values
+  /// before the loop (len must be loop-invariant). The loop must only exit
+  /// from its header, other than to traps (as checks do), and the check
+  /// must be made on every iteration (i.e. as many times as the loop's
+  /// backedge is taken when it exits from its header).
+  static bool hoist(const llvm::BranchInst* const check,
+                    const llvm::SCEV* const index, const llvm::SCEV* const len,
+                    llvm::DominatorTree& DT, llvm::LoopInfo& LI,
+                    llvm::ScalarEvolution& SE) {
+    const auto loop = LI.getLoopFor(check->getParent());
+    if (!loop || !loop->getLoopPreheader() || !loop->getLoopLatch() ||
+        !DT.dominates(check->getParent(), loop->getLoopLatch()) ||
+        !SE.isLoopInvariant(len, loop)) {
+      return false;
+    }
+    const auto header = loop->getHeader();
+    llvm::SmallVector<llvm::BasicBlock*, 8> exiting;
+    loop->getExitingBlocks(exiting);
+    bool exitsFromHeader = false;
+    for (const auto block : exiting) {
+      for (const auto succ : llvm::successors(block)) {
+        if (loop->contains(succ) || isTrap(succ)) {
+          continue;
+        }
+        if (block != header) {
+          return false; // (e.g. break)
+        }
+        exitsFromHeader = true;
+      }
+    }
+    if (!exitsFromHeader) {
+      return false;
+    }
+    const auto count = SE.getExitCount(loop, header);
+    if (llvm::isa<llvm::SCEVCouldNotCompute>(count) ||
+        !llvm::isSafeToExpand(count, SE)) {
+      return false;
+    }
+    auto first = index;
+    auto last = index;
+    if (!SE.isLoopInvariant(index, loop)) {
+      const auto rec = llvm::dyn_cast<llvm::SCEVAddRecExpr>(index);
+      if (!rec || rec->getLoop() != loop || !rec->isAffine() ||
+          !rec->getNoWrapFlags(llvm::SCEV::FlagNSW) ||
+          !SE.isKnownNonNegative(rec->getStepRecurrence(SE))) {
+        return false;
+      }
+      first = rec->getStart();
+      last = rec->evaluateAtIteration(
+          SE.getMinusSCEV(count, SE.getOne(count->getType())), SE);
+    }
+    if (!llvm::isSafeToExpand(first, SE) || !llvm::isSafeToExpand(last, SE)) {
+      return false;
+    }
+
+    const auto preheader = loop->getLoopPreheader();
+    const auto module = preheader->getModule();
+    llvm::SCEVExpander expander{SE, module->getDataLayout(), "boundscheck"};
+    const auto before = preheader->getTerminator();
+    const auto type = index->getType();
+    const auto n = expander.expandCodeFor(count, count->getType(), before);
+    const auto begin = expander.expandCodeFor(first, type, before);
+    const auto end = expander.expandCodeFor(last, type, before);
+    const auto bound = expander.expandCodeFor(len, type, before);
+    llvm::IRBuilder<> builder{before};
+    // (the loop may not run at all)
+    const auto fails = builder.CreateAnd(
+        builder.CreateICmpNE(n, llvm::ConstantInt::get(n->getType(), 0)),
+        builder.CreateOr(builder.CreateICmpUGE(begin, bound),
+                         builder.CreateICmpUGE(end, bound)));
+    const auto trap = llvm::SplitBlockAndInsertIfThen(fails, before, true,
+                                                      nullptr, &DT, &LI);
+    llvm::IRBuilder<>{trap}.CreateCall(
+        llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::trap));
+    return true;
+  }
+};
+
+} // namespace whack::pass
+
+#endif // WHACK_PASSES_BOUNDSCHECK_HPP
@@ -0,0 +1,201 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_PASSES_DEVIRT_HPP
+#define WHACK_PASSES_DEVIRT_HPP
+
+#pragma once
+
+#include "../ast/metadata.hpp"
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+
+namespace whack::pass {
+
+/// @brief Devirtualizes calls through interface vtables (tagged with
+/// "interface.slot" metadata). Calls become direct if the vtable is known,
+/// or if a single implementation of the function exists in the module;
+/// otherwise we speculate on the dominant implementation (the one used by
+/// most casts) behind a guard.
+struct Devirt : public llvm::ModulePass {
+  char pid = getpid();
+  Devirt() : llvm::ModulePass(pid) {}
+  bool runOnModule(llvm::Module& module) override {
+    small_vector<llvm::CallInst*> calls;
+    for (auto& func : module) {
+      for (auto& block : func) {
+        for (auto& inst : block) {
+          if (const auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+            const auto load =
+                llvm::dyn_cast<llvm::LoadInst>(call->getCalledValue());
+            if (load && load->getMetadata("interface.slot")) {
+              calls.push_back(call);
+            }
+          }
+        }
+      }
+    }
+
+    bool changed = false;
+    for (const auto call : calls) {
+      const auto load = llvm::cast<llvm::LoadInst>(call->getCalledValue());
+      const auto MD = load->getMetadata("interface.slot");
+      const auto interface =
+          llvm::cast<llvm::MDString>(MD->getOperand(0))->getString();
+      const auto idx = llvm::mdconst::extract<llvm::ConstantInt>(
+                           MD->getOperand(1))
+                           ->getZExtValue();
+
+      // the vtable flows in from a (local) cast
+      if (const auto vtable = getVTable(load)) {
+        call->setCalledFunction(getSlot(vtable, idx, call));
+        changed = true;
+        continue;
+      }
+
+      // we count the uses (casts) of each implementation
+      small_vector<std::pair<llvm::Constant*, size_t>> impls;
+      for (const auto vtable : getVTables(module, interface)) {
+        const auto slot = getSlot(vtable, idx, call);
+        const auto uses = static_cast<size_t>(vtable->getNumUses());
+        const auto it = std::find_if(
+            impls.begin(), impls.end(),
+            [slot](const auto& impl) { return impl.first == slot; });
+        if (it == impls.end()) {
+          impls.emplace_back(slot, uses);
+        } else {
+          it->second += uses;
+        }
+      }
+      if (impls.empty()) {
+        continue;
+      }
+      if (impls.size() == 1) {
+        call->setCalledFunction(impls.front().first);
+        changed = true;
+        continue;
+      }
+      const auto dominant = std::max_element(
+          impls.begin(), impls.end(), [](const auto& a, const auto& b) {
+            return a.second < b.second;
+          });
+      speculate(call, dominant->first);
+      changed = true;
+    }
+    return changed;
+  }
+
+private:
+  /// @brief Returns the slot function (as typed by call) of a vtable
+  static llvm::Constant* getSlot(const llvm::GlobalVariable* const vtable,
+                                 const uint64_t idx,
+                                 const llvm::CallInst* const call) {
+    const auto func = vtable->getInitializer()->getAggregateElement(idx);
+    return llvm::ConstantExpr::getBitCast(func->stripPointerCasts(),
+                                          call->getCalledValue()->getType());
+  }
+
+  /// @brief Finds the constant vtable a slot is loaded from, if any
+  static const llvm::GlobalVariable*
+  getVTable(const llvm::LoadInst* const load) {
+    const auto gep =
+        llvm::dyn_cast<llvm::GetElementPtrInst>(load->getPointerOperand());
+    if (!gep) {
+      return nullptr;
+    }
+    const llvm::Value* value = gep->getPointerOperand()->stripPointerCasts();
+    // {data, vtable} interface values are built with insertvalue
+    if (const auto extract = llvm::dyn_cast<llvm::ExtractValueInst>(value)) {
+      auto aggregate = extract->getAggregateOperand();
+      while (const auto insert =
+                 llvm::dyn_cast<llvm::InsertValueInst>(aggregate)) {
+        if (insert->getIndices()[0] == extract->getIndices()[0]) {
+          value = insert->getInsertedValueOperand()->stripPointerCasts();
+          break;
+        }
+        aggregate = insert->getAggregateOperand();
+      }
+    }
+    const auto vtable = llvm::dyn_cast<llvm::GlobalVariable>(value);
+    return vtable && vtable->isConstant() && vtable->hasInitializer()
+               ? vtable
+               : nullptr;
+  }
+
+  /// @brief Collects the vtables (of any type) usable as vtables of
+  /// interface, i.e. those of interface and of interfaces inheriting it
+  static small_vector<llvm::GlobalVariable*>
+  getVTables(llvm::Module& module, llvm::StringRef interface) {
+    const auto names = getFuncNames(module, interface);
+    small_vector<llvm::GlobalVariable*> vtables;
+    for (auto& global : module.globals()) {
+      const auto name = global.getName();
+      if (!name.startswith("vtable::") || !global.hasInitializer()) {
+        continue;
+      }
+      const auto implemented = getFuncNames(module, name.rsplit("::").second);
+      if (names.size() <= implemented.size() &&
+          std::equal(names.begin(), names.end(), implemented.begin())) {
+        vtables.push_back(&global);
+      }
+    }
+    return vtables;
+  }
+
+  static small_vector<llvm::StringRef>
+  getFuncNames(const llvm::Module& module, llvm::StringRef interface) {
+    small_vector<llvm::StringRef> names;
+    if (const auto MD =
+            ast::getMetadataOperand(module, "interfaces", interface)) {
+      for (unsigned i = 1; i < MD.value()->getNumOperands(); i += 2) {
+        const auto funcMD =
+            reinterpret_cast<llvm::MDNode*>(MD.value()->getOperand(i).get());
+        names.push_back(
+            reinterpret_cast<llvm::MDString*>(funcMD->getOperand(2).get())
+                ->getString());
+      }
+    }
+    return names;
+  }
+
+  /// @brief Guards a direct call to func, falling back to the indirect call
+  static void speculate(llvm::CallInst* const call,
+                        llvm::Constant* const func) {
+    llvm::IRBuilder<> builder{call};
+    const auto cond = builder.CreateICmpEQ(call->getCalledValue(), func);
+    llvm::TerminatorInst* thenTerm;
+    llvm::TerminatorInst* elseTerm;
+    llvm::SplitBlockAndInsertIfThenElse(cond, call, &thenTerm, &elseTerm);
+    const auto direct = llvm::cast<llvm::CallInst>(call->clone());
+    direct->setCalledFunction(func);
+    direct->insertBefore(thenTerm);
+    call->moveBefore(elseTerm);
+    if (!call->getType()->isVoidTy()) {
+      builder.SetInsertPoint(&*call->getParent()
+                                   ->getSingleSuccessor()
+                                   ->getFirstInsertionPt());
+      const auto phi = builder.CreatePHI(call->getType(), 2);
+      call->replaceAllUsesWith(phi);
+      phi->addIncoming(direct, direct->getParent());
+      phi->addIncoming(call, call->getParent());
+    }
+  }
+};
+
+} // namespace whack::pass
+
+#endif // WHACK_PASSES_DEVIRT_HPP
@@ -0,0 +1,83 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_PASSES_INTERNALIZE_HPP
+#define WHACK_PASSES_INTERNALIZE_HPP
+
+#pragma once
+
+#include "../ast/metadata.hpp"
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+namespace whack::pass {
+
+/// @brief Whether name is visible outside the module: `main`, symbols
+/// listed in "exports" metadata and the functions of exported structs
+static bool isExported(const llvm::Module& module, llvm::StringRef name) {
+  if (name == "main") {
+    return true;
+  }
+  for (const auto symbol : ast::getMetadataParts<1>(module, "exports")) {
+    if (name == symbol ||
+        name.startswith(format("struct::{}::", symbol.str()))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// @brief Gives symbols which are not exported internal linkage, so that
+/// global DCE and the inliner may drop them. Internal functions only ever
+/// called directly use the fast calling convention.
+struct Internalize : public llvm::ModulePass {
+  char pid = getpid();
+  Internalize() : llvm::ModulePass(pid) {}
+  bool runOnModule(llvm::Module& module) override {
+    bool changed = false;
+    for (auto& func : module) {
+      if (func.isDeclaration() || func.hasLocalLinkage() ||
+          isExported(module, func.getName())) {
+        continue;
+      }
+      func.setLinkage(llvm::Function::InternalLinkage);
+      changed = true;
+      if (func.isVarArg() || func.hasAddressTaken()) {
+        continue;
+      }
+      func.setCallingConv(llvm::CallingConv::Fast);
+      for (const auto user : func.users()) {
+        llvm::cast<llvm::CallInst>(user)->setCallingConv(
+            llvm::CallingConv::Fast);
+      }
+    }
+
+    for (auto& global : module.globals()) {
+      if (global.isDeclaration() || global.hasLocalLinkage() ||
+          global.getName().startswith("llvm.") ||
+          isExported(module, global.getName())) {
+        continue;
+      }
+      global.setLinkage(llvm::GlobalVariable::InternalLinkage);
+      changed = true;
+    }
+    return changed;
+  }
+};
+
+} // namespace whack::pass
+
+#endif // WHACK_PASSES_INTERNALIZE_HPP
@@ -0,0 +1,90 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_PASSES_NONNULL_HPP
+#define WHACK_PASSES_NONNULL_HPP
+
+#pragma once
+
+#include "internalize.hpp"
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+
+namespace whack::pass {
+
+/// @brief References and `this` are non-null and dereferenceable (see
+/// ast::Args::addAttributes). The front end forms them from addressable
+/// values, but other pointers may reach them too (e.g. from `new`, or
+/// through the thunks of function values), so each call checks the
+/// arguments not known to be non-null, trapping on null. Functions which
+/// may be called from elsewhere (whose address is taken, or which are
+/// exported) drop the attributes instead, as their callers are unchecked.
+struct NonNull : public llvm::ModulePass {
+  char pid = getpid();
+  NonNull() : llvm::ModulePass(pid) {}
+  bool runOnModule(llvm::Module& module) override {
+    const auto& dataLayout = module.getDataLayout();
+    llvm::MDBuilder MDBuilder{module.getContext()};
+    bool changed = false;
+    for (auto& func : module) {
+      llvm::SmallVector<unsigned, 4> params;
+      for (unsigned i = 0; i < func.arg_size(); ++i) {
+        if (func.hasParamAttribute(i, llvm::Attribute::NonNull)) {
+          params.push_back(i);
+        }
+      }
+      if (params.empty() || func.isDeclaration()) {
+        continue;
+      }
+      changed = true;
+      if (func.hasAddressTaken() || isExported(module, func.getName())) {
+        for (const auto i : params) {
+          func.removeParamAttr(i, llvm::Attribute::NonNull);
+          func.removeParamAttr(i, llvm::Attribute::Dereferenceable);
+        }
+        continue;
+      }
+      llvm::SmallVector<llvm::CallInst*, 8> calls;
+      for (const auto user : func.users()) {
+        calls.push_back(llvm::cast<llvm::CallInst>(user));
+      }
+      for (const auto call : calls) {
+        for (const auto i : params) {
+          const auto arg = call->getArgOperand(i);
+          if (llvm::isKnownNonZero(arg, dataLayout)) {
+            continue;
+          }
+          const auto fail = llvm::SplitBlockAndInsertIfThen(
+              llvm::IRBuilder<>{call}.CreateIsNull(arg), call,
+              /*Unreachable*/ true, MDBuilder.createBranchWeights(1, 1024));
+          llvm::IRBuilder<>{fail}.CreateCall(
+              llvm::Intrinsic::getDeclaration(&module, llvm::Intrinsic::trap));
+        }
+      }
+    }
+    return changed;
+  }
+};
+
+} // namespace whack::pass
+
+#endif // WHACK_PASSES_NONNULL_HPP
@@ -0,0 +1,355 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_PASSES_SRET_HPP
+#define WHACK_PASSES_SRET_HPP
+
+#pragma once
+
+#include "internalize.hpp"
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/CaptureTracking.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+namespace whack::pass {
+
+/// @brief Passes large aggregates through memory. Functions (only ever
+/// called directly) returning aggregates which do not fit in two registers
+/// return through an `sret` pointer to the caller's destination, and a
+/// returned local is built in place: `return T{...}` and named return
+/// values are never copied. Large by-value parameters of unexported
+/// functions become read-only pointers, and the remaining aggregate copies
+/// are lowered to memcpy.
+struct SRet : public llvm::ModulePass {
+  char pid = getpid();
+  SRet() : llvm::ModulePass(pid) {}
+  bool runOnModule(llvm::Module& module) override {
+    const auto& dataLayout = module.getDataLayout();
+    small_vector<llvm::Function*> funcs;
+    for (auto& func : module) {
+      // (the parameters of coroutines are copied into their frames)
+      if (func.isDeclaration() || func.isVarArg() || func.hasAddressTaken() ||
+          func.hasFnAttribute("coroutine.presplit")) {
+        continue;
+      }
+      const auto type = func.getFunctionType();
+      const auto byRef =
+          !isExported(module, func.getName()) &&
+          std::any_of(type->param_begin(), type->param_end(),
+                      [&](const auto param) {
+                        return isLarge(dataLayout, param);
+                      });
+      if (byRef || isLarge(dataLayout, type->getReturnType())) {
+        funcs.push_back(&func);
+      }
+    }
+    for (const auto func : funcs) {
+      lower(func);
+    }
+
+    bool changed = !funcs.empty();
+    for (auto& func : module) {
+      changed |= lowerCopies(func);
+    }
+    return changed;
+  }
+
+private:
+  static constexpr uint64_t kMaxDirectSize = 16;
+
+  /// @brief Whether type is an aggregate which does not fit in two registers
+  static bool isLarge(const llvm::DataLayout& dataLayout,
+                      llvm::Type* const type) {
+    return type->isAggregateType() && type->isSized() &&
+           dataLayout.getTypeAllocSize(type) > kMaxDirectSize;
+  }
+
+  static void lower(llvm::Function* const func) {
+    const auto module = func->getParent();
+    const auto& dataLayout = module->getDataLayout();
+    auto& ctx = module->getContext();
+    const auto type = func->getFunctionType();
+    const auto returnType = type->getReturnType();
+    const bool sret = isLarge(dataLayout, returnType);
+    const bool exported = isExported(*module, func->getName());
+
+    small_vector<bool> byRef;
+    small_vector<llvm::Type*> params;
+    if (sret) {
+      params.push_back(returnType->getPointerTo(0));
+    }
+    for (const auto param : type->params()) {
+      byRef.push_back(!exported && isLarge(dataLayout, param));
+      params.push_back(byRef.back() ? param->getPointerTo(0) : param);
+    }
+    const auto newFunc = llvm::Function::Create(
+        llvm::FunctionType::get(sret ? llvm::Type::getVoidTy(ctx) : returnType,
+                                params, false),
+        func->getLinkage(), "", module);
+    newFunc->takeName(func);
+    newFunc->setCallingConv(func->getCallingConv());
+
+    // attributes
+    const unsigned shift = sret;
+    const auto attributes = func->getAttributes();
+    for (const auto attr : attributes.getFnAttributes()) {
+      newFunc->addFnAttr(attr);
+    }
+    if (!sret) {
+      for (const auto attr : attributes.getRetAttributes()) {
+        newFunc->addAttribute(llvm::AttributeList::ReturnIndex, attr);
+      }
+    } else {
+      newFunc->addParamAttr(0, llvm::Attribute::StructRet);
+      newFunc->addParamAttr(0, llvm::Attribute::NoAlias);
+      newFunc->addDereferenceableParamAttr(
+          0, dataLayout.getTypeAllocSize(returnType));
+    }
+    for (unsigned i = 0; i < byRef.size(); ++i) {
+      for (const auto attr : attributes.getParamAttributes(i)) {
+        newFunc->addParamAttr(i + shift, attr);
+      }
+      if (byRef[i]) {
+        newFunc->addParamAttr(i + shift, llvm::Attribute::ReadOnly);
+        newFunc->addParamAttr(i + shift, llvm::Attribute::NoCapture);
+        newFunc->addDereferenceableParamAttr(
+            i + shift, dataLayout.getTypeAllocSize(type->getParamType(i)));
+      }
+    }
+
+    // body
+    newFunc->getBasicBlockList().splice(newFunc->begin(),
+                                        func->getBasicBlockList());
+    llvm::IRBuilder<> builder{
+        &*newFunc->getEntryBlock().getFirstInsertionPt()};
+    for (unsigned i = 0; i < byRef.size(); ++i) {
+      const auto oldArg = func->arg_begin() + i;
+      const auto arg = newFunc->arg_begin() + i + shift;
+      if (byRef[i]) {
+        arg->setName(oldArg->getName() + ".ref");
+        oldArg->replaceAllUsesWith(
+            builder.CreateLoad(arg, oldArg->getName()));
+      } else {
+        arg->takeName(oldArg);
+        oldArg->replaceAllUsesWith(arg);
+      }
+    }
+    if (sret) {
+      lowerReturns(newFunc, newFunc->arg_begin());
+    }
+
+    // call sites
+    const small_vector<llvm::User*> users(func->user_begin(),
+                                          func->user_end());
+    for (const auto user : users) {
+      const auto call = llvm::cast<llvm::CallInst>(user);
+      const auto caller = call->getFunction();
+      builder.SetInsertPoint(call);
+      small_vector<llvm::Value*> args;
+      for (unsigned i = 0; i < byRef.size(); ++i) {
+        const auto arg = call->getArgOperand(i);
+        args.push_back(byRef[i] ? getReference(builder, call, arg) : arg);
+      }
+      llvm::Value* dest{nullptr};
+      if (sret) {
+        dest = getDestination(call);
+        // the callee may not read its destination through an argument
+        if (!dest ||
+            std::find(args.begin(), args.end(), dest) != args.end()) {
+          dest = createEntryAlloca(caller, returnType);
+        }
+        args.insert(args.begin(), dest);
+      }
+      const auto newCall = builder.CreateCall(newFunc, args);
+      newCall->setCallingConv(call->getCallingConv());
+      if (!sret) {
+        newCall->takeName(call);
+        call->replaceAllUsesWith(newCall);
+      } else if (!call->use_empty()) {
+        if (call->hasOneUse() && dest == getDestination(call)) {
+          llvm::cast<llvm::Instruction>(*call->user_begin())
+              ->eraseFromParent();
+        } else {
+          call->replaceAllUsesWith(builder.CreateLoad(dest, call->getName()));
+        }
+      }
+      call->eraseFromParent();
+    }
+    func->eraseFromParent();
+  }
+
+  /// @brief Returns through the sret pointer. If every return returns the
+  /// same local, it is built in place (named return value)
+  static void lowerReturns(llvm::Function* const func, llvm::Argument* sret) {
+    sret->setName("sret");
+    small_vector<llvm::ReturnInst*> returns;
+    for (auto& block : *func) {
+      if (const auto ret = llvm::dyn_cast<llvm::ReturnInst>(&block.back())) {
+        returns.push_back(ret);
+      }
+    }
+
+    llvm::AllocaInst* local{nullptr};
+    for (const auto ret : returns) {
+      const auto load = llvm::dyn_cast<llvm::LoadInst>(ret->getReturnValue());
+      const auto alloca =
+          load ? llvm::dyn_cast<llvm::AllocaInst>(load->getPointerOperand())
+               : nullptr;
+      if (!alloca || (local && local != alloca) || writesBetween(load, ret)) {
+        local = nullptr;
+        break;
+      }
+      local = alloca;
+    }
+    // a local allocated in a loop may be referenced across iterations
+    if (local && (local->getAllocatedType() !=
+                       sret->getType()->getPointerElementType() ||
+                  (local->getParent() != &func->getEntryBlock() &&
+                   llvm::PointerMayBeCaptured(local, true, true)))) {
+      local = nullptr;
+    }
+    if (local) {
+      local->replaceAllUsesWith(sret);
+      local->eraseFromParent();
+    }
+
+    for (const auto ret : returns) {
+      const auto value = ret->getReturnValue();
+      if (!local) {
+        new llvm::StoreInst(value, sret, ret);
+      }
+      llvm::ReturnInst::Create(func->getContext(), ret);
+      ret->eraseFromParent();
+      if (const auto inst = llvm::dyn_cast<llvm::Instruction>(value);
+          inst && inst->use_empty()) {
+        inst->eraseFromParent();
+      }
+    }
+  }
+
+  /// @brief Returns the local the result of call is stored to, if it may be
+  /// passed as the call's destination
+  static llvm::Value* getDestination(llvm::CallInst* const call) {
+    if (!call->hasOneUse()) {
+      return nullptr;
+    }
+    const auto store = llvm::dyn_cast<llvm::StoreInst>(*call->user_begin());
+    if (!store || store->getValueOperand() != call ||
+        store != call->getNextNode()) {
+      return nullptr;
+    }
+    const auto ptr = store->getPointerOperand();
+    // (our own destination is not observable by the callee either)
+    if (const auto arg = llvm::dyn_cast<llvm::Argument>(ptr)) {
+      return arg->hasStructRetAttr() ? ptr : nullptr;
+    }
+    return llvm::isa<llvm::AllocaInst>(ptr) &&
+                   !llvm::PointerMayBeCaptured(ptr, true, true)
+               ? ptr
+               : nullptr;
+  }
+
+  /// @brief Returns a pointer to (a copy of) a large by-value argument.
+  /// Locals which are not written to before the call are not copied
+  static llvm::Value* getReference(llvm::IRBuilder<>& builder,
+                                   llvm::CallInst* const call,
+                                   llvm::Value* const arg) {
+    if (const auto load = llvm::dyn_cast<llvm::LoadInst>(arg)) {
+      const auto ptr = load->getPointerOperand();
+      if (llvm::isa<llvm::AllocaInst>(ptr) &&
+          load->getParent() == call->getParent() &&
+          !writesBetween(load, call) &&
+          !llvm::PointerMayBeCaptured(ptr, true, true)) {
+        return ptr;
+      }
+    }
+    const auto copy = createEntryAlloca(call->getFunction(), arg->getType());
+    builder.CreateStore(arg, copy);
+    return copy;
+  }
+
+  static llvm::AllocaInst* createEntryAlloca(llvm::Function* const func,
+                                             llvm::Type* const type) {
+    auto& entry = func->getEntryBlock();
+    llvm::IRBuilder<> builder{&entry, entry.begin()};
+    return builder.CreateAlloca(type, 0, nullptr, "");
+  }
+
+  /// @brief Whether memory may be written after from, before to
+  static bool writesBetween(const llvm::Instruction* from,
+                            const llvm::Instruction* const to) {
+    for (from = from->getNextNode(); from && from != to;
+         from = from->getNextNode()) {
+      if (from->mayWriteToMemory()) {
+        return true;
+      }
+    }
+    return !from;
+  }
+
+  /// @brief Replaces aggregate load/store pairs with memcpy (or memmove,
+  /// if source and destination may overlap)
+  static bool lowerCopies(llvm::Function& func) {
+    small_vector<llvm::StoreInst*> copies;
+    for (auto& block : func) {
+      for (auto& inst : block) {
+        const auto store = llvm::dyn_cast<llvm::StoreInst>(&inst);
+        if (!store || store->isVolatile() ||
+            !store->getValueOperand()->getType()->isAggregateType()) {
+          continue;
+        }
+        const auto load = llvm::dyn_cast<llvm::LoadInst>(
+            store->getValueOperand());
+        if (load && !load->isVolatile() && load->hasOneUse() &&
+            load->getParent() == store->getParent() &&
+            !writesBetween(load, store)) {
+          copies.push_back(store);
+        }
+      }
+    }
+
+    const auto& dataLayout = func.getParent()->getDataLayout();
+    for (const auto store : copies) {
+      const auto load = llvm::cast<llvm::LoadInst>(store->getValueOperand());
+      const auto type = load->getType();
+      const auto abiAlignment = dataLayout.getABITypeAlignment(type);
+      const auto align = std::min(
+          load->getAlignment() ? load->getAlignment() : abiAlignment,
+          store->getAlignment() ? store->getAlignment() : abiAlignment);
+      const auto size = dataLayout.getTypeStoreSize(type);
+      const auto dst = store->getPointerOperand();
+      const auto src = load->getPointerOperand();
+      const auto dstObject = llvm::GetUnderlyingObject(dst, dataLayout);
+      const auto srcObject = llvm::GetUnderlyingObject(src, dataLayout);
+      llvm::IRBuilder<> builder{store};
+      if (dstObject != srcObject && llvm::isIdentifiedObject(dstObject) &&
+          llvm::isIdentifiedObject(srcObject)) {
+        builder.CreateMemCpy(dst, src, size, align);
+      } else {
+        builder.CreateMemMove(dst, src, size, align);
+      }
+      store->eraseFromParent();
+      load->eraseFromParent();
+    }
+    return !copies.empty();
+  }
+};
+
+} // namespace whack::pass
+
+#endif // WHACK_PASSES_SRET_HPP
@@ -0,0 +1,178 @@
+/**
+ * Copyright 2018 Onchere Bironga
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WHACK_PASSES_TBAA_HPP
+#define WHACK_PASSES_TBAA_HPP
+
+#pragma once
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/Pass.h>
+#include <optional>
+#include <unordered_map>
+
+namespace whack::pass {
+
+/// @brief Tags loads and stores with TBAA type descriptors. Scalar types
+/// descend from "omnipotent char" (used by byte accesses, so that bytes
+/// alias everything) and accesses to fields of named structs get
+/// struct-path tags. Accesses through cast pointers (e.g. data class
+/// payloads or closure environments) are type punned, and left untagged.
+struct TBAA : public llvm::FunctionPass {
+  char pid = getpid();
+  TBAA() : llvm::FunctionPass(pid) {}
+  bool runOnFunction(llvm::Function& func) override {
+    const auto& dataLayout = func.getParent()->getDataLayout();
+    llvm::MDBuilder MDBuilder{func.getContext()};
+    const auto root = MDBuilder.createTBAARoot("whack TBAA");
+    char_ = MDBuilder.createTBAAScalarTypeNode("omnipotent char", root);
+
+    bool changed = false;
+    for (auto& block : func) {
+      for (auto& inst : block) {
+        llvm::Value* ptr;
+        llvm::Type* type;
+        if (const auto load = llvm::dyn_cast<llvm::LoadInst>(&inst)) {
+          ptr = load->getPointerOperand();
+          type = load->getType();
+        } else if (const auto store = llvm::dyn_cast<llvm::StoreInst>(&inst)) {
+          ptr = store->getPointerOperand();
+          type = store->getValueOperand()->getType();
+        } else {
+          continue;
+        }
+        if (inst.getMetadata(llvm::LLVMContext::MD_tbaa) ||
+            type->isAggregateType() || isPunned(ptr)) {
+          continue;
+        }
+
+        const auto access = getTypeNode(MDBuilder, dataLayout, type);
+        auto base = access;
+        uint64_t offset = 0;
+        if (const auto gep = llvm::dyn_cast<llvm::GetElementPtrInst>(ptr)) {
+          if (const auto path = getFieldOffset(dataLayout, gep)) {
+            base = getTypeNode(MDBuilder, dataLayout,
+                               gep->getSourceElementType());
+            offset = path.value();
+          }
+        }
+        inst.setMetadata(llvm::LLVMContext::MD_tbaa,
+                         MDBuilder.createTBAAStructTagNode(base, access,
+                                                           offset));
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+private:
+  llvm::MDNode* char_;
+  std::unordered_map<llvm::Type*, llvm::MDNode*> nodes_;
+
+  /// @brief Returns the type descriptor of type. Pointers share a single
+  /// descriptor, and types we cannot describe are bytes (omnipotent char)
+  llvm::MDNode* getTypeNode(llvm::MDBuilder& MDBuilder,
+                            const llvm::DataLayout& dataLayout,
+                            llvm::Type* type) {
+    while (type->isArrayTy()) {
+      type = type->getArrayElementType();
+    }
+    if (type->isIntegerTy(8) || type->isVectorTy()) {
+      return char_;
+    }
+    if (const auto it = nodes_.find(type); it != nodes_.end()) {
+      return it->second;
+    }
+
+    llvm::MDNode* node;
+    if (type->isPointerTy()) {
+      node = MDBuilder.createTBAAScalarTypeNode("any pointer", char_);
+    } else if (const auto structure = llvm::dyn_cast<llvm::StructType>(type)) {
+      if (structure->isLiteral() || !structure->isSized()) {
+        return char_;
+      }
+      const auto layout = dataLayout.getStructLayout(structure);
+      llvm::SmallVector<std::pair<llvm::MDNode*, uint64_t>, 10> fields;
+      for (unsigned i = 0; i < structure->getNumElements(); ++i) {
+        const auto element = structure->getElementType(i);
+        if (dataLayout.getTypeAllocSize(element) == 0) {
+          continue;
+        }
+        fields.emplace_back(getTypeNode(MDBuilder, dataLayout, element),
+                            layout->getElementOffset(i));
+      }
+      node = MDBuilder.createTBAAStructTypeNode(structure->getName(), fields);
+    } else {
+      std::string name;
+      llvm::raw_string_ostream os{name};
+      type->print(os);
+      node = MDBuilder.createTBAAScalarTypeNode(os.str(), char_);
+    }
+    nodes_[type] = node;
+    return node;
+  }
+
+  /// @brief Returns the offset of the (possibly nested) struct field
+  /// addressed by gep, if it only indexes into structs
+  static std::optional<uint64_t>
+  getFieldOffset(const llvm::DataLayout& dataLayout,
+                 const llvm::GetElementPtrInst* const gep) {
+    const auto structure =
+        llvm::dyn_cast<llvm::StructType>(gep->getSourceElementType());
+    if (!structure || structure->isLiteral() || gep->getNumIndices() < 2) {
+      return std::nullopt;
+    }
+    const auto first = llvm::dyn_cast<llvm::ConstantInt>(gep->getOperand(1));
+    if (!first || !first->isZero()) {
+      return std::nullopt;
+    }
+    uint64_t offset = 0;
+    llvm::Type* type = structure;
+    for (unsigned i = 2; i < gep->getNumOperands(); ++i) {
+      const auto current = llvm::dyn_cast<llvm::StructType>(type);
+      if (!current) {
+        return std::nullopt;
+      }
+      const auto idx =
+          llvm::cast<llvm::ConstantInt>(gep->getOperand(i))->getZExtValue();
+      offset += dataLayout.getStructLayout(current)->getElementOffset(idx);
+      type = current->getElementType(idx);
+    }
+    return offset;
+  }
+
+  /// @brief Whether ptr is addressed through a pointer cast
+  static bool isPunned(const llvm::Value* ptr) {
+    while (true) {
+      if (llvm::isa<llvm::BitCastOperator>(ptr)) {
+        return true;
+      }
+      const auto gep = llvm::dyn_cast<llvm::GEPOperator>(ptr);
+      if (!gep) {
+        return false;
+      }
+      ptr = gep->getPointerOperand();
+    }
+  }
+};
+
+} // namespace whack::pass
+
+#endif // WHACK_PASSES_TBAA_HPP
@@ -16,12 +16,50 @@
 // gcc runtime.c -o ../build/runtime.o -c
 #ifdef _WIN32
 #include <windows.h>
+#else
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
 #endif
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Trampolines are a few dozen bytes (23 on x86-64, 36 on AArch64), so we
+// carve them from per-thread slabs of fixed-size slots instead of mapping
+// a page per trampoline. A slot lives for the duration of the extern call
+// it is made for (the caller frees it when the call returns). Slabs are
+// never unmapped; freed slots are reused.
+enum {
+  kTrampolineSlotSize = 64,
+  kTrampolineSlabPages = 16,
+};
+
+typedef struct __trampoline_slot {
+  union {
+    struct __trampoline_slot* next; // while in the free list
+    unsigned char code[kTrampolineSlotSize - sizeof(ptrdiff_t)];
+  };
+  ptrdiff_t exec; // offset from this (writable) slot to its executable view
+} __trampoline_slot_t;
+
+_Static_assert(sizeof(__trampoline_slot_t) == kTrampolineSlotSize,
+               "trampoline slots must be of a fixed size");
+
+static _Thread_local __trampoline_slot_t* __trampoline_free_list;
+
 #ifdef _WIN32
 
 DWORD __builtin_page_size() {
@@ -30,35 +68,923 @@ DWORD __builtin_page_size() {
   return sysInfo.dwPageSize;
 }
 
-/// Allocates an executable region of memory
-void* __builtin_virtual_alloc() {
-  return VirtualAlloc(NULL, __builtin_page_size(), MEM_COMMIT,
+/// Maps a slab of size bytes, returning its writable view
+static unsigned char* __trampoline_map_slab(const size_t size,
+                                            ptrdiff_t* const exec) {
+  *exec = 0;
+  return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE,
                       PAGE_EXECUTE_READWRITE);
 }
 
-/// Frees a region of memory allocated by __builtin_virtual_alloc
+#else
+
+long __builtin_page_size() { return sysconf(_SC_PAGESIZE); }
+
+/// Maps a slab of size bytes, returning its writable view. The slab
+/// is dual-mapped from a memfd (RW + RX) so that no page is ever
+/// both writable and executable; we only fall back to RWX pages
+/// if the kernel does not support memfd_create.
+static unsigned char* __trampoline_map_slab(const size_t size,
+                                            ptrdiff_t* const exec) {
+#ifdef SYS_memfd_create
+  const int fd = (int)syscall(SYS_memfd_create, "whack-trampolines",
+                              1u /* MFD_CLOEXEC */);
+  if (fd >= 0) {
+    void* rw = MAP_FAILED;
+    void* rx = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+      rw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      rx = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (rw != MAP_FAILED && rx != MAP_FAILED) {
+      *exec = (unsigned char*)rx - (unsigned char*)rw;
+      return rw;
+    }
+    if (rw != MAP_FAILED) {
+      munmap(rw, size);
+    }
+    if (rx != MAP_FAILED) {
+      munmap(rx, size);
+    }
+  }
+#endif
+  *exec = 0;
+  void* const rwx = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return rwx == MAP_FAILED ? NULL : rwx;
+}
+
+#endif
+
+static int __trampoline_refill() {
+  const size_t size = (size_t)__builtin_page_size() * kTrampolineSlabPages;
+  ptrdiff_t exec;
+  unsigned char* const slab = __trampoline_map_slab(size, &exec);
+  if (!slab) {
+    return 0;
+  }
+  for (size_t i = size / kTrampolineSlotSize; i-- > 0;) {
+    __trampoline_slot_t* const slot =
+        (__trampoline_slot_t*)(slab + i * kTrampolineSlotSize);
+    slot->exec = exec;
+    slot->next = __trampoline_free_list;
+    __trampoline_free_list = slot;
+  }
+  return 1;
+}
+
+/// Allocates a (writable) trampoline slot
+void* __builtin_virtual_alloc() {
+  if (!__trampoline_free_list && !__trampoline_refill()) {
+    return NULL;
+  }
+  __trampoline_slot_t* const slot = __trampoline_free_list;
+  __trampoline_free_list = slot->next;
+  return slot->code;
+}
+
+/// Returns the executable address of an initialized trampoline slot
+void* __builtin_virtual_exec(void* const buf) {
+  char* const code = (char*)buf + ((__trampoline_slot_t*)buf)->exec;
+  __builtin___clear_cache(code, code + kTrampolineSlotSize);
+  return code;
+}
+
+/// Frees a slot allocated by __builtin_virtual_alloc. Slots may be freed
+/// by any thread; they are then reused by that thread.
 void __builtin_virtual_free(void* const buf) {
-  VirtualFree(buf, __builtin_page_size(), MEM_RELEASE);
+  if (buf) {
+    __trampoline_slot_t* const slot = (__trampoline_slot_t*)buf;
+    slot->next = __trampoline_free_list;
+    __trampoline_free_list = slot;
+  }
+}
+
+/// FNV-1a hash of size bytes, as computed at compile time for string matches
+uint64_t __builtin_hash_bytes(const char* const data, const size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Channels are bounded MPMC rings with a sequence number per slot, so
+// that sending or receiving is a single CAS when the ring is neither full
+// nor empty. On lap k a slot's sequence number is 2k while it is free and
+// 2k + 1 while it holds a value. Blocked senders and receivers park on futexes.
+// Unbuffered channels are rings of one slot whose senders also wait until
+// their value has been taken (rendezvous). Channels are freed with `delete`
+// once no thread uses them.
+enum {
+  kCacheLineSize = 64,
+  kChanSlotHeader = _Alignof(max_align_t), // the sequence number, padded
+};
+
+typedef struct __chan {
+  _Alignas(kCacheLineSize) _Atomic size_t head; // next send position
+  _Alignas(kCacheLineSize) _Atomic size_t tail; // next receive position
+  // futex words, bumped on every send (resp. receive)
+  _Alignas(kCacheLineSize) _Atomic uint32_t sent;
+  _Atomic uint32_t received;
+  _Atomic uint32_t waiters;
+  _Atomic uint32_t receivers; // parked in a receive or a select
+  size_t size;     // of an element
+  size_t capacity; // in elements
+  size_t stride;   // of a slot
+  int rendezvous;
+  unsigned char* slots;
+} __chan_t;
+
+typedef struct __chan_case {
+  void* chan;
+  void* value; // sent, or received into
+  int32_t send;
+} __chan_case_t;
+
+// select parks on a single futex word, bumped by every channel while
+// some select waits
+static _Atomic uint32_t __chan_select_epoch;
+static _Atomic uint32_t __chan_select_waiters;
+static _Thread_local uint32_t __chan_select_seed;
+
+static void __futex_wait(_Atomic uint32_t* const word, uint32_t expected) {
+#ifdef _WIN32
+  WaitOnAddress((volatile VOID*)word, &expected, sizeof(expected), INFINITE);
+#else
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#endif
 }
 
-#else  // @todo
-#error "Whack currently supports only Windows"
-// const int64_t __builtin_page_size() {
-//   return 72;
-// }
+static void __futex_wake(_Atomic uint32_t* const word) {
+#ifdef _WIN32
+  WakeByAddressAll((PVOID)word);
+#else
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
 
-// /// Allocates an executable region of memory
-// void* __builtin_virtual_alloc() {
-//   return mmap(NULL, __builtin_page_size(), PROT_READ | PROT_WRITE | PROT_EXEC,
-//               MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
-// }
+static void __futex_wake_one(_Atomic uint32_t* const word) {
+#ifdef _WIN32
+  WakeByAddressSingle((PVOID)word);
+#else
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
 
-// /// Frees a region of memory allocated by __builtin_virtual_alloc
-// void __builtin_virtual_free(void* const buf) {
-//   munmap(buf, __builtin_page_size());
-// }
+static void* __chan_alloc(const size_t align, const size_t size) {
+#ifdef _WIN32
+  return _aligned_malloc(size, align);
+#else
+  return aligned_alloc(align, size);
+#endif
+}
 
+static void __chan_dealloc(void* const ptr) {
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  free(ptr);
 #endif
+}
+
+// Waiters register (in waiters) before reading the futex word and
+// retrying, and notifiers bump the word before reading waiters, so that
+// either the waiter sees the change or the notifier sees the waiter.
+static void __chan_notify(__chan_t* const chan, _Atomic uint32_t* const word) {
+  atomic_fetch_add(word, 1);
+  if (atomic_load(&chan->waiters)) {
+    __futex_wake(word);
+  }
+  if (atomic_load(&__chan_select_waiters)) {
+    atomic_fetch_add(&__chan_select_epoch, 1);
+    __futex_wake(&__chan_select_epoch);
+  }
+}
+
+static unsigned char* __chan_slot(const __chan_t* const chan,
+                                  const size_t pos) {
+  return chan->slots + (pos % chan->capacity) * chan->stride;
+}
+
+static int __chan_try_send(__chan_t* const chan, const void* const value,
+                           size_t* const ticket) {
+  size_t pos = atomic_load_explicit(&chan->head, memory_order_relaxed);
+  for (;;) {
+    unsigned char* const slot = __chan_slot(chan, pos);
+    const size_t seq = atomic_load_explicit((_Atomic size_t*)slot,
+                                            memory_order_acquire);
+    const ptrdiff_t diff = (ptrdiff_t)(seq - 2 * (pos / chan->capacity));
+    if (diff < 0) {
+      return 0; // full
+    }
+    if (diff > 0) {
+      pos = atomic_load_explicit(&chan->head, memory_order_relaxed);
+    } else if (atomic_compare_exchange_weak_explicit(
+                   &chan->head, &pos, pos + 1, memory_order_relaxed,
+                   memory_order_relaxed)) {
+      memcpy(slot + kChanSlotHeader, value, chan->size);
+      atomic_store_explicit((_Atomic size_t*)slot, seq + 1,
+                            memory_order_release);
+      __chan_notify(chan, &chan->sent);
+      *ticket = pos;
+      return 1;
+    }
+  }
+}
+
+static int __chan_try_recv(__chan_t* const chan, void* const value) {
+  size_t pos = atomic_load_explicit(&chan->tail, memory_order_relaxed);
+  for (;;) {
+    unsigned char* const slot = __chan_slot(chan, pos);
+    const size_t seq = atomic_load_explicit((_Atomic size_t*)slot,
+                                            memory_order_acquire);
+    const ptrdiff_t diff =
+        (ptrdiff_t)(seq - (2 * (pos / chan->capacity) + 1));
+    if (diff < 0) {
+      return 0; // empty
+    }
+    if (diff > 0) {
+      pos = atomic_load_explicit(&chan->tail, memory_order_relaxed);
+    } else if (atomic_compare_exchange_weak_explicit(
+                   &chan->tail, &pos, pos + 1, memory_order_relaxed,
+                   memory_order_relaxed)) {
+      memcpy(value, slot + kChanSlotHeader, chan->size);
+      atomic_store_explicit((_Atomic size_t*)slot, seq + 1,
+                            memory_order_release);
+      __chan_notify(chan, &chan->received);
+      return 1;
+    }
+  }
+}
+
+/// Waits until the value sent at ticket is taken by a receiver
+static void __chan_wait_taken(__chan_t* const chan, const size_t ticket) {
+  if (atomic_load(&chan->tail) > ticket) {
+    return;
+  }
+  atomic_fetch_add(&chan->waiters, 1);
+  for (;;) {
+    const uint32_t epoch = atomic_load(&chan->received);
+    if (atomic_load(&chan->tail) > ticket) {
+      break;
+    }
+    __futex_wait(&chan->received, epoch);
+  }
+  atomic_fetch_sub(&chan->waiters, 1);
+}
+
+/// Takes back the value sent at ticket unless a receiver has taken it,
+/// returning whether it did
+static int __chan_retract(__chan_t* const chan, const size_t ticket) {
+  size_t pos = ticket;
+  if (!atomic_compare_exchange_strong(&chan->tail, &pos, ticket + 1)) {
+    return 0;
+  }
+  unsigned char* const slot = __chan_slot(chan, ticket);
+  const size_t seq = atomic_load_explicit((_Atomic size_t*)slot,
+                                          memory_order_relaxed);
+  atomic_store_explicit((_Atomic size_t*)slot, seq + 1, memory_order_release);
+  __chan_notify(chan, &chan->received);
+  return 1;
+}
+
+/// Hands value over to a parked receiver of an unbuffered channel (other
+/// than the own receivers of the caller) without blocking on other senders,
+/// returning whether it was taken. The value is retracted when the
+/// receivers leave without taking it (e.g. selects choosing other cases).
+static int __chan_try_handoff(__chan_t* const chan, const void* const value,
+                              const uint32_t own) {
+  size_t ticket;
+  if (atomic_load(&chan->receivers) <= own ||
+      !__chan_try_send(chan, value, &ticket)) {
+    return 0;
+  }
+  int taken = 1;
+  atomic_fetch_add(&chan->waiters, 1);
+  for (;;) {
+    const uint32_t epoch = atomic_load(&chan->received);
+    if (atomic_load(&chan->tail) > ticket) {
+      break;
+    }
+    if (atomic_load(&chan->receivers) <= own) {
+      taken = !__chan_retract(chan, ticket);
+      break;
+    }
+    __futex_wait(&chan->received, epoch);
+  }
+  atomic_fetch_sub(&chan->waiters, 1);
+  return taken;
+}
+
+/// Makes a channel of elements of size bytes, unbuffered if capacity is 0
+void* __builtin_chan_make(const uint64_t size, const uint32_t capacity) {
+  __chan_t* const chan = __chan_alloc(kCacheLineSize, sizeof(__chan_t));
+  if (!chan) {
+    return NULL;
+  }
+  chan->size = (size_t)size;
+  chan->rendezvous = capacity == 0;
+  chan->capacity = capacity ? capacity : 1;
+  chan->stride = kChanSlotHeader + (chan->size + kChanSlotHeader - 1) /
+                                       kChanSlotHeader * kChanSlotHeader;
+  chan->slots = __chan_alloc(kChanSlotHeader, chan->stride * chan->capacity);
+  if (!chan->slots) {
+    __chan_dealloc(chan);
+    return NULL;
+  }
+  for (size_t i = 0; i < chan->capacity; ++i) {
+    atomic_init((_Atomic size_t*)(chan->slots + i * chan->stride), 0);
+  }
+  atomic_init(&chan->head, 0);
+  atomic_init(&chan->tail, 0);
+  atomic_init(&chan->sent, 0);
+  atomic_init(&chan->received, 0);
+  atomic_init(&chan->waiters, 0);
+  atomic_init(&chan->receivers, 0);
+  return chan;
+}
+
+/// Frees a channel made by __builtin_chan_make
+void __builtin_chan_free(void* const handle) {
+  __chan_t* const chan = handle;
+  if (chan) {
+    __chan_dealloc(chan->slots);
+    __chan_dealloc(chan);
+  }
+}
+
+/// Sends the element at value, blocking while the channel is full (or,
+/// for unbuffered channels, until a receiver takes it)
+void __builtin_chan_send(void* const handle, const void* const value) {
+  __chan_t* const chan = handle;
+  size_t ticket;
+  if (!__chan_try_send(chan, value, &ticket)) {
+    atomic_fetch_add(&chan->waiters, 1);
+    for (;;) {
+      const uint32_t epoch = atomic_load(&chan->received);
+      if (__chan_try_send(chan, value, &ticket)) {
+        break;
+      }
+      __futex_wait(&chan->received, epoch);
+    }
+    atomic_fetch_sub(&chan->waiters, 1);
+  }
+  if (chan->rendezvous) {
+    __chan_wait_taken(chan, ticket);
+  }
+}
+
+/// Receives an element into value, blocking while the channel is empty
+void __builtin_chan_recv(void* const handle, void* const value) {
+  __chan_t* const chan = handle;
+  if (__chan_try_recv(chan, value)) {
+    return;
+  }
+  atomic_fetch_add(&chan->waiters, 1);
+  atomic_fetch_add(&chan->receivers, 1);
+  __chan_notify(chan, &chan->received); // (for selects handing over)
+  for (;;) {
+    const uint32_t epoch = atomic_load(&chan->sent);
+    if (__chan_try_recv(chan, value)) {
+      break;
+    }
+    __futex_wait(&chan->sent, epoch);
+  }
+  atomic_fetch_sub(&chan->receivers, 1);
+  atomic_fetch_sub(&chan->waiters, 1);
+  __chan_notify(chan, &chan->received); // (for senders handing over)
+}
+
+/// Polls the cases from a random one on, so that no ready case starves.
+/// (an unbuffered send is ready once a receiver is parked to take it; a
+/// parked select does not receive from itself)
+static int32_t __chan_poll(__chan_case_t* const cases, const int32_t n,
+                           const int parked) {
+  if (n <= 0) {
+    return -1;
+  }
+  uint32_t seed = __chan_select_seed;
+  if (!seed) {
+    seed = (uint32_t)(uintptr_t)&__chan_select_seed | 1u;
+  }
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  __chan_select_seed = seed;
+  for (int32_t i = 0; i < n; ++i) {
+    const int32_t idx = (int32_t)((seed + (uint32_t)i) % (uint32_t)n);
+    __chan_t* const chan = cases[idx].chan;
+    size_t ticket;
+    if (cases[idx].send) {
+      uint32_t own = 0;
+      for (int32_t j = 0; parked && j < n; ++j) {
+        own += !cases[j].send && cases[j].chan == chan;
+      }
+      if (chan->rendezvous
+              ? __chan_try_handoff(chan, cases[idx].value, own)
+              : __chan_try_send(chan, cases[idx].value, &ticket)) {
+        return idx;
+      }
+    } else if (__chan_try_recv(chan, cases[idx].value)) {
+      return idx;
+    }
+  }
+  return -1;
+}
+
+/// Runs one ready case of a select, returning its index. If none is
+/// ready, returns -1 if the select has a default case, or blocks
+int32_t __builtin_chan_select(__chan_case_t* const cases, const int32_t n,
+                              const int32_t hasDefault) {
+  int32_t chosen = __chan_poll(cases, n, 0);
+  if (chosen >= 0 || hasDefault) {
+    return chosen;
+  }
+  // parked selects are receivers of their receive cases, which senders
+  // hand over to (and take back from once the select leaves)
+  atomic_fetch_add(&__chan_select_waiters, 1);
+  for (int32_t i = 0; i < n; ++i) {
+    if (!cases[i].send) {
+      __chan_t* const chan = cases[i].chan;
+      atomic_fetch_add(&chan->receivers, 1);
+      __chan_notify(chan, &chan->received);
+    }
+  }
+  for (;;) {
+    const uint32_t epoch = atomic_load(&__chan_select_epoch);
+    if ((chosen = __chan_poll(cases, n, 1)) >= 0) {
+      break;
+    }
+    __futex_wait(&__chan_select_epoch, epoch);
+  }
+  for (int32_t i = 0; i < n; ++i) {
+    if (!cases[i].send) {
+      __chan_t* const chan = cases[i].chan;
+      atomic_fetch_sub(&chan->receivers, 1);
+      __chan_notify(chan, &chan->received);
+    }
+  }
+  atomic_fetch_sub(&__chan_select_waiters, 1);
+  return chosen;
+}
+
+// Async calls are tasks of a work-stealing scheduler. Every thread which
+// launches tasks owns a Chase-Lev deque, pushing and taking tasks at its
+// bottom, while other threads steal from its top; a push or a take is then
+// a couple of plain loads and stores unless the deque is nearly empty.
+// The pool has a worker per core (counting the launching thread), unless
+// WHACK_WORKERS is set. Idle workers park on a futex, which launches only
+// bump while some worker sleeps. A task is a single allocation of its
+// header, a copy of the arguments of the call and its result, and is the
+// future of the call. Threads awaiting a future run other tasks until it
+// is ready, then park on it. Futures which are not awaited are detached by
+// `delete`, freeing the task once it is done.
+enum {
+  kSchedMaxDeques = 256,
+  kSchedDequeCapacity = 256, // initial, in tasks
+  kSchedSpins = 64,          // find attempts before a worker parks
+  kTaskHeader = kCacheLineSize,
+};
+
+enum { kTaskPending, kTaskDone, kTaskWaited, kTaskSuspended, kTaskDetached };
+
+typedef struct __task {
+  void (*fn)(void* env, void* result);
+  _Atomic uint32_t state;
+  size_t result;     // offset of the result
+  size_t resultSize;
+  void* awaiter;     // the coroutine suspended on this task, if any
+} __task_t;
+
+_Static_assert(sizeof(__task_t) <= kTaskHeader,
+               "task headers must fit in a cache line");
+
+typedef struct __deque_array {
+  int64_t capacity;               // a power of two
+  struct __deque_array* retired; // the array we outgrew
+  _Atomic(__task_t*) tasks[];
+} __deque_array_t;
+
+typedef struct __deque {
+  _Alignas(kCacheLineSize) _Atomic int64_t top;    // next steal position
+  _Alignas(kCacheLineSize) _Atomic int64_t bottom; // next push position
+  _Atomic(__deque_array_t*) array;
+} __deque_t;
+
+static __deque_t* _Atomic __sched_deques[kSchedMaxDeques];
+static _Atomic uint32_t __sched_num_deques;
+static _Atomic uint32_t __sched_epoch;
+static _Atomic uint32_t __sched_sleepers;
+static _Atomic int __sched_started;
+static _Thread_local __deque_t* __sched_self;
+static _Thread_local uint32_t __sched_seed;
+
+static size_t __task_align(const size_t size) {
+  return (size + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
+}
+
+static void* __task_env(__task_t* const task) {
+  return (unsigned char*)task + kTaskHeader;
+}
+
+static void* __task_result(__task_t* const task) {
+  return (unsigned char*)task + task->result;
+}
+
+static void __task_free(__task_t* const task) {
+#ifdef _WIN32
+  _aligned_free(task);
+#else
+  free(task);
+#endif
+}
+
+/// Resumes a (switched-resume) coroutine, whose frame starts with a
+/// pointer to its resume function
+static void __coro_resume(void* const handle) {
+  (*(void (**)(void*))handle)(handle);
+}
+
+static void __task_run(__task_t* const task) {
+  task->fn(__task_env(task), __task_result(task));
+  // the awaiting thread may free the task as soon as it is done
+  switch (atomic_exchange(&task->state, kTaskDone)) {
+  case kTaskWaited:
+    __futex_wake(&task->state);
+    break;
+  case kTaskSuspended:
+    __coro_resume(task->awaiter);
+    break;
+  case kTaskDetached:
+    __task_free(task);
+    break;
+  }
+}
+
+static __deque_array_t* __deque_array_make(const int64_t capacity) {
+  __deque_array_t* const array =
+      malloc(sizeof(__deque_array_t) + (size_t)capacity * sizeof(__task_t*));
+  if (array) {
+    array->capacity = capacity;
+    array->retired = NULL;
+  }
+  return array;
+}
+
+/// Gives the calling thread a deque, if there is room for it
+static __deque_t* __deque_register() {
+  const uint32_t idx = atomic_fetch_add(&__sched_num_deques, 1);
+  if (idx >= kSchedMaxDeques) {
+    return NULL;
+  }
+  __deque_t* const deque = __chan_alloc(kCacheLineSize, sizeof(__deque_t));
+  __deque_array_t* const array =
+      deque ? __deque_array_make(kSchedDequeCapacity) : NULL;
+  if (!array) {
+    return NULL;
+  }
+  atomic_init(&deque->top, 0);
+  atomic_init(&deque->bottom, 0);
+  atomic_init(&deque->array, array);
+  atomic_store(&__sched_deques[idx], deque);
+  return deque;
+}
+
+static int __deque_push(__deque_t* const deque, __task_t* const task) {
+  const int64_t bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  const int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  __deque_array_t* array =
+      atomic_load_explicit(&deque->array, memory_order_relaxed);
+  if (bottom - top > array->capacity - 1) {
+    // thieves may still read the old array, so we keep it around
+    __deque_array_t* const grown = __deque_array_make(2 * array->capacity);
+    if (!grown) {
+      return 0;
+    }
+    for (int64_t i = top; i < bottom; ++i) {
+      atomic_store_explicit(
+          &grown->tasks[i & (grown->capacity - 1)],
+          atomic_load_explicit(&array->tasks[i & (array->capacity - 1)],
+                               memory_order_relaxed),
+          memory_order_relaxed);
+    }
+    grown->retired = array;
+    atomic_store_explicit(&deque->array, grown, memory_order_release);
+    array = grown;
+  }
+  atomic_store_explicit(&array->tasks[bottom & (array->capacity - 1)], task,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  return 1;
+}
+
+/// Takes the newest task of the deque of this thread
+static __task_t* __deque_take(__deque_t* const deque) {
+  const int64_t bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  __deque_array_t* const array =
+      atomic_load_explicit(&deque->array, memory_order_relaxed);
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+  __task_t* task = NULL;
+  if (top <= bottom) {
+    task = atomic_load_explicit(&array->tasks[bottom & (array->capacity - 1)],
+                                memory_order_relaxed);
+    if (top != bottom) {
+      return task;
+    }
+    // the last task, which thieves race us for
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+      task = NULL;
+    }
+  }
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  return task;
+}
+
+/// Steals the oldest task of a deque, setting lost if we lost a race for it
+static __task_t* __deque_steal(__deque_t* const deque, int* const lost) {
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  const int64_t bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (top >= bottom) {
+    return NULL;
+  }
+  __deque_array_t* const array =
+      atomic_load_explicit(&deque->array, memory_order_acquire);
+  __task_t* const task = atomic_load_explicit(
+      &array->tasks[top & (array->capacity - 1)], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    *lost = 1;
+    return NULL;
+  }
+  return task;
+}
+
+/// Takes a task of this thread, or steals one (trying deques from a
+/// random one on, so that thieves spread over victims)
+static __task_t* __sched_find() {
+  if (__sched_self) {
+    __task_t* const task = __deque_take(__sched_self);
+    if (task) {
+      return task;
+    }
+  }
+  uint32_t seed = __sched_seed;
+  if (!seed) {
+    seed = (uint32_t)(uintptr_t)&__sched_seed | 1u;
+  }
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  __sched_seed = seed;
+  for (;;) {
+    uint32_t n = atomic_load(&__sched_num_deques);
+    n = n < kSchedMaxDeques ? n : kSchedMaxDeques;
+    int lost = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      __deque_t* const deque = atomic_load_explicit(
+          &__sched_deques[(seed + i) % n], memory_order_acquire);
+      if (deque && deque != __sched_self) {
+        __task_t* const task = __deque_steal(deque, &lost);
+        if (task) {
+          return task;
+        }
+      }
+    }
+    if (!lost) {
+      return NULL;
+    }
+  }
+}
+
+// Sleepers register before reading the epoch and looking for tasks, and
+// launches push before reading sleepers (see __chan_notify)
+static void __sched_notify() {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&__sched_sleepers, memory_order_relaxed)) {
+    atomic_fetch_add(&__sched_epoch, 1);
+    __futex_wake_one(&__sched_epoch);
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI __sched_worker(LPVOID arg) {
+#else
+static void* __sched_worker(void* arg) {
+#endif
+  (void)arg;
+  for (;;) {
+    __task_t* task = NULL;
+    for (int i = 0; i < kSchedSpins && !task; ++i) {
+      task = __sched_find();
+    }
+    if (!task) {
+      atomic_fetch_add(&__sched_sleepers, 1);
+      for (;;) {
+        const uint32_t epoch = atomic_load(&__sched_epoch);
+        if ((task = __sched_find())) {
+          break;
+        }
+        __futex_wait(&__sched_epoch, epoch);
+      }
+      atomic_fetch_sub(&__sched_sleepers, 1);
+    }
+    __task_run(task);
+  }
+  return 0;
+}
+
+/// Starts the workers, on the first launch
+static void __sched_start() {
+  if (atomic_load_explicit(&__sched_started, memory_order_relaxed) ||
+      atomic_exchange(&__sched_started, 1)) {
+    return;
+  }
+  const char* const env = getenv("WHACK_WORKERS");
+  long workers = env ? strtol(env, NULL, 10) : 0;
+  if (workers <= 0) {
+#ifdef _WIN32
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo(&sysInfo);
+    workers = (long)sysInfo.dwNumberOfProcessors;
+#else
+    workers = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  }
+  // the launching thread works too (while awaiting)
+  workers = workers > 1 ? workers - 1 : 1;
+#ifndef _WIN32
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+#endif
+  for (long i = 0; i < workers; ++i) {
+#ifdef _WIN32
+    const HANDLE thread = CreateThread(NULL, 0, __sched_worker, NULL, 0, NULL);
+    if (thread) {
+      CloseHandle(thread);
+    }
+#else
+    pthread_t thread;
+    pthread_create(&thread, &attr, __sched_worker, NULL);
+#endif
+  }
+#ifndef _WIN32
+  pthread_attr_destroy(&attr);
+#endif
+}
+
+/// Launches fn on a copy of the envSize bytes at env, returning the future
+/// of its result (of resultSize bytes). Without room for the copy, fn runs
+/// inline on env; returns NULL if there is no room for the result either.
+void* __builtin_async(void (*const fn)(void*, void*), const void* const env,
+                      const uint64_t envSize, const uint64_t resultSize) {
+  const size_t result = kTaskHeader + __task_align((size_t)envSize);
+  __task_t* const task = __chan_alloc(
+      kCacheLineSize, result + __task_align((size_t)resultSize));
+  if (!task) {
+    __task_t* const done = __chan_alloc(
+        kCacheLineSize, kTaskHeader + __task_align((size_t)resultSize));
+    if (!done) {
+      return NULL;
+    }
+    done->fn = fn;
+    atomic_init(&done->state, kTaskDone);
+    done->result = kTaskHeader;
+    done->resultSize = (size_t)resultSize;
+    done->awaiter = NULL;
+    fn((void*)env, __task_result(done));
+    return done;
+  }
+  task->fn = fn;
+  atomic_init(&task->state, kTaskPending);
+  task->result = result;
+  task->resultSize = (size_t)resultSize;
+  task->awaiter = NULL;
+  memcpy(__task_env(task), env, (size_t)envSize);
+
+  __sched_start();
+  if (!__sched_self) {
+    __sched_self = __deque_register();
+  }
+  if (!__sched_self || !__deque_push(__sched_self, task)) {
+    __task_run(task); // we cannot queue it
+    return task;
+  }
+  __sched_notify();
+  return task;
+}
+
+/// Waits for a future, running other tasks meanwhile, and copies its result
+/// to result. A future is awaited (and freed) once.
+void __builtin_await(void* const handle, void* const result) {
+  __task_t* const task = handle;
+  while (atomic_load_explicit(&task->state, memory_order_acquire) !=
+         kTaskDone) {
+    __task_t* const other = __sched_find();
+    if (other) {
+      __task_run(other);
+      continue;
+    }
+    uint32_t state = kTaskPending;
+    if (atomic_compare_exchange_strong(&task->state, &state, kTaskWaited) ||
+        state == kTaskWaited) {
+      __futex_wait(&task->state, kTaskWaited);
+    }
+  }
+  if (result) {
+    memcpy(result, __task_result(task), task->resultSize);
+  }
+  __task_free(task);
+}
+
+/// Detaches a future which is not awaited: its task is freed once done
+void __builtin_future_free(void* const handle) {
+  __task_t* const task = handle;
+  uint32_t state = kTaskPending;
+  if (task &&
+      !atomic_compare_exchange_strong(&task->state, &state, kTaskDetached)) {
+    __task_free(task); // (done)
+  }
+}
+
+/// Suspends the coroutine awaiter on a future, which resumes it once
+/// ready. Returns 0 (not suspending) if the future is already ready.
+int32_t __builtin_await_suspend(void* const handle, void* const awaiter) {
+  __task_t* const task = handle;
+  task->awaiter = awaiter;
+  uint32_t state = kTaskPending;
+  return atomic_compare_exchange_strong(&task->state, &state, kTaskSuspended);
+}
+
+// Coroutine frames are allocated through these hooks (unless CoroElide
+// puts them on the stack of their caller). Coroutines hand their values
+// over to their awaiter through their promise: the awaiter resumes the
+// coroutine, which runs until its next value (or until it suspends on a
+// future, in which case it is later resumed by the task scheduler). Then
+// whichever of the coroutine (yielding) and awaiter (waiting) comes second
+// in handoff carries on: a yielding coroutine resumes a suspended awaiter
+// (or wakes a blocked one), and a waiting awaiter takes the value.
+enum { kCoroRunning, kCoroYielded, kCoroAwaited };
+
+typedef struct __coro_promise {
+  void* awaiter; // the coroutine awaiting our next value, if any
+  _Atomic uint32_t handoff;
+} __coro_promise_t;
+
+void* __builtin_coro_alloc(const uint64_t size) { return malloc(size); }
+
+void __builtin_coro_free(void* const frame) { free(frame); }
+
+/// Hands the value of a coroutine over to its awaiter (the coroutine then
+/// suspends)
+void __builtin_coro_yield(void* const promise) {
+  __coro_promise_t* const coro = promise;
+  // the awaiter may destroy the coroutine once it has the value
+  void* const awaiter = coro->awaiter;
+  if (atomic_exchange(&coro->handoff, kCoroYielded) == kCoroAwaited) {
+    if (awaiter) {
+      __coro_resume(awaiter);
+    } else {
+      __futex_wake(&coro->handoff);
+    }
+  }
+}
+
+/// Waits for the next value of the coroutine we resumed. Awaiting
+/// coroutines suspend if it is not ready (returning 1), while threads
+/// block, running other tasks meanwhile.
+int32_t __builtin_coro_wait(void* const promise) {
+  __coro_promise_t* const coro = promise;
+  const int suspends = coro->awaiter != NULL;
+  if (atomic_exchange(&coro->handoff, kCoroAwaited) == kCoroYielded) {
+    return 0;
+  }
+  if (suspends) {
+    return 1;
+  }
+  while (atomic_load_explicit(&coro->handoff, memory_order_acquire) !=
+         kCoroYielded) {
+    __task_t* const task = __sched_find();
+    if (task) {
+      __task_run(task);
+    } else {
+      __futex_wait(&coro->handoff, kCoroAwaited);
+    }
+  }
+  return 0;
+}
 
 #ifdef __cplusplus
 }
@@ -28,7 +28,8 @@ INTERNAL_CONSTANTS = [
 ]
 
 INTERNAL_TAGS = [
-	"noinline", "inline", "mustinline", "noreturn"
+	"noinline", "inline", "mustinline", "noreturn", "packed", "align", "bits",
+	"reorder", "soa"
 ]
 
 def getKeywordsList():